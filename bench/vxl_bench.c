@@ -0,0 +1,1118 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <time.h>
+#include <sys/resource.h>
+#endif
+
+#include "libvxl.h"
+
+// Generates procedural maps, then times loading, encoding, edits and queries
+// on them. Every measurement is printed as one JSON object per line:
+//
+// {"map":"caves","size":"512x512x64","bench":"write","ops":5,"bytes":...,
+//  "seconds":...,"ops_per_sec":...,"mb_per_sec":...,"p50_ns":...,
+//  "p90_ns":...,"p99_ns":...,"max_ns":...,"peak_rss_kb":...}
+//
+// Latencies of single edits are taken per call. Queries are too fast for
+// that, they are timed in groups of BENCH_GROUP calls and every group
+// contributes its average to the percentiles. peak_rss_kb is the peak of the
+// whole process up to the end of that measurement.
+//
+// Each map is followed by a line with its libvxl_map_stats(). If libvxl was
+// built with LIBVXL_COUNTERS, every workload is followed by a line with the
+// counters it caused.
+//
+// Results are checked where that is cheap, the bench exits with an error
+// instead of timing a library that gives wrong answers.
+
+#define BENCH_GROUP 256
+#define BENCH_STREAM_CHUNK 8192
+#define BENCH_FILE "vxl_bench.vxl"
+
+struct bench_size {
+	size_t width, height, depth;
+};
+
+struct bench_world {
+	size_t width, height, depth;
+	uint8_t* solid;
+	uint32_t* ground;
+	uint64_t seed;
+};
+
+struct bench_buffer {
+	uint8_t* data;
+	size_t length, capacity;
+};
+
+struct bench_result {
+	const char* map;
+	struct bench_size size;
+	const char* bench;
+	size_t ops;
+	size_t bytes;
+	double seconds;
+	uint64_t* latencies;
+	size_t latency_count;
+};
+
+static uint64_t bench_now(void) {
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if(!frequency.QuadPart)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000
+		+ (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000
+		/ frequency.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+#endif
+}
+
+static size_t bench_peak_rss(void) {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.PeakWorkingSetSize / 1024;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage))
+		return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss / 1024;
+#else
+	return (size_t)usage.ru_maxrss;
+#endif
+#endif
+}
+
+static void* bench_malloc(size_t size) {
+	void* ptr = malloc(size ? size : 1);
+	if(!ptr) {
+		fprintf(stderr, "vxl_bench: out of memory\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+static uint64_t bench_hash(uint64_t x) {
+	x ^= x >> 33;
+	x *= 0xFF51AFD7ED558CCDULL;
+	x ^= x >> 33;
+	x *= 0xC4CEB9FE1A85EC53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+static uint64_t bench_random(uint64_t* state) {
+	*state += 0x9E3779B97F4A7C15ULL;
+	return bench_hash(*state);
+}
+
+static size_t bench_random_range(uint64_t* state, size_t range) {
+	return range ? (size_t)(bench_random(state) % range) : 0;
+}
+
+static float bench_lattice(uint64_t seed, size_t x, size_t y, size_t z) {
+	uint64_t h = bench_hash(seed ^ (x * 0x8DA6B343ULL) ^ (y * 0xD8163841ULL)
+							^ (z * 0xCB1AB31FULL));
+	return (float)(h >> 40) / (float)(1 << 24);
+}
+
+static float bench_smooth(float t) {
+	return t * t * (3.0F - 2.0F * t);
+}
+
+static float bench_mix(float a, float b, float t) {
+	return a + (b - a) * t;
+}
+
+// value noise on a lattice of *cell* blocks, wraps around at the map border
+// so that the generated map tiles like the format expects
+static float bench_noise2(struct bench_world* world, uint64_t seed, size_t x,
+						  size_t y, size_t cell) {
+	size_t cells_x = world->width / cell ? world->width / cell : 1;
+	size_t cells_y = world->height / cell ? world->height / cell : 1;
+	size_t x0 = x / cell % cells_x, x1 = (x0 + 1) % cells_x;
+	size_t y0 = y / cell % cells_y, y1 = (y0 + 1) % cells_y;
+	float tx = bench_smooth((float)(x % cell) / (float)cell);
+	float ty = bench_smooth((float)(y % cell) / (float)cell);
+	return bench_mix(bench_mix(bench_lattice(seed, x0, y0, 0),
+							   bench_lattice(seed, x1, y0, 0), tx),
+					 bench_mix(bench_lattice(seed, x0, y1, 0),
+							   bench_lattice(seed, x1, y1, 0), tx),
+					 ty);
+}
+
+static float bench_noise3(struct bench_world* world, uint64_t seed, size_t x,
+						  size_t y, size_t z, size_t cell) {
+	size_t cells_x = world->width / cell ? world->width / cell : 1;
+	size_t cells_y = world->height / cell ? world->height / cell : 1;
+	size_t x0 = x / cell % cells_x, x1 = (x0 + 1) % cells_x;
+	size_t y0 = y / cell % cells_y, y1 = (y0 + 1) % cells_y;
+	size_t z0 = z / cell, z1 = z0 + 1;
+	float tx = bench_smooth((float)(x % cell) / (float)cell);
+	float ty = bench_smooth((float)(y % cell) / (float)cell);
+	float tz = bench_smooth((float)(z % cell) / (float)cell);
+	float a = bench_mix(bench_mix(bench_lattice(seed, x0, y0, z0),
+								  bench_lattice(seed, x1, y0, z0), tx),
+						bench_mix(bench_lattice(seed, x0, y1, z0),
+								  bench_lattice(seed, x1, y1, z0), tx),
+						ty);
+	float b = bench_mix(bench_mix(bench_lattice(seed, x0, y0, z1),
+								  bench_lattice(seed, x1, y0, z1), tx),
+						bench_mix(bench_lattice(seed, x0, y1, z1),
+								  bench_lattice(seed, x1, y1, z1), tx),
+						ty);
+	return bench_mix(a, b, tz);
+}
+
+static size_t bench_index(struct bench_world* world, size_t x, size_t y,
+						  size_t z) {
+	return z + (x + y * world->width) * world->depth;
+}
+
+static bool bench_solid(struct bench_world* world, size_t x, size_t y,
+						size_t z) {
+	size_t idx = bench_index(world, x, y, z);
+	return world->solid[idx / 8] & (1 << (idx % 8));
+}
+
+static void bench_put(struct bench_world* world, size_t x, size_t y, size_t z,
+					  bool solid) {
+	size_t idx = bench_index(world, x, y, z);
+	if(solid)
+		world->solid[idx / 8] |= 1 << (idx % 8);
+	else
+		world->solid[idx / 8] &= ~(1 << (idx % 8));
+}
+
+// z of the topmost block, *hills* scales how far the ground may rise above
+// three quarters of the map depth
+static void bench_terrain(struct bench_world* world, float hills) {
+	for(size_t y = 0; y < world->height; y++) {
+		for(size_t x = 0; x < world->width; x++) {
+			float n = 0.0F, amplitude = 0.5F;
+			for(size_t cell = 128; cell >= 8; cell /= 2) {
+				n += bench_noise2(world, world->seed + cell, x, y, cell)
+					* amplitude;
+				amplitude *= 0.5F;
+			}
+
+			float top = (float)world->depth * (0.75F - hills * n);
+			size_t ground = top < 1.0F ? 1 : (size_t)top;
+			if(ground > world->depth - 2)
+				ground = world->depth - 2;
+
+			world->ground[x + y * world->width] = (uint32_t)ground;
+			for(size_t z = ground; z < world->depth; z++)
+				bench_put(world, x, y, z, true);
+		}
+	}
+}
+
+static void bench_caves(struct bench_world* world) {
+	for(size_t y = 0; y < world->height; y++) {
+		for(size_t x = 0; x < world->width; x++) {
+			size_t ground = world->ground[x + y * world->width];
+			for(size_t z = ground + 3; z + 2 < world->depth; z++) {
+				float n = bench_noise3(world, world->seed * 3, x, y, z, 16)
+						* 0.7F
+					+ bench_noise3(world, world->seed * 5, x, y, z, 8) * 0.3F;
+				if(n > 0.58F)
+					bench_put(world, x, y, z, false);
+			}
+		}
+	}
+}
+
+// hollow boxes with floors and windows, one per lot of 32x32 columns
+static void bench_buildings(struct bench_world* world) {
+	uint64_t state = world->seed * 7;
+	for(size_t ly = 0; ly + 32 <= world->height; ly += 32) {
+		for(size_t lx = 0; lx + 32 <= world->width; lx += 32) {
+			if(bench_random_range(&state, 4) == 0)
+				continue;
+			size_t sx = 8 + bench_random_range(&state, 17);
+			size_t sy = 8 + bench_random_range(&state, 17);
+			size_t ox = lx + 2 + bench_random_range(&state, 30 - sx);
+			size_t oy = ly + 2 + bench_random_range(&state, 30 - sy);
+
+			size_t base = world->depth;
+			for(size_t y = oy; y < oy + sy; y++)
+				for(size_t x = ox; x < ox + sx; x++)
+					if(world->ground[x + y * world->width] < base)
+						base = world->ground[x + y * world->width];
+			size_t max_height = base > 2 ? base - 2 : 0;
+			if(max_height > 48)
+				max_height = 48;
+			if(max_height < 6)
+				continue;
+			size_t height = 6 + bench_random_range(&state, max_height - 5);
+
+			for(size_t y = oy; y < oy + sy; y++) {
+				for(size_t x = ox; x < ox + sx; x++) {
+					bool wall = x == ox || y == oy || x == ox + sx - 1
+						|| y == oy + sy - 1;
+					size_t ground = world->ground[x + y * world->width];
+					for(size_t z = base - height; z < ground; z++) {
+						size_t level = base - z;
+						bool floor = level % 5 == 0 || z == base - height;
+						bool window = wall && level % 5 >= 2 && level % 5 <= 3
+							&& (x + y) % 4 < 2;
+						bench_put(world, x, y, z,
+								  (wall && !window) || floor || z >= base);
+					}
+				}
+			}
+		}
+	}
+}
+
+static uint32_t bench_color(struct bench_world* world, size_t x, size_t y,
+							size_t z) {
+	size_t ground = world->ground[x + y * world->width];
+	uint32_t shade = (uint32_t)(bench_hash(world->seed + x * 31 + y * 17
+										   + z * 7)
+								& 0x0F);
+	if(z + 1 == world->depth)
+		return 0x3050A0 + shade;
+	if(z < ground)
+		return 0x808078 + shade * 0x010101;
+	if(z == ground)
+		return 0x40A030 + (shade << 8);
+	if(z < ground + 4)
+		return 0x806040 + (shade << 16);
+	return 0x707070 + shade * 0x010101;
+}
+
+static bool bench_visible(struct bench_world* world, size_t x, size_t y,
+						  size_t z) {
+	if(z == 0)
+		return true;
+	if(z + 1 == world->depth)
+		return !bench_solid(world, x, y, z - 1)
+			|| !bench_solid(world, (x + 1) % world->width, y, z)
+			|| !bench_solid(world, (x + world->width - 1) % world->width, y, z)
+			|| !bench_solid(world, x, (y + 1) % world->height, z)
+			|| !bench_solid(world, x, (y + world->height - 1) % world->height,
+							z);
+	return !bench_solid(world, x, y, z - 1) || !bench_solid(world, x, y, z + 1)
+		|| !bench_solid(world, (x + 1) % world->width, y, z)
+		|| !bench_solid(world, (x + world->width - 1) % world->width, y, z)
+		|| !bench_solid(world, x, (y + 1) % world->height, z)
+		|| !bench_solid(world, x, (y + world->height - 1) % world->height, z);
+}
+
+static void bench_append(struct bench_buffer* buffer, const void* data,
+						 size_t length) {
+	if(buffer->length + length > buffer->capacity) {
+		while(buffer->length + length > buffer->capacity)
+			buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 4096;
+		buffer->data = realloc(buffer->data, buffer->capacity);
+		if(!buffer->data) {
+			fprintf(stderr, "vxl_bench: out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+}
+
+// Encodes one column. Every span lists only its top colors; a visible block
+// below hidden ones (or past the 254 colors a span can hold) starts a new span
+// without air above it instead of using the bottom colors.
+static void bench_encode_column(struct bench_world* world, size_t x, size_t y,
+								struct bench_buffer* out) {
+	size_t z = 0;
+	while(1) {
+		size_t air_start = z;
+		while(z < world->depth && !bench_solid(world, x, y, z))
+			z++;
+		size_t color_start = z;
+		while(z < world->depth && z - color_start < 254
+			  && bench_solid(world, x, y, z) && bench_visible(world, x, y, z))
+			z++;
+		size_t color_end = z - 1;
+
+		while(z < world->depth && bench_solid(world, x, y, z)
+			  && !bench_visible(world, x, y, z))
+			z++;
+
+		size_t colors = color_end + 1 - color_start;
+		uint8_t span[4] = {
+			z < world->depth ? (uint8_t)(colors + 1) : 0,
+			(uint8_t)color_start,
+			(uint8_t)color_end,
+			(uint8_t)air_start,
+		};
+		bench_append(out, span, sizeof(span));
+
+		for(size_t k = color_start; k <= color_end; k++) {
+			uint32_t color = bench_color(world, x, y, k);
+			uint8_t bgra[4] = {
+				(uint8_t)color,
+				(uint8_t)(color >> 8),
+				(uint8_t)(color >> 16),
+				0x7F,
+			};
+			bench_append(out, bgra, sizeof(bgra));
+		}
+
+		if(z >= world->depth)
+			break;
+	}
+}
+
+static void bench_generate(struct bench_world* world, const char* kind,
+						   struct bench_size size, uint64_t seed,
+						   struct bench_buffer* out) {
+	world->width = size.width;
+	world->height = size.height;
+	world->depth = size.depth;
+	world->seed = seed;
+	world->solid = bench_malloc((size.width * size.height * size.depth + 7) / 8);
+	world->ground = bench_malloc(size.width * size.height * sizeof(uint32_t));
+	memset(world->solid, 0, (size.width * size.height * size.depth + 7) / 8);
+
+	bool city = !strcmp(kind, "buildings");
+	bench_terrain(world, city ? 0.1F : 0.6F);
+	if(!strcmp(kind, "caves"))
+		bench_caves(world);
+	if(city)
+		bench_buildings(world);
+
+	out->length = 0;
+	for(size_t y = 0; y < world->height; y++)
+		for(size_t x = 0; x < world->width; x++)
+			bench_encode_column(world, x, y, out);
+
+	free(world->solid);
+}
+
+static int bench_compare(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t bench_percentile(uint64_t* sorted, size_t count, double p) {
+	if(!count)
+		return 0;
+	size_t idx = (size_t)(p * (double)(count - 1) + 0.5);
+	return sorted[idx < count ? idx : count - 1];
+}
+
+static void bench_report(struct bench_result* result) {
+	qsort(result->latencies, result->latency_count, sizeof(uint64_t),
+		  bench_compare);
+
+	double seconds = result->seconds > 0.0 ? result->seconds : 1e-9;
+	printf("{\"map\":\"%s\",\"size\":\"%zux%zux%zu\",\"bench\":\"%s\","
+		   "\"ops\":%zu,\"bytes\":%zu,\"seconds\":%.6f,\"ops_per_sec\":%.1f,"
+		   "\"mb_per_sec\":%.2f,\"p50_ns\":%llu,\"p90_ns\":%llu,"
+		   "\"p99_ns\":%llu,\"max_ns\":%llu,\"peak_rss_kb\":%zu}\n",
+		   result->map, result->size.width, result->size.height,
+		   result->size.depth, result->bench, result->ops, result->bytes,
+		   result->seconds, (double)result->ops / seconds,
+		   (double)result->bytes / seconds / (1024.0 * 1024.0),
+		   (unsigned long long)bench_percentile(
+			   result->latencies, result->latency_count, 0.50),
+		   (unsigned long long)bench_percentile(
+			   result->latencies, result->latency_count, 0.90),
+		   (unsigned long long)bench_percentile(
+			   result->latencies, result->latency_count, 0.99),
+		   (unsigned long long)(result->latency_count
+									? result->latencies[result->latency_count
+														- 1]
+									: 0),
+		   bench_peak_rss());
+	fflush(stdout);
+}
+
+static void bench_begin(struct bench_result* result, const char* map,
+						struct bench_size size, const char* bench,
+						size_t latencies) {
+	result->map = map;
+	result->size = size;
+	result->bench = bench;
+	result->ops = 0;
+	result->bytes = 0;
+	result->seconds = 0.0;
+	result->latencies = bench_malloc(latencies * sizeof(uint64_t));
+	result->latency_count = 0;
+}
+
+static void bench_end(struct bench_result* result) {
+	bench_report(result);
+	free(result->latencies);
+}
+
+static void bench_add(struct bench_result* result, uint64_t ns, size_t ops) {
+	result->seconds += (double)ns * 1e-9;
+	result->ops += ops;
+	result->latencies[result->latency_count++] = ops ? ns / ops : ns;
+}
+
+static void bench_counters(const char* kind, struct bench_size size,
+						   const char* bench) {
+	struct libvxl_counters c;
+	if(!libvxl_counters(&c, true))
+		return;
+
+	printf("{\"map\":\"%s\",\"size\":\"%zux%zux%zu\",\"bench\":\"%s\","
+		   "\"counters\":{\"reallocs\":%llu,\"relocations\":%llu,"
+		   "\"moved_bytes\":%llu,\"searches\":%llu,\"search_steps\":%llu,"
+		   "\"encoded_bytes\":%llu,\"encode_ns\":%llu}}\n",
+		   kind, size.width, size.height, size.depth, bench,
+		   (unsigned long long)c.reallocs, (unsigned long long)c.relocations,
+		   (unsigned long long)c.moved_bytes, (unsigned long long)c.searches,
+		   (unsigned long long)c.search_steps,
+		   (unsigned long long)c.encoded_bytes,
+		   (unsigned long long)c.encode_ns);
+	fflush(stdout);
+}
+
+static void bench_stats(const char* kind, struct bench_size size,
+						struct bench_buffer* vxl) {
+	struct libvxl_map map;
+	libvxl_create(&map, size.width, size.height, size.depth, vxl->data,
+				  vxl->length);
+
+	struct libvxl_stats stats;
+	libvxl_map_stats(&map, &stats);
+	libvxl_free(&map);
+
+	printf("{\"map\":\"%s\",\"size\":\"%zux%zux%zu\",\"bench\":\"stats\","
+		   "\"blocks\":%zu,\"block_bytes\":%zu,\"slack_bytes\":%zu,"
+		   "\"column_bytes\":%zu,\"geometry_pages\":%zu,"
+		   "\"geometry_bytes\":%zu,\"index_bytes\":%zu,"
+		   "\"total_bytes\":%zu,\"fill\":[",
+		   kind, size.width, size.height, size.depth, stats.blocks,
+		   stats.block_bytes, stats.slack_bytes, stats.column_bytes,
+		   stats.geometry_pages, stats.geometry_bytes, stats.index_bytes,
+		   stats.total_bytes);
+	for(size_t k = 0; k < LIBVXL_STATS_FILL; k++)
+		printf(k ? ",%zu" : "%zu", stats.fill[k]);
+	printf("]}\n");
+	fflush(stdout);
+}
+
+// "create" times loading alone, "rotate" loading and freeing a map as a
+// server does when it changes maps, with the default allocator and a pool
+static void bench_load(const char* kind, struct bench_size size,
+					   struct bench_buffer* vxl, size_t repeat) {
+	struct libvxl_pool* pool = libvxl_pool_create();
+	const char* names[] = {"create", "rotate", "rotate_pool"};
+
+	for(size_t n = 0; n < sizeof(names) / sizeof(*names); n++) {
+		struct libvxl_create_options options = {
+			.threads = 1,
+			.allocator = n == 2 ? libvxl_pool_allocator(pool) : NULL,
+		};
+
+		struct bench_result result;
+		libvxl_counters(NULL, true);
+		bench_begin(&result, kind, size, names[n], repeat);
+		for(size_t k = 0; k < repeat; k++) {
+			struct libvxl_map map;
+			uint64_t start = bench_now();
+			bool ok = libvxl_create_ex(&map, size.width, size.height,
+									   size.depth, vxl->data, vxl->length,
+									   &options);
+			if(n == 0)
+				bench_add(&result, bench_now() - start, 1);
+			if(!ok) {
+				fprintf(stderr, "vxl_bench: generated map is invalid\n");
+				exit(1);
+			}
+			libvxl_free(&map);
+			if(n > 0)
+				bench_add(&result, bench_now() - start, 1);
+			result.bytes += vxl->length;
+		}
+		bench_end(&result);
+		bench_counters(kind, size, names[n]);
+	}
+
+	libvxl_pool_destroy(pool);
+
+	// the same map received in packets, e.g. from the network
+	struct bench_result result;
+	libvxl_counters(NULL, true);
+	bench_begin(&result, kind, size, "decode_feed", repeat);
+	for(size_t k = 0; k < repeat; k++) {
+		struct libvxl_decoder decoder;
+		struct libvxl_map map;
+		uint64_t start = bench_now();
+		libvxl_decode_begin(&decoder, &map, size.width, size.height,
+							size.depth, NULL);
+		bool ok = true;
+		for(size_t offset = 0; ok && offset < vxl->length;
+			offset += BENCH_STREAM_CHUNK) {
+			size_t length = vxl->length - offset;
+			ok = libvxl_decode_feed(&decoder, vxl->data + offset,
+									length < BENCH_STREAM_CHUNK ?
+										length :
+										BENCH_STREAM_CHUNK);
+		}
+		if(!libvxl_decode_end(&decoder) || !ok) {
+			fprintf(stderr, "vxl_bench: generated map is invalid\n");
+			exit(1);
+		}
+		bench_add(&result, bench_now() - start, 1);
+		libvxl_free(&map);
+		result.bytes += vxl->length;
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "decode_feed");
+}
+
+static void bench_encode(const char* kind, struct bench_size size,
+						 struct bench_buffer* vxl, size_t repeat) {
+	struct libvxl_map map;
+	libvxl_create(&map, size.width, size.height, size.depth, vxl->data,
+				  vxl->length);
+
+	struct bench_result result;
+	uint8_t* chunk = bench_malloc(BENCH_STREAM_CHUNK);
+	libvxl_counters(NULL, true);
+	bench_begin(&result, kind, size, "stream_read", repeat);
+	size_t total = 0;
+	for(size_t k = 0; k < repeat; k++) {
+		struct libvxl_stream stream;
+		uint64_t start = bench_now();
+		libvxl_stream(&stream, &map, BENCH_STREAM_CHUNK);
+		size_t read, bytes = 0;
+		while((read = libvxl_stream_read(&stream, chunk)))
+			bytes += read;
+		libvxl_stream_free(&stream);
+		bench_add(&result, bench_now() - start, 1);
+		result.bytes += bytes;
+		total = bytes;
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "stream_read");
+
+	uint8_t* packed = bench_malloc(total + BENCH_STREAM_CHUNK);
+	size_t packed_length = 0;
+	bench_begin(&result, kind, size, "stream_deflate", repeat);
+	for(size_t k = 0; k < repeat; k++) {
+		struct libvxl_stream stream;
+		uint64_t start = bench_now();
+		libvxl_stream_deflate(&stream, &map, BENCH_STREAM_CHUNK);
+		size_t read;
+		packed_length = 0;
+		while((read = libvxl_stream_read(&stream, chunk))) {
+			if(packed_length + read <= total + BENCH_STREAM_CHUNK)
+				memcpy(packed + packed_length, chunk, read);
+			packed_length += read;
+		}
+		libvxl_stream_free(&stream);
+		bench_add(&result, bench_now() - start, 1);
+		result.bytes += total;
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "stream_deflate");
+	free(chunk);
+
+	bench_begin(&result, kind, size, "inflate", repeat);
+	for(size_t k = 0; k < repeat
+		&& packed_length <= total + BENCH_STREAM_CHUNK; k++) {
+		uint64_t start = bench_now();
+		struct libvxl_inflate* inflate = libvxl_inflate_create();
+		for(size_t offset = 0; offset < packed_length;
+			offset += BENCH_STREAM_CHUNK) {
+			size_t length = packed_length - offset;
+			if(!libvxl_inflate_feed(inflate, packed + offset,
+									length < BENCH_STREAM_CHUNK ?
+										length :
+										BENCH_STREAM_CHUNK)) {
+				fprintf(stderr, "vxl_bench: compressed stream is invalid\n");
+				exit(1);
+			}
+		}
+		size_t length;
+		libvxl_inflate_data(inflate, &length);
+		if(!libvxl_inflate_done(inflate) || length != total) {
+			fprintf(stderr, "vxl_bench: compressed stream is truncated\n");
+			exit(1);
+		}
+		libvxl_inflate_destroy(inflate);
+		bench_add(&result, bench_now() - start, 1);
+		result.bytes += total;
+	}
+	bench_end(&result);
+	free(packed);
+
+	uint8_t* out = bench_malloc(total);
+	bench_begin(&result, kind, size, "write", repeat);
+	for(size_t k = 0; k < repeat; k++) {
+		size_t bytes;
+		uint64_t start = bench_now();
+		libvxl_write(&map, out, &bytes);
+		bench_add(&result, bench_now() - start, 1);
+		result.bytes += bytes;
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "write");
+	free(out);
+
+	bench_begin(&result, kind, size, "writefile", repeat);
+	for(size_t k = 0; k < repeat; k++) {
+		uint64_t start = bench_now();
+		size_t bytes = libvxl_writefile(&map, BENCH_FILE);
+		bench_add(&result, bench_now() - start, 1);
+		result.bytes += bytes;
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "writefile");
+	remove(BENCH_FILE);
+
+	libvxl_free(&map);
+}
+
+// *clustered* edits dig and fill small craters around random centers, like
+// explosions and building do in game, the others are spread over the map
+static void bench_edits(const char* kind, struct bench_size size,
+						struct bench_buffer* vxl, size_t count, bool clustered,
+						uint64_t seed) {
+	int* positions = bench_malloc(count * 3 * sizeof(int));
+	uint64_t state = seed;
+	for(size_t k = 0; k < count; k++) {
+		int* p = positions + k * 3;
+		if(clustered && k % 64) {
+			p[0] = (int)((size_t)(p[-3] - 3 + (int)bench_random_range(&state, 7)
+								  + (int)size.width)
+						 % size.width);
+			p[1] = (int)((size_t)(p[-2] - 3 + (int)bench_random_range(&state, 7)
+								  + (int)size.height)
+						 % size.height);
+			p[2] = p[-1] - 3 + (int)bench_random_range(&state, 7);
+			if(p[2] < 0)
+				p[2] = 0;
+			if(p[2] > (int)size.depth - 2)
+				p[2] = (int)size.depth - 2;
+		} else {
+			p[0] = (int)bench_random_range(&state, size.width);
+			p[1] = (int)bench_random_range(&state, size.height);
+			p[2] = (int)bench_random_range(&state, size.depth - 1);
+		}
+	}
+
+	struct libvxl_map map;
+	libvxl_create(&map, size.width, size.height, size.depth, vxl->data,
+				  vxl->length);
+
+	struct bench_result result;
+	libvxl_counters(NULL, true);
+	bench_begin(&result, kind, size,
+				clustered ? "set_clustered" : "set_random", count);
+	for(size_t k = 0; k < count; k++) {
+		int* p = positions + k * 3;
+		uint64_t start = bench_now();
+		if(k % 2)
+			libvxl_map_setair(&map, p[0], p[1], p[2]);
+		else
+			libvxl_map_set(&map, p[0], p[1], p[2], 0xC0C0C0);
+		bench_add(&result, bench_now() - start, 1);
+	}
+	bench_end(&result);
+	bench_counters(kind, size, clustered ? "set_clustered" : "set_random");
+
+	libvxl_free(&map);
+	free(positions);
+}
+
+// 40% get, 40% issolid and 20% gettop, either uniform over the map or close to
+// a few points of interest as a renderer or game server would ask for them
+static void bench_queries(const char* kind, struct bench_size size,
+						  struct bench_buffer* vxl, size_t count,
+						  bool clustered, uint64_t seed) {
+	count = (count + BENCH_GROUP - 1) / BENCH_GROUP * BENCH_GROUP;
+	int* positions = bench_malloc(count * 3 * sizeof(int));
+	uint64_t state = seed;
+	int center[3] = {0, 0, 0};
+	for(size_t k = 0; k < count; k++) {
+		int* p = positions + k * 3;
+		if(clustered) {
+			if(k % 4096 == 0) {
+				center[0] = (int)bench_random_range(&state, size.width);
+				center[1] = (int)bench_random_range(&state, size.height);
+				center[2] = (int)bench_random_range(&state, size.depth);
+			}
+			p[0] = (int)((size_t)(center[0] + (int)size.width - 16
+								  + (int)bench_random_range(&state, 32))
+						 % size.width);
+			p[1] = (int)((size_t)(center[1] + (int)size.height - 16
+								  + (int)bench_random_range(&state, 32))
+						 % size.height);
+			p[2] = center[2];
+		} else {
+			p[0] = (int)bench_random_range(&state, size.width);
+			p[1] = (int)bench_random_range(&state, size.height);
+			p[2] = (int)bench_random_range(&state, size.depth);
+		}
+	}
+
+	struct libvxl_map map;
+	libvxl_create(&map, size.width, size.height, size.depth, vxl->data,
+				  vxl->length);
+
+	struct bench_result result;
+	libvxl_counters(NULL, true);
+	bench_begin(&result, kind, size,
+				clustered ? "query_clustered" : "query_random",
+				count / BENCH_GROUP);
+	uint32_t sink = 0;
+	for(size_t k = 0; k < count; k += BENCH_GROUP) {
+		uint64_t start = bench_now();
+		for(size_t i = k; i < k + BENCH_GROUP; i++) {
+			int* p = positions + i * 3;
+			uint32_t top[2];
+			switch(i % 5) {
+				case 0:
+				case 1: sink += libvxl_map_get(&map, p[0], p[1], p[2]); break;
+				case 2:
+				case 3: sink += libvxl_map_issolid(&map, p[0], p[1], p[2]); break;
+				default:
+					libvxl_map_gettop(&map, p[0], p[1], top);
+					sink += top[1];
+					break;
+			}
+		}
+		bench_add(&result, bench_now() - start, BENCH_GROUP);
+	}
+	bench_end(&result);
+	bench_counters(kind, size,
+				   clustered ? "query_clustered" : "query_random");
+
+	// keeps the queries from being optimized away
+	if(sink == 0x12345678)
+		fprintf(stderr, "\n");
+
+	libvxl_free(&map);
+	free(positions);
+}
+
+// "mesh" builds the meshes of all chunks, "remesh" rebuilds the ones around a
+// single changed block as a client does after every edit it receives
+static void bench_mesh(const char* kind, struct bench_size size,
+					   struct bench_buffer* vxl, size_t repeat, size_t count,
+					   uint64_t seed) {
+	struct libvxl_map map;
+	libvxl_create(&map, size.width, size.height, size.depth, vxl->data,
+				  vxl->length);
+
+	size_t chunks = (size.width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE
+		* ((size.height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE);
+	struct libvxl_mesh* meshes = bench_malloc(chunks * sizeof(*meshes));
+
+	struct bench_result result;
+	libvxl_counters(NULL, true);
+	bench_begin(&result, kind, size, "mesh", repeat);
+	memset(meshes, 0, chunks * sizeof(*meshes));
+	for(size_t k = 0; k < repeat; k++) {
+		for(size_t c = 0; c < chunks; c++) // built again from scratch
+			libvxl_mesh_free(meshes + c);
+		uint64_t start = bench_now();
+		size_t built = libvxl_mesh_update(&map, meshes, 1);
+		bench_add(&result, bench_now() - start, built);
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "mesh");
+
+	uint64_t state = seed;
+	bench_begin(&result, kind, size, "remesh", count);
+	for(size_t k = 0; k < count; k++) {
+		int x = (int)bench_random_range(&state, size.width);
+		int y = (int)bench_random_range(&state, size.height);
+		int z = (int)bench_random_range(&state, size.depth - 1);
+		if(k % 2)
+			libvxl_map_setair(&map, x, y, z);
+		else
+			libvxl_map_set(&map, x, y, z, 0xC0C0C0);
+		uint64_t start = bench_now();
+		libvxl_mesh_update(&map, meshes, 1);
+		bench_add(&result, bench_now() - start, 1);
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "remesh");
+
+	for(size_t c = 0; c < chunks; c++)
+		libvxl_mesh_free(meshes + c);
+	free(meshes);
+	libvxl_free(&map);
+}
+
+static void bench_kv6(const char* kind, struct bench_size size,
+					  struct bench_buffer* vxl, size_t repeat) {
+	struct libvxl_map map;
+	libvxl_create(&map, size.width, size.height, size.depth, vxl->data,
+				  vxl->length);
+
+	size_t length = libvxl_kv6_size(&map, NULL);
+	void* model = bench_malloc(length);
+
+	struct bench_result result;
+	libvxl_counters(NULL, true);
+	bench_begin(&result, kind, size, "kv6_write", repeat);
+	for(size_t k = 0; k < repeat; k++) {
+		uint64_t start = bench_now();
+		libvxl_kv6_write(&map, NULL, model, &length);
+		bench_add(&result, bench_now() - start, 1);
+		result.bytes += length;
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "kv6_write");
+
+	bench_begin(&result, kind, size, "kv6_create", repeat);
+	for(size_t k = 0; k < repeat; k++) {
+		struct libvxl_map imported;
+		uint64_t start = bench_now();
+		libvxl_kv6_create(&imported, model, length, NULL);
+		bench_add(&result, bench_now() - start, 1);
+		result.bytes += length;
+		libvxl_free(&imported);
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "kv6_create");
+
+	free(model);
+	libvxl_free(&map);
+}
+
+static void bench_region(const char* kind, struct bench_size size,
+						 struct bench_buffer* vxl, size_t repeat,
+						 uint64_t seed) {
+	struct libvxl_map map;
+	libvxl_create(&map, size.width, size.height, size.depth, vxl->data,
+				  vxl->length);
+
+	struct libvxl_region region = {
+		.width = 128,
+		.height = 128,
+		.depth = size.depth,
+	};
+	struct libvxl_prefab prefab;
+
+	struct bench_result result;
+	libvxl_counters(NULL, true);
+	bench_begin(&result, kind, size, "extract", repeat);
+	for(size_t k = 0; k < repeat; k++) {
+		uint64_t start = bench_now();
+		libvxl_region_extract(&map, &region, &prefab);
+		bench_add(&result, bench_now() - start, 1);
+		if(k + 1 < repeat)
+			libvxl_prefab_free(&prefab);
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "extract");
+
+	uint64_t state = seed;
+	bench_begin(&result, kind, size, "paste", repeat);
+	for(size_t k = 0; k < repeat; k++) {
+		int x = (int)bench_random_range(&state, size.width);
+		int y = (int)bench_random_range(&state, size.height);
+		uint64_t start = bench_now();
+		libvxl_region_paste(&map, &prefab, x, y, 0, k % 2 == 0);
+		bench_add(&result, bench_now() - start, 1);
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "paste");
+
+	libvxl_prefab_free(&prefab);
+	libvxl_free(&map);
+}
+
+static void bench_shapes(const char* kind, struct bench_size size,
+						 struct bench_buffer* vxl, size_t repeat,
+						 uint64_t seed) {
+	struct libvxl_map map;
+	libvxl_create(&map, size.width, size.height, size.depth, vxl->data,
+				  vxl->length);
+
+	struct bench_result result;
+	uint64_t state = seed;
+	libvxl_counters(NULL, true);
+	bench_begin(&result, kind, size, "sphere", repeat);
+	for(size_t k = 0; k < repeat; k++) {
+		int x = (int)bench_random_range(&state, size.width);
+		int y = (int)bench_random_range(&state, size.height);
+		int z = (int)bench_random_range(&state, size.depth);
+		uint64_t start = bench_now();
+		libvxl_map_sphere(&map, x, y, z, 10.0F, false, 0, NULL);
+		bench_add(&result, bench_now() - start, 1);
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "sphere");
+
+	bench_begin(&result, kind, size, "box", repeat);
+	for(size_t k = 0; k < repeat; k++) {
+		int x = (int)bench_random_range(&state, size.width);
+		int y = (int)bench_random_range(&state, size.height);
+		int z = (int)bench_random_range(&state, size.depth);
+		uint64_t start = bench_now();
+		libvxl_map_box(&map, x, y, z, x + 15, y + 15, z + 15, true, 0x808080,
+					   NULL);
+		bench_add(&result, bench_now() - start, 1);
+	}
+	bench_end(&result);
+	bench_counters(kind, size, "box");
+
+	libvxl_free(&map);
+}
+
+// shapes touching the edges of a map whose sides are not a power of two must
+// leave it exactly like the same blocks set one at a time
+static void bench_check_shapes(void) {
+	struct libvxl_map shape, single;
+	libvxl_create(&shape, 40, 72, 64, NULL, 0);
+	libvxl_create(&single, 40, 72, 64, NULL, 0);
+
+	// a wall on the last row hides blocks of the first one
+	for(int z = 40; z <= 50; z++) {
+		for(int x = 30; x < 40; x++) {
+			libvxl_map_set(&shape, x, 71, z, 0x808080);
+			libvxl_map_set(&single, x, 71, z, 0x808080);
+		}
+	}
+
+	libvxl_map_sphere(&shape, 36, 1, 45, 4.5F, true, 0x123456, NULL);
+	for(int z = 40; z <= 50; z++)
+		for(int y = -4; y <= 6; y++)
+			for(int x = 31; x <= 41; x++)
+				if((x - 36) * (x - 36) + (y - 1) * (y - 1)
+						   + (z - 45) * (z - 45)
+					   <= 20
+				   && x < 40 && y >= 0)
+					libvxl_map_set(&single, x, y, z, 0x123456);
+
+	libvxl_map_box(&shape, 0, 60, 50, 5, 71, 62, true, 0x654321, NULL);
+	libvxl_map_box(&shape, 0, 66, 55, 2, 71, 58, false, 0, NULL);
+	for(int z = 50; z <= 62; z++)
+		for(int y = 60; y <= 71; y++)
+			for(int x = 0; x <= 5; x++)
+				libvxl_map_set(&single, x, y, z, 0x654321);
+	for(int z = 55; z <= 58; z++)
+		for(int y = 66; y <= 71; y++)
+			for(int x = 0; x <= 2; x++)
+				libvxl_map_setair(&single, x, y, z);
+
+	for(int z = 0; z < 64; z++) {
+		for(int y = 0; y < 72; y++) {
+			for(int x = 0; x < 40; x++) {
+				bool solid = libvxl_map_issolid(&shape, x, y, z);
+				bool surface = solid && libvxl_map_onsurface(&shape, x, y, z);
+				if(solid != libvxl_map_issolid(&single, x, y, z)
+				   || (surface
+					   && libvxl_map_get(&shape, x, y, z)
+						   != libvxl_map_get(&single, x, y, z))) {
+					fprintf(stderr,
+							"vxl_bench: shape differs at [%i,%i,%i]\n", x, y,
+							z);
+					exit(1);
+				}
+			}
+		}
+	}
+
+	libvxl_free(&shape);
+	libvxl_free(&single);
+}
+
+static void bench_usage(const char* name) {
+	fprintf(stderr,
+			"usage: %s [-r repeat] [-n ops] [-s seed] [WxHxD ...]\n"
+			"  -r  repetitions of create/write/stream/writefile (default 5)\n"
+			"  -n  edits and queries per workload (default 200000)\n"
+			"  -s  seed of the generated maps (default 1)\n"
+			"  map sizes default to 512x512x64 1024x1024x64 512x512x256\n",
+			name);
+}
+
+int main(int argc, char** argv) {
+	const char* kinds[] = {"terrain", "caves", "buildings"};
+	struct bench_size sizes[16] = {
+		{512, 512, 64},
+		{1024, 1024, 64},
+		{512, 512, 256},
+	};
+	size_t size_count = 3, repeat = 5, ops = 200000;
+	uint64_t seed = 1;
+	bool custom = false;
+
+	for(int k = 1; k < argc; k++) {
+		if(!strcmp(argv[k], "-r") && k + 1 < argc) {
+			repeat = strtoul(argv[++k], NULL, 10);
+		} else if(!strcmp(argv[k], "-n") && k + 1 < argc) {
+			ops = strtoul(argv[++k], NULL, 10);
+		} else if(!strcmp(argv[k], "-s") && k + 1 < argc) {
+			seed = strtoull(argv[++k], NULL, 10);
+		} else {
+			struct bench_size s;
+			if(sscanf(argv[k], "%zux%zux%zu", &s.width, &s.height, &s.depth)
+				   != 3
+			   || s.width < 16 || s.height < 16 || s.depth < 2
+			   || s.depth > 256 || s.width % 16 || s.height % 16) {
+				bench_usage(argv[0]);
+				return 1;
+			}
+			if(!custom)
+				size_count = 0;
+			custom = true;
+			if(size_count < sizeof(sizes) / sizeof(*sizes))
+				sizes[size_count++] = s;
+		}
+	}
+
+	if(repeat == 0 || ops == 0) {
+		bench_usage(argv[0]);
+		return 1;
+	}
+
+	bench_check_shapes();
+
+	struct bench_buffer vxl = {NULL, 0, 0};
+	for(size_t s = 0; s < size_count; s++) {
+		for(size_t k = 0; k < sizeof(kinds) / sizeof(*kinds); k++) {
+			struct bench_world world;
+			bench_generate(&world, kinds[k], sizes[s], seed, &vxl);
+
+			bench_stats(kinds[k], sizes[s], &vxl);
+			bench_load(kinds[k], sizes[s], &vxl, repeat);
+			bench_encode(kinds[k], sizes[s], &vxl, repeat);
+			bench_edits(kinds[k], sizes[s], &vxl, ops, false, seed + 1);
+			bench_edits(kinds[k], sizes[s], &vxl, ops, true, seed + 2);
+			bench_queries(kinds[k], sizes[s], &vxl, ops * 5, false, seed + 3);
+			bench_queries(kinds[k], sizes[s], &vxl, ops * 5, true, seed + 4);
+			bench_mesh(kinds[k], sizes[s], &vxl, repeat, ops / 100 + 1,
+					   seed + 5);
+			bench_kv6(kinds[k], sizes[s], &vxl, repeat);
+			bench_region(kinds[k], sizes[s], &vxl, repeat, seed + 6);
+			bench_shapes(kinds[k], sizes[s], &vxl, repeat, seed + 7);
+
+			free(world.ground);
+		}
+	}
+
+	free(vxl.data);
+	return 0;
+}
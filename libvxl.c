@@ -1,775 +1,6523 @@
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#define _DARWIN_C_SOURCE
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
 #include <assert.h>
 
-#include "libvxl.h"
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifndef LIBVXL_NO_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifndef LIBVXL_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define LIBVXL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)                                     \
+	|| (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIBVXL_SSE2
+#endif
+#endif
+
+#include "libvxl.h"
+
+#define LIBVXL_SPAN(base, off) ((struct libvxl_span*)((uint8_t*)(base) + (off)))
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+// wraps a coordinate around a map side of length n, every neighbour lookup
+// goes through this so all of them agree on sizes that are not a power of two
+static inline size_t libvxl_wrap(long v, size_t n) {
+	long m = v % (long)n;
+	return m < 0 ? (size_t)(m + (long)n) : (size_t)m;
+}
+
+#ifdef LIBVXL_COUNTERS
+static struct libvxl_counters libvxl_counts;
+
+#ifdef _MSC_VER
+#define LIBVXL_COUNT(field, n)                                                 \
+	InterlockedExchangeAdd64((volatile LONG64*)&libvxl_counts.field,           \
+							 (LONG64)(n))
+#else
+#define LIBVXL_COUNT(field, n)                                                 \
+	__atomic_add_fetch(&libvxl_counts.field, (uint64_t)(n), __ATOMIC_RELAXED)
+#endif
+
+// reads a counter, resetting it at the same time if requested
+static uint64_t libvxl_counter_take(uint64_t* counter, bool reset) {
+#ifdef _MSC_VER
+	return reset ? InterlockedExchange64((volatile LONG64*)counter, 0) :
+				   InterlockedExchangeAdd64((volatile LONG64*)counter, 0);
+#else
+	return reset ? __atomic_exchange_n(counter, 0, __ATOMIC_RELAXED) :
+				   __atomic_load_n(counter, __ATOMIC_RELAXED);
+#endif
+}
+
+static uint64_t libvxl_time_ns(void) {
+#ifdef _WIN32
+	LARGE_INTEGER frequency, counter;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000
+		+ (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000
+		/ frequency.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+#endif
+}
+
+// brackets the encoding of bytes by one of the write functions
+#define LIBVXL_ENCODE_START() uint64_t encode_start = libvxl_time_ns()
+#define LIBVXL_ENCODE_END(bytes)                                               \
+	do {                                                                       \
+		LIBVXL_COUNT(encoded_bytes, bytes);                                    \
+		LIBVXL_COUNT(encode_ns, libvxl_time_ns() - encode_start);              \
+	} while(0)
+#else
+#define LIBVXL_COUNT(field, n) ((void)0)
+#define LIBVXL_ENCODE_START() ((void)0)
+#define LIBVXL_ENCODE_END(bytes) ((void)0)
+#endif
+
+static size_t libvxl_hardware_threads(void) {
+#if defined(LIBVXL_NO_THREADS)
+	return 1;
+#elif defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (size_t)count : 1;
+#endif
+}
+
+struct libvxl_worker {
+	void (*func)(void* ctx, size_t index);
+	void* ctx;
+	size_t first, count, stride;
+};
+
+static void libvxl_worker_run(struct libvxl_worker* worker) {
+	for(size_t k = worker->first; k < worker->count; k += worker->stride)
+		worker->func(worker->ctx, k);
+}
+
+#ifndef LIBVXL_NO_THREADS
+#ifdef _WIN32
+static DWORD WINAPI libvxl_worker_entry(LPVOID arg) {
+	libvxl_worker_run(arg);
+	return 0;
+}
+#else
+static void* libvxl_worker_entry(void* arg) {
+	libvxl_worker_run(arg);
+	return NULL;
+}
+#endif
+#endif
+
+// calls func(ctx, k) for every k < count, spread over at most threads workers
+// (0 = one per hardware thread), items are handed out round-robin
+static void libvxl_parallel(size_t threads, size_t count,
+							void (*func)(void* ctx, size_t index), void* ctx) {
+	if(threads == 0)
+		threads = libvxl_hardware_threads();
+	threads = min(threads, count);
+
+	if(threads <= 1) {
+		for(size_t k = 0; k < count; k++)
+			func(ctx, k);
+		return;
+	}
+
+#ifdef LIBVXL_NO_THREADS
+	for(size_t k = 0; k < count; k++)
+		func(ctx, k);
+#else
+	struct libvxl_worker* workers
+		= libvxl_mem_malloc(threads * sizeof(struct libvxl_worker));
+#ifdef _WIN32
+	HANDLE* handles = libvxl_mem_malloc(threads * sizeof(HANDLE));
+#else
+	pthread_t* handles = libvxl_mem_malloc(threads * sizeof(pthread_t));
+#endif
+	bool* started = libvxl_mem_malloc(threads * sizeof(bool));
+
+	for(size_t k = 0; k < threads; k++) {
+		workers[k] = (struct libvxl_worker) {
+			.func = func,
+			.ctx = ctx,
+			.first = k,
+			.count = count,
+			.stride = threads,
+		};
+	}
+
+	// worker 0 runs on the calling thread
+	for(size_t k = 1; k < threads; k++) {
+#ifdef _WIN32
+		handles[k]
+			= CreateThread(NULL, 0, libvxl_worker_entry, workers + k, 0, NULL);
+		started[k] = handles[k] != NULL;
+#else
+		started[k] = pthread_create(handles + k, NULL, libvxl_worker_entry,
+									workers + k)
+			== 0;
+#endif
+	}
+
+	libvxl_worker_run(workers);
+
+	for(size_t k = 1; k < threads; k++) {
+		if(started[k]) {
+#ifdef _WIN32
+			WaitForSingleObject(handles[k], INFINITE);
+			CloseHandle(handles[k]);
+#else
+			pthread_join(handles[k], NULL);
+#endif
+		} else { // thread could not be created, do its share here
+			libvxl_worker_run(workers + k);
+		}
+	}
+
+	libvxl_mem_free(started);
+	libvxl_mem_free(handles);
+	libvxl_mem_free(workers);
+#endif
+}
+
+static void libvxl_chunk_decode(struct libvxl_map* map,
+								struct libvxl_chunk* chunk);
+
+static struct libvxl_chunk* chunk_fposition(struct libvxl_map* map, size_t x,
+											size_t y) {
+	libvxl_assert(map && x < map->width && y < map->height,
+				  "invalid input parameters");
+
+	size_t chunk_cnt = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t chunk_x = x / LIBVXL_CHUNK_SIZE;
+	size_t chunk_y = y / LIBVXL_CHUNK_SIZE;
+	struct libvxl_chunk* chunk = map->chunks + chunk_x + chunk_y * chunk_cnt;
+
+	if(map->lazy && !chunk->columns) // first access to a lazily loaded chunk
+		libvxl_chunk_decode(map, chunk);
+
+	return chunk;
+}
+
+static void* libvxl_default_allocate(void* ctx, size_t size) {
+	(void)ctx;
+	return libvxl_mem_malloc(size);
+}
+
+static void libvxl_default_deallocate(void* ctx, void* ptr, size_t size) {
+	(void)ctx;
+	(void)size;
+	libvxl_mem_free(ptr);
+}
+
+static const struct libvxl_allocator libvxl_default_allocator = {
+	.allocate = libvxl_default_allocate,
+	.deallocate = libvxl_default_deallocate,
+	.ctx = NULL,
+};
+
+static void* libvxl_map_alloc(struct libvxl_map* map, size_t size) {
+	return map->allocator->allocate(map->allocator->ctx, size);
+}
+
+static void libvxl_map_dealloc(struct libvxl_map* map, void* ptr,
+							   size_t size) {
+	if(ptr)
+		map->allocator->deallocate(map->allocator->ctx, ptr, size);
+}
+
+// reference counted storage shared between a map and its snapshots, the
+// counter is kept right in front of the data together with what is needed to
+// free it, whichever of them releases it last
+struct libvxl_shared {
+	long refs;
+	size_t size;
+	const struct libvxl_allocator* allocator;
+};
+
+static void* libvxl_shared_alloc(const struct libvxl_allocator* allocator,
+								 size_t size) {
+	struct libvxl_shared* shared = allocator->allocate(
+		allocator->ctx, sizeof(struct libvxl_shared) + size);
+	shared->refs = 1;
+	shared->size = sizeof(struct libvxl_shared) + size;
+	shared->allocator = allocator;
+	return shared + 1;
+}
+
+static void libvxl_shared_retain(void* data) {
+	if(!data)
+		return;
+
+	struct libvxl_shared* shared = (struct libvxl_shared*)data - 1;
+#ifdef _MSC_VER
+	InterlockedIncrement(&shared->refs);
+#else
+	__atomic_add_fetch(&shared->refs, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+static void libvxl_shared_release(void* data) {
+	if(!data)
+		return;
+
+	struct libvxl_shared* shared = (struct libvxl_shared*)data - 1;
+#ifdef _MSC_VER
+	if(InterlockedDecrement(&shared->refs) == 0)
+#else
+	if(__atomic_sub_fetch(&shared->refs, 1, __ATOMIC_ACQ_REL) == 0)
+#endif
+		shared->allocator->deallocate(shared->allocator->ctx, shared,
+									  shared->size);
+}
+
+// concurrent maps, see libvxl_create_options.concurrent: every chunk has a
+// version which is odd while the writer changes it, readers retry until they
+// saw the same even version before and after reading; storage replaced by the
+// writer is only freed once no reader can still be using it
+#define LIBVXL_SYNC_READERS 64
+
+// the epoch a reader started in, 0 if the slot is unused, each slot is kept
+// on its own cache line
+struct libvxl_sync_reader {
+	uint64_t epoch;
+	uint8_t padding[56];
+};
+
+struct libvxl_retired {
+	void* data;
+	uint64_t epoch;
+};
+
+struct libvxl_sync {
+	struct libvxl_sync_reader readers[LIBVXL_SYNC_READERS];
+	uint32_t* versions;
+	size_t* written; // chunks marked odd by the current edit
+	size_t written_length;
+	uint64_t writer; // thread inside of an edit, 0 if there is none
+	uint64_t epoch;
+	struct libvxl_retired* retired;
+	size_t retired_length, retired_capacity;
+};
+
+static uintptr_t libvxl_thread_id(void) {
+#if defined(LIBVXL_NO_THREADS)
+	return 1;
+#elif defined(_WIN32)
+	return GetCurrentThreadId();
+#else
+	return (uintptr_t)pthread_self();
+#endif
+}
+
+static void libvxl_yield(void) {
+#if defined(LIBVXL_NO_THREADS)
+#elif defined(_WIN32)
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+static uint32_t libvxl_load_u32(uint32_t* ptr) {
+#ifdef _MSC_VER
+	return InterlockedOr((volatile long*)ptr, 0);
+#else
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void libvxl_store_u32(uint32_t* ptr, uint32_t value) {
+#ifdef _MSC_VER
+	InterlockedExchange((volatile long*)ptr, value);
+#else
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#endif
+}
+
+static uint64_t libvxl_load_u64(uint64_t* ptr) {
+#ifdef _MSC_VER
+	return InterlockedOr64((volatile long long*)ptr, 0);
+#else
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static void libvxl_store_u64(uint64_t* ptr, uint64_t value) {
+#ifdef _MSC_VER
+	InterlockedExchange64((volatile long long*)ptr, value);
+#else
+	__atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+#endif
+}
+
+static bool libvxl_cas_u64(uint64_t* ptr, uint64_t expected, uint64_t value) {
+#ifdef _MSC_VER
+	return InterlockedCompareExchange64((volatile long long*)ptr, value,
+										expected)
+		== (long long)expected;
+#else
+	return __atomic_compare_exchange_n(ptr, &expected, value, false,
+									   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+#endif
+}
+
+static void libvxl_fence(void) {
+#ifdef _MSC_VER
+	MemoryBarrier();
+#else
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+
+static void libvxl_fence_acquire(void) {
+#ifdef _MSC_VER
+	MemoryBarrier();
+#else
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+#endif
+}
+
+static void libvxl_fence_release(void) {
+#ifdef _MSC_VER
+	MemoryBarrier();
+#else
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+#endif
+}
+
+static void libvxl_sync_create(struct libvxl_map* map) {
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+	struct libvxl_sync* sync = libvxl_mem_malloc(sizeof(struct libvxl_sync));
+	memset(sync, 0, sizeof(struct libvxl_sync));
+	sync->versions = libvxl_mem_malloc(sx * sy * sizeof(uint32_t));
+	sync->written = libvxl_mem_malloc(sx * sy * sizeof(size_t));
+	memset(sync->versions, 0, sx * sy * sizeof(uint32_t));
+	sync->epoch = 1;
+	map->sync = sync;
+}
+
+// frees storage retired before the oldest epoch any reader is still in
+static void libvxl_sync_reclaim(struct libvxl_sync* sync, bool all) {
+	uint64_t oldest = UINT64_MAX;
+	if(!all)
+		for(size_t k = 0; k < LIBVXL_SYNC_READERS; k++) {
+			uint64_t epoch = libvxl_load_u64(&sync->readers[k].epoch);
+			if(epoch > 0 && epoch < oldest)
+				oldest = epoch;
+		}
+
+	size_t length = 0;
+	for(size_t k = 0; k < sync->retired_length; k++) {
+		if(sync->retired[k].epoch < oldest)
+			libvxl_shared_release(sync->retired[k].data);
+		else
+			sync->retired[length++] = sync->retired[k];
+	}
+
+	sync->retired_length = length;
+}
+
+static void libvxl_sync_free(struct libvxl_map* map) {
+	if(!map->sync)
+		return;
+
+	libvxl_sync_reclaim(map->sync, true);
+	libvxl_mem_free(map->sync->retired);
+	libvxl_mem_free(map->sync->versions);
+	libvxl_mem_free(map->sync->written);
+	libvxl_mem_free(map->sync);
+}
+
+// drops a reference to replaced storage, readers of a concurrent map might
+// still be using it, so it is kept until the edit is published
+static void libvxl_map_release(struct libvxl_map* map, void* data) {
+	struct libvxl_sync* sync = map->sync;
+
+	if(!sync || !data) {
+		libvxl_shared_release(data);
+		return;
+	}
+
+	if(sync->retired_length == sync->retired_capacity) {
+		sync->retired_capacity
+			= sync->retired_capacity > 0 ? sync->retired_capacity * 2 : 16;
+		sync->retired = libvxl_mem_realloc(
+			sync->retired,
+			sync->retired_capacity * sizeof(struct libvxl_retired));
+	}
+
+	sync->retired[sync->retired_length++] = (struct libvxl_retired) {
+		.data = data,
+		.epoch = sync->epoch,
+	};
+}
+
+// must be called before a public function changes a map
+static void libvxl_sync_begin(struct libvxl_map* map) {
+	if(map->sync)
+		libvxl_store_u64(&map->sync->writer, libvxl_thread_id());
+}
+
+// marks chunk k as being changed until libvxl_sync_end(), readers of it wait
+static void libvxl_chunk_write(struct libvxl_map* map, size_t k) {
+	struct libvxl_sync* sync = map->sync;
+
+	if(!sync || sync->versions[k] & 1)
+		return;
+
+	libvxl_store_u32(sync->versions + k, sync->versions[k] + 1);
+	libvxl_fence_release();
+	sync->written[sync->written_length++] = k;
+}
+
+// publishes all changes of an edit and frees what readers no longer use
+static void libvxl_sync_end(struct libvxl_map* map) {
+	struct libvxl_sync* sync = map->sync;
+
+	if(!sync)
+		return;
+
+	for(size_t k = 0; k < sync->written_length; k++)
+		libvxl_store_u32(sync->versions + sync->written[k],
+						 sync->versions[sync->written[k]] + 1);
+	sync->written_length = 0;
+	libvxl_store_u64(&sync->writer, 0);
+
+	if(sync->retired_length > 0) {
+		// readers entering from now on cannot see anything retired so far
+		libvxl_store_u64(&sync->epoch, sync->epoch + 1);
+		libvxl_fence();
+		libvxl_sync_reclaim(sync, false);
+	}
+}
+
+// an optimistic read of up to five chunks of a concurrent map
+struct libvxl_reading {
+	struct libvxl_sync* sync;
+	size_t slot;
+	size_t count;
+	size_t chunks[5];
+	uint32_t versions[5];
+};
+
+// returns false if the map can be read directly, which is the case if it is
+// not concurrent or the calling thread is the one changing it
+static bool libvxl_read_enter(struct libvxl_map* map,
+							  struct libvxl_reading* r) {
+	struct libvxl_sync* sync = map->sync;
+
+	if(!sync)
+		return false;
+
+	uintptr_t self = libvxl_thread_id();
+	if(libvxl_load_u64(&sync->writer) == self)
+		return false;
+
+	r->sync = sync;
+	r->count = 0;
+	r->slot = (self / 64 + self) % LIBVXL_SYNC_READERS;
+
+	// the slot keeps storage retired from this epoch on alive, if all of them
+	// are taken give the readers holding them a chance to leave
+	size_t tries = 0;
+	while(!libvxl_cas_u64(&sync->readers[r->slot].epoch, 0,
+						  libvxl_load_u64(&sync->epoch))) {
+		r->slot = (r->slot + 1) % LIBVXL_SYNC_READERS;
+		if(++tries % LIBVXL_SYNC_READERS == 0)
+			libvxl_yield();
+	}
+	libvxl_fence();
+
+	return true;
+}
+
+static void libvxl_read_leave(struct libvxl_reading* r) {
+	libvxl_store_u64(&r->sync->readers[r->slot].epoch, 0);
+}
+
+// adds the chunk of column [x,y] to the chunks read
+static void libvxl_read_chunk(struct libvxl_map* map, struct libvxl_reading* r,
+							  size_t x, size_t y) {
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	r->chunks[r->count++] = x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx;
+}
+
+// waits until none of the chunks read is being changed
+static void libvxl_read_start(struct libvxl_reading* r) {
+	for(size_t k = 0; k < r->count; k++) {
+		uint32_t* version = r->sync->versions + r->chunks[k];
+		while((r->versions[k] = libvxl_load_u32(version)) & 1)
+			libvxl_yield();
+	}
+}
+
+// returns true if any chunk changed since libvxl_read_start(), whatever was
+// read must then be discarded
+static bool libvxl_read_retry(struct libvxl_reading* r) {
+	libvxl_fence_acquire();
+	for(size_t k = 0; k < r->count; k++)
+		if(libvxl_load_u32(r->sync->versions + r->chunks[k])
+		   != r->versions[k])
+			return true;
+	return false;
+}
+
+// returns data itself if nothing else references it, otherwise a private copy
+// of its first size bytes which replaces the reference to data
+static void* libvxl_shared_own(struct libvxl_map* map, void* data, size_t size,
+							   size_t capacity) {
+	if(!data)
+		return data;
+
+	struct libvxl_shared* shared = (struct libvxl_shared*)data - 1;
+#ifdef _MSC_VER
+	if(InterlockedCompareExchange(&shared->refs, 1, 1) == 1)
+#else
+	if(__atomic_load_n(&shared->refs, __ATOMIC_ACQUIRE) == 1)
+#endif
+		return data;
+
+	void* copy = libvxl_shared_alloc(shared->allocator, capacity);
+	memcpy(copy, data, size);
+	libvxl_map_release(map, data);
+	return copy;
+}
+
+#define LIBVXL_CHUNK_COLUMNS (LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE)
+// slice size given to a column, leaves a small gap for later inserts
+#define LIBVXL_COLUMN_CAPACITY(count) ((count) + ((count) + 3) / 4)
+
+static size_t libvxl_chunk_column(libvxl_key pos) {
+	return key_getx(pos) % LIBVXL_CHUNK_SIZE
+		+ key_gety(pos) % LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE;
+}
+
+// bytes of chunk storage: the column table followed by length blocks and a
+// spare one, readers of a concurrent map can see a slice's new count before
+// its new start and then read one block past the end of the old one
+static size_t libvxl_chunk_storage(size_t length) {
+	return LIBVXL_CHUNK_COLUMNS * sizeof(struct libvxl_column)
+		+ (length + 1) * sizeof(struct libvxl_block);
+}
+
+static void libvxl_chunk_alloc(struct libvxl_chunk* chunk, size_t length,
+							   const struct libvxl_allocator* allocator) {
+	chunk->columns
+		= libvxl_shared_alloc(allocator, libvxl_chunk_storage(length));
+	chunk->blocks
+		= (struct libvxl_block*)(chunk->columns + LIBVXL_CHUNK_COLUMNS);
+	chunk->length = length;
+	chunk->index = 0;
+	chunk->regular = false;
+	memset(chunk->columns, 0,
+		   LIBVXL_CHUNK_COLUMNS * sizeof(struct libvxl_column));
+}
+
+// drops the references a chunk holds to its storage
+static void libvxl_chunk_release(struct libvxl_chunk* chunk) {
+	libvxl_shared_release(chunk->columns);
+	if(chunk->regular)
+		libvxl_shared_release(chunk->blocks);
+	libvxl_shared_release(chunk->geometry);
+}
+
+// gives the chunk its own copy of its storage if a snapshot still uses it, a
+// regular chunk gets a column table of its own with room for changes again
+static void libvxl_chunk_own(struct libvxl_map* map,
+							 struct libvxl_chunk* chunk) {
+	if(!chunk->columns)
+		return;
+
+	if(chunk->regular) {
+		struct libvxl_chunk expanded;
+		libvxl_chunk_alloc(&expanded,
+						   LIBVXL_CHUNK_COLUMNS * LIBVXL_COLUMN_CAPACITY(1)
+							   * LIBVXL_CHUNK_GROWTH,
+						   map->allocator);
+
+		for(size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++) {
+			expanded.columns[k] = (struct libvxl_column) {
+				.start = expanded.index,
+				.count = 1,
+				.capacity = LIBVXL_COLUMN_CAPACITY(1),
+			};
+			expanded.blocks[expanded.index] = chunk->blocks[k];
+			expanded.index += LIBVXL_COLUMN_CAPACITY(1);
+		}
+
+		LIBVXL_COUNT(reallocs, 1);
+
+		libvxl_map_release(map, chunk->columns);
+		libvxl_map_release(map, chunk->blocks);
+		chunk->columns = expanded.columns;
+		chunk->blocks = expanded.blocks;
+		chunk->length = expanded.length;
+		chunk->index = expanded.index;
+		chunk->regular = false;
+		return;
+	}
+
+	chunk->columns = libvxl_shared_own(map, chunk->columns,
+									   libvxl_chunk_storage(chunk->index),
+									   libvxl_chunk_storage(chunk->length));
+	chunk->blocks
+		= (struct libvxl_block*)(chunk->columns + LIBVXL_CHUNK_COLUMNS);
+}
+
+// makes the map safe for concurrent readers, which need the column table and
+// blocks of a chunk in one allocation, so regular chunks are expanded first
+static void libvxl_map_concurrent(struct libvxl_map* map) {
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+	for(size_t k = 0; k < sx * sy; k++)
+		if(map->chunks[k].regular)
+			libvxl_chunk_own(map, map->chunks + k);
+
+	libvxl_sync_create(map);
+}
+
+// the geometry is stored per chunk, each column is a run of depth bits
+static size_t libvxl_geometry_words(struct libvxl_map* map) {
+	return (LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE * map->depth
+			+ (sizeof(size_t) * 8 - 1))
+		/ (sizeof(size_t) * 8);
+}
+
+// finds the geometry of column [x,y], offset is set to the bit of z=0
+static size_t* libvxl_geometry_column(struct libvxl_map* map, size_t x,
+									  size_t y, size_t* offset) {
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	*offset
+		= (x % LIBVXL_CHUNK_SIZE + y % LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE)
+		* map->depth;
+	return map->chunks[x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx]
+		.geometry;
+}
+
+static bool libvxl_geometry_get(struct libvxl_map* map, size_t x, size_t y,
+								size_t z) {
+	libvxl_assert(map && x < map->width && y < map->height && z < map->depth,
+				  "invalid input parameters");
+
+	size_t offset;
+	size_t* geometry = libvxl_geometry_column(map, x, y, &offset);
+	offset += z;
+
+	return (geometry[offset / (sizeof(size_t) * 8)]
+			& ((size_t)1 << (offset % (sizeof(size_t) * 8))))
+		> 0;
+}
+
+static void libvxl_geometry_set(struct libvxl_map* map, size_t x, size_t y,
+								size_t z, size_t state) {
+	libvxl_assert(map && x < map->width && y < map->height && z < map->depth,
+				  "invalid input parameters");
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t k = x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx;
+	struct libvxl_chunk* chunk = map->chunks + k;
+
+	libvxl_chunk_write(map, k);
+
+	size_t words = libvxl_geometry_words(map);
+	chunk->geometry = libvxl_shared_own(
+		map, chunk->geometry, words * sizeof(size_t), words * sizeof(size_t));
+
+	size_t offset = z
+		+ (x % LIBVXL_CHUNK_SIZE + y % LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE)
+			* map->depth;
+
+	size_t* val = chunk->geometry + offset / (sizeof(size_t) * 8);
+	size_t bit = offset % (sizeof(size_t) * 8);
+
+	*val = (*val & ~((size_t)1 << bit)) | (state << bit);
+}
+
+// reads color and height of the topmost block of column [x,y] of a chunk
+static void libvxl_column_top(struct libvxl_map* map,
+							  struct libvxl_chunk* chunk, size_t x, size_t y,
+							  uint32_t* color, uint32_t* height) {
+	struct libvxl_column* columns = chunk->columns;
+	struct libvxl_column* c = columns + libvxl_chunk_column(pos_key(x, y, 0));
+	struct libvxl_block* blocks = chunk->regular ?
+		chunk->blocks :
+		(struct libvxl_block*)(columns + LIBVXL_CHUNK_COLUMNS);
+
+	size_t start = c->start;
+
+	if(c->count > 0) { // the first block of a column is its topmost
+		*color = blocks[start].color;
+		*height = key_getz(blocks[start].position);
+	} else {
+		*color = 0;
+		*height = map->depth;
+	}
+}
+
+// marks column [x,y] and its chunk as changed in the current generation and
+// refreshes its overview entry, must be called after its blocks changed
+static void libvxl_map_touch(struct libvxl_map* map, size_t x, size_t y) {
+	libvxl_assert(map && x < map->width && y < map->height,
+				  "invalid input parameters");
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	libvxl_chunk_write(map, x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx);
+
+	if(map->top_colors)
+		libvxl_column_top(map, chunk_fposition(map, x, y), x, y,
+						  map->top_colors + x + y * map->width,
+						  map->top_heights + x + y * map->width);
+
+	if(!map->column_generation) // snapshots do not track changes
+		return;
+
+	// columns are only tracked in chunks that changed at least once
+	size_t chunk = x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx;
+	if(!map->column_generation[chunk]) {
+		map->column_generation[chunk]
+			= libvxl_map_alloc(map, LIBVXL_CHUNK_COLUMNS * sizeof(uint64_t));
+		memset(map->column_generation[chunk], 0,
+			   LIBVXL_CHUNK_COLUMNS * sizeof(uint64_t));
+	}
+
+	map->column_generation[chunk][x % LIBVXL_CHUNK_SIZE
+								  + y % LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE]
+		= map->generation;
+	map->chunk_generation[chunk] = map->generation;
+}
+
+// forgets all changes, e.g. the ones made while building a new map
+static void libvxl_changes_reset(struct libvxl_map* map) {
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	for(size_t k = 0; k < sx * sy; k++) {
+		libvxl_map_dealloc(map, map->column_generation[k],
+						   LIBVXL_CHUNK_COLUMNS * sizeof(uint64_t));
+		map->column_generation[k] = NULL;
+	}
+	memset(map->chunk_generation, 0, sx * sy * sizeof(uint64_t));
+}
+
+// generation a column last changed at, chunk_generation must be non zero
+static uint64_t libvxl_column_generation(struct libvxl_map* map, size_t chunk,
+										 size_t x, size_t y) {
+	return map->column_generation[chunk][x % LIBVXL_CHUNK_SIZE
+										 + y % LIBVXL_CHUNK_SIZE
+											 * LIBVXL_CHUNK_SIZE];
+}
+
+// index of the lowest set bit, value must not be 0
+static size_t libvxl_bit_lowest(size_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+#if SIZE_MAX > 0xFFFFFFFF
+	_BitScanForward64(&index, value);
+#else
+	_BitScanForward(&index, value);
+#endif
+	return index;
+#else
+	return sizeof(size_t) > sizeof(unsigned long) ? __builtin_ctzll(value) :
+													__builtin_ctzl(value);
+#endif
+}
+
+// index of the highest set bit, value must not be 0
+static size_t libvxl_bit_highest(size_t value) {
+#ifdef _MSC_VER
+	unsigned long index;
+#if SIZE_MAX > 0xFFFFFFFF
+	_BitScanReverse64(&index, value);
+#else
+	_BitScanReverse(&index, value);
+#endif
+	return index;
+#else
+	return sizeof(size_t) > sizeof(unsigned long) ?
+		sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(value) :
+		sizeof(unsigned long) * 8 - 1 - __builtin_clzl(value);
+#endif
+}
+
+// number of set bits
+static size_t libvxl_bit_count(uint64_t value) {
+#ifdef _MSC_VER
+	return (size_t)(__popcnt((unsigned int)value)
+					+ __popcnt((unsigned int)(value >> 32)));
+#else
+	return __builtin_popcountll(value);
+#endif
+}
+
+// finds the first z in [z, z_end) which has the given state, scanning whole
+// geometry words at a time, returns z_end if there is none
+static size_t libvxl_geometry_find(struct libvxl_map* map, size_t x, size_t y,
+								   size_t z, size_t z_end, bool state) {
+	libvxl_assert(map && x < map->width && y < map->height
+					  && z_end <= map->depth,
+				  "invalid input parameters");
+
+	const size_t bits = sizeof(size_t) * 8;
+	size_t base;
+	size_t* geometry = libvxl_geometry_column(map, x, y, &base);
+	size_t offset = base + z;
+
+	while(offset < base + z_end) {
+		size_t word = geometry[offset / bits];
+		if(!state)
+			word = ~word;
+		word >>= offset % bits;
+
+		if(word) {
+			size_t found = offset + libvxl_bit_lowest(word);
+			return found < base + z_end ? found - base : z_end;
+		}
+
+		offset = (offset / bits + 1) * bits;
+	}
+
+	return z_end;
+}
+
+// finds the last z in [z_start, z] which has the given state, scanning whole
+// geometry words at a time, returns one past it or z_start if there is none
+static size_t libvxl_geometry_rfind(struct libvxl_map* map, size_t x, size_t y,
+									size_t z, size_t z_start, bool state) {
+	libvxl_assert(map && x < map->width && y < map->height && z < map->depth,
+				  "invalid input parameters");
+
+	const size_t bits = sizeof(size_t) * 8;
+	size_t base;
+	size_t* geometry = libvxl_geometry_column(map, x, y, &base);
+	size_t offset = base + z + 1;
+
+	while(offset > base + z_start) {
+		size_t k = (offset - 1) / bits;
+		size_t word = geometry[k];
+		if(!state)
+			word = ~word;
+
+		if(offset - k * bits < bits) // ignore bits after offset
+			word &= ((size_t)1 << (offset - k * bits)) - 1;
+		if(k * bits < base + z_start) // and before z_start
+			word &= ~(((size_t)1 << (base + z_start - k * bits)) - 1);
+
+		if(word)
+			return k * bits + libvxl_bit_highest(word) + 1 - base;
+
+		offset = k * bits;
+	}
+
+	return z_start;
+}
+
+// the whole geometry of column [x,y] as one word, bit z is set if z is solid,
+// the map must not be deeper than 64 blocks
+static uint64_t libvxl_geometry_mask(struct libvxl_map* map, size_t x,
+									 size_t y) {
+	libvxl_assert(map && x < map->width && y < map->height && map->depth <= 64,
+				  "invalid input parameters");
+
+	const size_t bits = sizeof(size_t) * 8;
+	size_t base;
+	size_t* geometry = libvxl_geometry_column(map, x, y, &base);
+	uint64_t all = map->depth < 64 ? ((uint64_t)1 << map->depth) - 1 : ~0ULL;
+
+	if(base % bits + map->depth <= bits) // column is inside a single word
+		return (uint64_t)(geometry[base / bits] >> (base % bits)) & all;
+
+	uint64_t mask = 0;
+	for(size_t z = 0; z < map->depth; z += bits - (base + z) % bits)
+		mask |= (uint64_t)(geometry[(base + z) / bits] >> ((base + z) % bits))
+			<< z;
+
+	return mask & all;
+}
+
+// 64 bit words holding a whole column
+#define LIBVXL_COLUMN_WORDS (LIBVXL_MAX_DEPTH / 64)
+
+// the geometry of column [x,y] in LIBVXL_COLUMN_WORDS words, bit z % 64 of
+// word z / 64 is set if z is solid, bits past the depth are cleared
+static void libvxl_geometry_bits(struct libvxl_map* map, size_t x, size_t y,
+								 uint64_t* out) {
+	libvxl_assert(map && x < map->width && y < map->height
+					  && map->depth <= LIBVXL_COLUMN_WORDS * 64,
+				  "invalid input parameters");
+
+	const size_t bits = sizeof(size_t) * 8;
+	size_t base;
+	size_t* geometry = libvxl_geometry_column(map, x, y, &base);
+	memset(out, 0, LIBVXL_COLUMN_WORDS * sizeof(uint64_t));
+
+	for(size_t z = 0; z < map->depth;) {
+		size_t n = min(min(bits - (base + z) % bits, 64 - z % 64),
+					   map->depth - z);
+		uint64_t word
+			= (uint64_t)(geometry[(base + z) / bits] >> ((base + z) % bits));
+		if(n < 64)
+			word &= ((uint64_t)1 << n) - 1;
+		out[z / 64] |= word << (z % 64);
+		z += n;
+	}
+}
+
+// sets [z_start, z_end) of column [x,y] to the given state, whole geometry
+// words at a time
+static void libvxl_geometry_fill(struct libvxl_map* map, size_t x, size_t y,
+								 size_t z_start, size_t z_end, bool state) {
+	libvxl_assert(map && x < map->width && y < map->height
+					  && z_start <= z_end && z_end <= map->depth,
+				  "invalid input parameters");
+
+	if(z_start == z_end)
+		return;
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t k = x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx;
+	struct libvxl_chunk* chunk = map->chunks + k;
+
+	libvxl_chunk_write(map, k);
+
+	size_t words = libvxl_geometry_words(map);
+	chunk->geometry = libvxl_shared_own(
+		map, chunk->geometry, words * sizeof(size_t), words * sizeof(size_t));
+
+	const size_t bits = sizeof(size_t) * 8;
+	size_t base
+		= (x % LIBVXL_CHUNK_SIZE + y % LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE)
+		* map->depth;
+
+	for(size_t offset = base + z_start; offset < base + z_end;) {
+		size_t n = min(bits - offset % bits, base + z_end - offset);
+		size_t mask = (n < bits ? ((size_t)1 << n) - 1 : ~(size_t)0)
+			<< (offset % bits);
+
+		if(state) {
+			chunk->geometry[offset / bits] |= mask;
+		} else {
+			chunk->geometry[offset / bits] &= ~mask;
+		}
+
+		offset += n;
+	}
+}
+
+// blocks of the LIBVXL_COLUMN_WORDS column bits m with air above them (z - 1)
+// in up and with air below them (z + 1) in down, past the last of depth bits
+// is solid if floor is set and air otherwise
+static void libvxl_bits_exposed(const uint64_t* m, size_t depth, bool floor,
+								uint64_t* up, uint64_t* down) {
+	for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++) {
+		uint64_t above = (m[k] << 1) | (k > 0 ? m[k - 1] >> 63 : 0);
+		uint64_t below = (m[k] >> 1)
+			| (k + 1 < LIBVXL_COLUMN_WORDS ? m[k + 1] << 63 : 0);
+		if(floor && k == (depth - 1) / 64)
+			below |= (uint64_t)1 << (depth - 1) % 64;
+
+		up[k] = m[k] & ~above;
+		down[k] = m[k] & ~below;
+	}
+}
+
+// moves LIBVXL_COLUMN_WORDS column bits by shift towards larger z, or towards
+// smaller z if it is negative
+static void libvxl_bits_shift(const uint64_t* in, ptrdiff_t shift,
+							  uint64_t* out) {
+	const ptrdiff_t words = LIBVXL_COLUMN_WORDS;
+
+	for(ptrdiff_t k = 0; k < words; k++) {
+		// out[k] takes the 64 bits of in starting at bit 64 * k - shift
+		ptrdiff_t start = 64 * k - shift;
+		ptrdiff_t src = start >= 0 ? start / 64 : -((63 - start) / 64);
+		size_t bit = (size_t)(start - src * 64);
+
+		out[k] = src >= 0 && src < words ? in[src] >> bit : 0;
+		if(bit && src + 1 >= 0 && src + 1 < words)
+			out[k] |= in[src + 1] << (64 - bit);
+	}
+}
+
+// bits [z_start, z_end) of a column
+static void libvxl_bits_range(size_t z_start, size_t z_end, uint64_t* out) {
+	for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++) {
+		size_t lo = min(max(z_start, k * 64), (k + 1) * 64) - k * 64;
+		size_t hi = min(max(z_end, k * 64), (k + 1) * 64) - k * 64;
+		out[k] = (hi < 64 ? ((uint64_t)1 << hi) - 1 : ~0ULL)
+			& ~(lo < 64 ? ((uint64_t)1 << lo) - 1 : ~0ULL);
+	}
+}
+
+// replaces the geometry of column [x,y] by LIBVXL_COLUMN_WORDS words of bits,
+// see libvxl_geometry_bits()
+static void libvxl_geometry_store(struct libvxl_map* map, size_t x, size_t y,
+								  const uint64_t* in) {
+	libvxl_assert(map && x < map->width && y < map->height
+					  && map->depth <= LIBVXL_COLUMN_WORDS * 64,
+				  "invalid input parameters");
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t k = x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx;
+	struct libvxl_chunk* chunk = map->chunks + k;
+
+	libvxl_chunk_write(map, k);
+
+	size_t words = libvxl_geometry_words(map);
+	chunk->geometry = libvxl_shared_own(
+		map, chunk->geometry, words * sizeof(size_t), words * sizeof(size_t));
+
+	const size_t bits = sizeof(size_t) * 8;
+	size_t base
+		= (x % LIBVXL_CHUNK_SIZE + y % LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE)
+		* map->depth;
+
+	for(size_t z = 0; z < map->depth;) {
+		size_t n = min(min(bits - (base + z) % bits, 64 - z % 64),
+					   map->depth - z);
+		size_t mask = n < bits ? ((size_t)1 << n) - 1 : ~(size_t)0;
+		size_t value = (size_t)(in[z / 64] >> (z % 64)) & mask;
+		size_t* word = chunk->geometry + (base + z) / bits;
+		*word = (*word & ~(mask << (base + z) % bits))
+			| (value << (base + z) % bits);
+		z += n;
+	}
+}
+
+// checks if bits [start, end) of a page of geometry all have the given state
+static bool libvxl_bits_uniform(const size_t* geometry, size_t start,
+								size_t end, bool state) {
+	const size_t bits = sizeof(size_t) * 8;
+
+	while(start < end) {
+		size_t n = min(bits - start % bits, end - start);
+		size_t mask = (n < bits ? ((size_t)1 << n) - 1 : ~(size_t)0)
+			<< start % bits;
+		if((geometry[start / bits] & mask) != (state ? mask : 0))
+			return false;
+		start += n;
+	}
+
+	return true;
+}
+
+// checks if every column of a page of geometry is air above height and solid
+// from there on down
+static bool libvxl_geometry_flat(const size_t* geometry, size_t depth,
+								 size_t height) {
+	for(size_t c = 0; c < LIBVXL_CHUNK_COLUMNS; c++)
+		if(!libvxl_bits_uniform(geometry, c * depth, c * depth + height, false)
+		   || !libvxl_bits_uniform(geometry, c * depth + height,
+								   (c + 1) * depth, true))
+			return false;
+
+	return true;
+}
+
+// checks if a chunk has exactly one block in each of its columns
+static bool libvxl_chunk_single(struct libvxl_chunk* chunk) {
+	for(size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++)
+		if(chunk->columns[k].count != 1)
+			return false;
+
+	return true;
+}
+
+// stores a chunk with one block per column as just these blocks, the column
+// table is the same for all such chunks and shared with the others
+static void libvxl_chunk_regular(struct libvxl_map* map,
+								 struct libvxl_chunk* chunk,
+								 struct libvxl_column* table) {
+	struct libvxl_block* blocks = libvxl_shared_alloc(
+		map->allocator, LIBVXL_CHUNK_COLUMNS * sizeof(struct libvxl_block));
+	for(size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++)
+		blocks[k] = chunk->blocks[chunk->columns[k].start];
+
+	libvxl_map_release(map, chunk->columns);
+	libvxl_shared_retain(table);
+	chunk->columns = table;
+	chunk->blocks = blocks;
+	chunk->length = LIBVXL_CHUNK_COLUMNS;
+	chunk->index = LIBVXL_CHUNK_COLUMNS;
+	chunk->regular = true;
+}
+
+// lets every chunk in [start, end) whose columns are all solid from the same
+// height down use a single page of geometry with all others like it, the
+// first one writing to it gets its own copy again, returns how many of these
+// chunks there are
+//
+// Those with a single block per column, like the ones of open water, also
+// drop their column table and the gaps between their blocks. Chunks of a
+// concurrent map keep them, readers expect both in one allocation.
+static size_t libvxl_map_share(struct libvxl_map* map, size_t start,
+							   size_t end) {
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t bytes = libvxl_geometry_words(map) * sizeof(size_t);
+	size_t d = map->depth;
+	// first page found of each height, all air being height d
+	size_t* pages[LIBVXL_COLUMN_WORDS * 64 + 1] = {NULL};
+	struct libvxl_column* table = NULL;
+	size_t uniform = 0;
+
+	for(size_t k = start; k < end; k++) {
+		struct libvxl_chunk* chunk = map->chunks + k;
+		size_t height = libvxl_geometry_find(map, k % sx * LIBVXL_CHUNK_SIZE,
+											 k / sx * LIBVXL_CHUNK_SIZE, 0, d,
+											 true);
+
+		if(chunk->geometry != pages[height]
+		   && !(pages[height] ?
+					memcmp(chunk->geometry, pages[height], bytes) == 0 :
+					libvxl_geometry_flat(chunk->geometry, d, height)))
+			continue;
+
+		uniform++;
+
+		if(!pages[height]) {
+			pages[height] = chunk->geometry;
+		} else if(chunk->geometry != pages[height]) {
+			libvxl_chunk_write(map, k);
+			libvxl_shared_retain(pages[height]);
+			libvxl_map_release(map, chunk->geometry);
+			chunk->geometry = pages[height];
+		}
+
+		if(map->sync || !chunk->columns || chunk->regular
+		   || !libvxl_chunk_single(chunk))
+			continue;
+
+		if(!table) {
+			table = libvxl_shared_alloc(
+				map->allocator,
+				LIBVXL_CHUNK_COLUMNS * sizeof(struct libvxl_column));
+			for(size_t c = 0; c < LIBVXL_CHUNK_COLUMNS; c++)
+				table[c] = (struct libvxl_column) {
+					.start = c,
+					.count = 1,
+					.capacity = 1,
+				};
+		}
+
+		libvxl_chunk_regular(map, chunk, table);
+	}
+
+	libvxl_shared_release(table);
+
+	return uniform;
+}
+
+// shares the geometry of a chunk row once all of its columns are decoded, so
+// loading a map never needs much more memory than it ends up with
+static void libvxl_band_share(struct libvxl_map* map, size_t band) {
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	libvxl_map_share(map, band * sx, (band + 1) * sx);
+}
+
+// blocks of column [x,y] with a face towards air, wrapped like
+// libvxl_map_issolid() and with the bottom layer resting on solid ground
+static void libvxl_column_surface(struct libvxl_map* map, size_t x, size_t y,
+								  uint64_t* out) {
+	size_t w = map->width, h = map->height;
+	uint64_t m[LIBVXL_COLUMN_WORDS], side[LIBVXL_COLUMN_WORDS];
+	uint64_t down[LIBVXL_COLUMN_WORDS];
+	libvxl_geometry_bits(map, x, y, m);
+	libvxl_bits_exposed(m, map->depth, true, out, down);
+	for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++)
+		out[k] |= down[k];
+
+	size_t neighbours[4][2] = {
+		{libvxl_wrap((long)x - 1, w), y},
+		{libvxl_wrap((long)x + 1, w), y},
+		{x, libvxl_wrap((long)y - 1, h)},
+		{x, libvxl_wrap((long)y + 1, h)},
+	};
+	for(size_t n = 0; n < 4; n++) {
+		libvxl_geometry_bits(map, neighbours[n][0], neighbours[n][1], side);
+		for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++)
+			out[k] |= m[k] & ~side[k];
+	}
+}
+
+// surface bits of count columns from the solid masks of their own row, which
+// starts one column west of them, and of the rows north and south of them
+static void libvxl_surface_kernel(const uint64_t* row, const uint64_t* north,
+								  const uint64_t* south, uint64_t bottom,
+								  uint64_t* out, size_t count) {
+	size_t k = 0;
+
+#if defined(LIBVXL_AVX2)
+	__m256i b4 = _mm256_set1_epi64x((long long)bottom);
+	for(; k + 4 <= count; k += 4) {
+		__m256i m = _mm256_loadu_si256((const __m256i*)(row + k + 1));
+		__m256i west = _mm256_loadu_si256((const __m256i*)(row + k));
+		__m256i east = _mm256_loadu_si256((const __m256i*)(row + k + 2));
+		__m256i n = _mm256_loadu_si256((const __m256i*)(north + k));
+		__m256i s = _mm256_loadu_si256((const __m256i*)(south + k));
+		__m256i solid = _mm256_and_si256(
+			_mm256_slli_epi64(m, 1),
+			_mm256_or_si256(_mm256_srli_epi64(m, 1), b4));
+		solid = _mm256_and_si256(solid, _mm256_and_si256(west, east));
+		solid = _mm256_and_si256(solid, _mm256_and_si256(n, s));
+		_mm256_storeu_si256((__m256i*)(out + k), _mm256_andnot_si256(solid, m));
+	}
+#elif defined(LIBVXL_SSE2)
+	__m128i b2 = _mm_set1_epi64x((long long)bottom);
+	for(; k + 2 <= count; k += 2) {
+		__m128i m = _mm_loadu_si128((const __m128i*)(row + k + 1));
+		__m128i west = _mm_loadu_si128((const __m128i*)(row + k));
+		__m128i east = _mm_loadu_si128((const __m128i*)(row + k + 2));
+		__m128i n = _mm_loadu_si128((const __m128i*)(north + k));
+		__m128i s = _mm_loadu_si128((const __m128i*)(south + k));
+		__m128i solid = _mm_and_si128(_mm_slli_epi64(m, 1),
+									  _mm_or_si128(_mm_srli_epi64(m, 1), b2));
+		solid = _mm_and_si128(solid, _mm_and_si128(west, east));
+		solid = _mm_and_si128(solid, _mm_and_si128(n, s));
+		_mm_storeu_si128((__m128i*)(out + k), _mm_andnot_si128(solid, m));
+	}
+#endif
+
+	for(; k < count; k++) {
+		uint64_t m = row[k + 1];
+		// a block is hidden if all six neighbours are solid, above z=0 is air
+		// and below the bottom is solid
+		uint64_t solid = (m << 1) & ((m >> 1) | bottom) & row[k] & row[k + 2]
+			& north[k] & south[k];
+		out[k] = m & ~solid;
+	}
+}
+
+static void libvxl_chunk_compact(struct libvxl_map* map,
+								 struct libvxl_chunk* chunk, size_t column,
+								 size_t capacity) {
+	size_t length = 0;
+	for(size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++)
+		length += k == column ?
+			capacity :
+			LIBVXL_COLUMN_CAPACITY((size_t)chunk->columns[k].count);
+
+	struct libvxl_chunk compact;
+	libvxl_chunk_alloc(&compact, length * LIBVXL_CHUNK_GROWTH,
+					   ((struct libvxl_shared*)chunk->columns - 1)->allocator);
+
+	for(size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++) {
+		struct libvxl_column* src = chunk->columns + k;
+		struct libvxl_column* dst = compact.columns + k;
+
+		dst->start = compact.index;
+		dst->count = src->count;
+		dst->capacity = k == column ?
+			capacity :
+			LIBVXL_COLUMN_CAPACITY((size_t)src->count);
+		memcpy(compact.blocks + dst->start, chunk->blocks + src->start,
+			   src->count * sizeof(struct libvxl_block));
+		compact.index += dst->capacity;
+		LIBVXL_COUNT(moved_bytes, src->count * sizeof(struct libvxl_block));
+	}
+
+	LIBVXL_COUNT(reallocs, 1);
+
+	libvxl_map_release(map, chunk->columns);
+	chunk->columns = compact.columns;
+	chunk->blocks = compact.blocks;
+	chunk->length = compact.length;
+	chunk->index = compact.index;
+}
+
+// makes room for at least count blocks in a column, a slice that cannot grow
+// in place moves to the end of the storage, which is compacted once it is full
+static void libvxl_column_reserve(struct libvxl_map* map,
+								  struct libvxl_chunk* chunk, size_t column,
+								  size_t count) {
+	libvxl_assert(!chunk->regular, "chunk must be owned first");
+	struct libvxl_column* c = chunk->columns + column;
+
+	if(count <= c->capacity)
+		return;
+
+	size_t capacity = LIBVXL_COLUMN_CAPACITY(count);
+
+	if(c->start + c->capacity == chunk->index
+	   && c->start + capacity <= chunk->length) { // last slice, grows in place
+		c->capacity = capacity;
+		chunk->index = c->start + capacity;
+	} else if(chunk->index + capacity <= chunk->length) {
+		memcpy(chunk->blocks + chunk->index, chunk->blocks + c->start,
+			   c->count * sizeof(struct libvxl_block));
+		c->start = chunk->index;
+		c->capacity = capacity;
+		chunk->index += capacity;
+		LIBVXL_COUNT(relocations, 1);
+		LIBVXL_COUNT(moved_bytes, c->count * sizeof(struct libvxl_block));
+	} else {
+		libvxl_chunk_compact(map, chunk, column, capacity);
+	}
+}
+
+// appends a block below all others of its column
+static void libvxl_chunk_put(struct libvxl_map* map,
+							 struct libvxl_chunk* chunk, libvxl_key pos,
+							 uint32_t color) {
+	libvxl_assert(chunk, "chunk pointer is null");
+
+	libvxl_chunk_own(map, chunk);
+
+	size_t column = libvxl_chunk_column(pos);
+	libvxl_column_reserve(map, chunk, column,
+						  chunk->columns[column].count + 1);
+
+	struct libvxl_column* c = chunk->columns + column;
+	chunk->blocks[c->start + c->count++] = (struct libvxl_block) {
+		.position = pos,
+		.color = color,
+	};
+}
+
+// returns the first block of the column of pos which is not above pos, this
+// is one past the column's slice if there is none, which end is set to
+//
+// Everything is read relative to a single load of the storage pointer, so
+// readers of a concurrent map stay within one allocation. Chunks of these
+// are never regular.
+static struct libvxl_block* libvxl_chunk_gequal_block(
+	struct libvxl_chunk* chunk, libvxl_key pos, struct libvxl_block** end) {
+	libvxl_assert(chunk, "chunk pointer is null");
+
+	struct libvxl_column* columns = chunk->columns;
+	struct libvxl_column* c = columns + libvxl_chunk_column(pos);
+	struct libvxl_block* blocks = chunk->regular ?
+		chunk->blocks :
+		(struct libvxl_block*)(columns + LIBVXL_CHUNK_COLUMNS);
+	blocks += c->start;
+
+	size_t count = c->count;
+	size_t start = 0;
+	size_t stop = count;
+	*end = blocks + count;
+	LIBVXL_COUNT(searches, 1);
+	while(stop > start) {
+		size_t mid = (start + stop) / 2;
+		LIBVXL_COUNT(search_steps, 1);
+		if(pos > blocks[mid].position) {
+			start = mid + 1;
+		} else if(pos < blocks[mid].position) {
+			stop = mid;
+		} else {
+			return blocks + mid;
+		}
+	}
+
+	return blocks + start;
+}
+
+static struct libvxl_block* libvxl_chunk_find(struct libvxl_chunk* chunk,
+											  libvxl_key pos) {
+	libvxl_assert(chunk, "chunk pointer is null");
+
+	struct libvxl_block* end;
+	struct libvxl_block* b = libvxl_chunk_gequal_block(chunk, pos, &end);
+
+	if(b == end || b->position != pos)
+		return NULL;
+
+	return b;
+}
+
+static void libvxl_chunk_insert(struct libvxl_map* map,
+								struct libvxl_chunk* chunk, libvxl_key pos,
+								uint32_t color) {
+	libvxl_assert(chunk, "chunk pointer is null");
+
+	libvxl_chunk_own(map, chunk);
+
+	size_t column = libvxl_chunk_column(pos);
+	struct libvxl_block* end;
+	struct libvxl_block* b = libvxl_chunk_gequal_block(chunk, pos, &end);
+	size_t k = b - (chunk->blocks + chunk->columns[column].start);
+
+	if(b < end && b->position == pos) {
+		b->color = color; // replace color
+		return;
+	}
+
+	libvxl_column_reserve(map, chunk, column,
+						  chunk->columns[column].count + 1);
+
+	// only the blocks of this column need to move
+	struct libvxl_column* c = chunk->columns + column;
+	struct libvxl_block* blocks = chunk->blocks + c->start;
+	memmove(blocks + k + 1, blocks + k,
+			(c->count - k) * sizeof(struct libvxl_block));
+	LIBVXL_COUNT(moved_bytes, (c->count - k) * sizeof(struct libvxl_block));
+	blocks[k].position = pos;
+	blocks[k].color = color;
+	c->count++;
+}
+
+// removes a block, its column keeps the space it used
+static void libvxl_chunk_remove(struct libvxl_map* map,
+								struct libvxl_chunk* chunk, libvxl_key pos) {
+	libvxl_assert(chunk, "chunk pointer is null");
+
+	struct libvxl_block* b = libvxl_chunk_find(chunk, pos);
+	if(!b)
+		return;
+
+	// owning the storage can move the column's slice
+	size_t column = libvxl_chunk_column(pos);
+	size_t index = b - (chunk->blocks + chunk->columns[column].start);
+	libvxl_chunk_own(map, chunk);
+
+	struct libvxl_column* c = chunk->columns + column;
+	b = chunk->blocks + c->start + index;
+	size_t moved = (chunk->blocks + c->start + (--c->count) - b)
+		* sizeof(struct libvxl_block);
+	memmove(b, b + 1, moved);
+	LIBVXL_COUNT(moved_bytes, moved);
+}
+
+static size_t libvxl_span_length(struct libvxl_span* s) {
+	libvxl_assert(s, "span pointer is null");
+
+	return s->length > 0 ? s->length * 4 :
+						   (s->color_end + 2 - s->color_start) * 4;
+}
+
+struct libvxl_column_index {
+	const void* data;
+	size_t len;
+	bool mapped; // data is a file mapping owned by the index
+	size_t* bands;     // byte offset of the first column in each chunk row
+	uint32_t* columns; // byte offset of each column relative to its chunk row
+};
+
+// finds the byte offset of every column by walking only the span headers, if
+// requested the air runs are already cleared from the geometry on the way
+static bool libvxl_index_build(struct libvxl_map* map,
+							   struct libvxl_column_index* index,
+							   bool geometry) {
+	size_t offset = 0;
+	for(size_t y = 0; y < map->height; y++) {
+		if(y % LIBVXL_CHUNK_SIZE == 0)
+			index->bands[y / LIBVXL_CHUNK_SIZE] = offset;
+
+		for(size_t x = 0; x < map->width; x++) {
+			if(offset - index->bands[y / LIBVXL_CHUNK_SIZE] > UINT32_MAX)
+				return false;
+			index->columns[x + y * map->width]
+				= offset - index->bands[y / LIBVXL_CHUNK_SIZE];
+
+			while(1) {
+				if(offset + sizeof(struct libvxl_span) - 1 >= index->len)
+					return false;
+				struct libvxl_span* desc = LIBVXL_SPAN(index->data, offset);
+				if(offset + libvxl_span_length(desc) - 1 >= index->len)
+					return false;
+
+				if(geometry)
+					for(size_t z = desc->air_start; z < desc->color_start; z++)
+						libvxl_geometry_set(map, x, y, z, 0);
+
+				offset += libvxl_span_length(desc);
+				if(!desc->length)
+					break;
+			}
+		}
+
+		if(geometry
+		   && (y % LIBVXL_CHUNK_SIZE == LIBVXL_CHUNK_SIZE - 1
+			   || y == map->height - 1))
+			libvxl_band_share(map, y / LIBVXL_CHUNK_SIZE);
+	}
+
+	return true;
+}
+
+static size_t libvxl_index_get(struct libvxl_map* map,
+							   struct libvxl_column_index* index, size_t x,
+							   size_t y) {
+	return index->bands[y / LIBVXL_CHUNK_SIZE]
+		+ index->columns[x + y * map->width];
+}
+
+static void* libvxl_file_map(const char* name, size_t* size, int* error) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL,
+							  OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(file == INVALID_HANDLE_VALUE) {
+		*error = LIBVXL_ERROR_OPEN;
+		return NULL;
+	}
+
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file, &file_size)) {
+		CloseHandle(file);
+		*error = LIBVXL_ERROR_READ;
+		return NULL;
+	}
+
+	if(file_size.QuadPart == 0) { // can't be mapped
+		CloseHandle(file);
+		*error = LIBVXL_ERROR_FORMAT;
+		return NULL;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	void* data
+		= mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+
+	// the view keeps the file open
+	if(mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+
+	if(!data) {
+		*error = LIBVXL_ERROR_READ;
+		return NULL;
+	}
+
+	*size = file_size.QuadPart;
+	return data;
+#else
+	int fd = open(name, O_RDONLY);
+	if(fd < 0) {
+		*error = LIBVXL_ERROR_OPEN;
+		return NULL;
+	}
+
+	struct stat info;
+	if(fstat(fd, &info) < 0) {
+		close(fd);
+		*error = LIBVXL_ERROR_READ;
+		return NULL;
+	}
+
+	if(info.st_size == 0) { // can't be mapped
+		close(fd);
+		*error = LIBVXL_ERROR_FORMAT;
+		return NULL;
+	}
+
+	void* data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps the file open
+
+	if(data == MAP_FAILED) {
+		*error = LIBVXL_ERROR_READ;
+		return NULL;
+	}
+
+	*size = info.st_size;
+	return data;
+#endif
+}
+
+static void libvxl_file_unmap(const void* data, size_t size) {
+#ifdef _WIN32
+	(void)size;
+	UnmapViewOfFile(data);
+#else
+	munmap((void*)data, size);
+#endif
+}
+
+// frees the column index of a map, which need not be map->lazy
+static void libvxl_index_free(struct libvxl_map* map,
+							  struct libvxl_column_index* index) {
+	if(!index)
+		return;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	if(index->mapped)
+		libvxl_file_unmap(index->data, index->len);
+	libvxl_map_dealloc(map, index->bands, sy * sizeof(size_t));
+	libvxl_map_dealloc(map, index->columns,
+					   map->width * map->height * sizeof(uint32_t));
+	libvxl_map_dealloc(map, index, sizeof(struct libvxl_column_index));
+}
+
+void libvxl_free(struct libvxl_map* map) {
+	if(!map)
+		return;
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t columns = map->width * map->height;
+	for(size_t k = 0; k < sx * sy; k++)
+		libvxl_chunk_release(map->chunks + k);
+	libvxl_map_dealloc(map, map->chunks, sx * sy * sizeof(struct libvxl_chunk));
+	if(map->column_generation)
+		libvxl_changes_reset(map);
+	libvxl_map_dealloc(map, map->column_generation,
+					   sx * sy * sizeof(uint64_t*));
+	libvxl_map_dealloc(map, map->chunk_generation,
+					   sx * sy * sizeof(uint64_t));
+	libvxl_map_dealloc(map, map->top_colors, columns * sizeof(uint32_t));
+	libvxl_map_dealloc(map, map->top_heights, columns * sizeof(uint32_t));
+	libvxl_index_free(map, map->lazy);
+	libvxl_sync_free(map);
+}
+
+static int libvxl_page_cmp(const void* a, const void* b) {
+	uintptr_t aa = *(const uintptr_t*)a;
+	uintptr_t bb = *(const uintptr_t*)b;
+	return aa < bb ? -1 : (aa > bb);
+}
+
+void libvxl_map_stats(struct libvxl_map* map, struct libvxl_stats* stats) {
+	if(!map || !stats)
+		return;
+
+	memset(stats, 0, sizeof(struct libvxl_stats));
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	stats->chunks = sx * sy;
+
+	// chunks can share their geometry, each page is counted once
+	uintptr_t* pages = libvxl_mem_malloc(sx * sy * sizeof(uintptr_t));
+	size_t count = 0;
+	for(size_t k = 0; k < sx * sy; k++)
+		if(map->chunks[k].geometry)
+			pages[count++] = (uintptr_t)map->chunks[k].geometry;
+
+	qsort(pages, count, sizeof(uintptr_t), libvxl_page_cmp);
+	for(size_t k = 0; k < count; k++)
+		if(k == 0 || pages[k] != pages[k - 1])
+			stats->geometry_pages++;
+	libvxl_mem_free(pages);
+
+	stats->geometry_bytes = stats->geometry_pages
+		* (sizeof(struct libvxl_shared)
+		   + libvxl_geometry_words(map) * sizeof(size_t));
+
+	// regular chunks share their column tables, each is counted once too
+	uintptr_t* tables = libvxl_mem_malloc(sx * sy * sizeof(uintptr_t));
+	count = 0;
+
+	for(size_t k = 0; k < sx * sy; k++) {
+		struct libvxl_chunk* chunk = map->chunks + k;
+
+		if(!chunk->columns) // lazily loaded chunk, not decoded yet
+			continue;
+
+		size_t used = 0;
+		for(size_t c = 0; c < LIBVXL_CHUNK_COLUMNS; c++)
+			used += chunk->columns[c].count;
+
+		stats->chunks_decoded++;
+		stats->blocks += used;
+		stats->block_bytes += used * sizeof(struct libvxl_block);
+
+		if(chunk->regular) {
+			stats->regular_chunks++;
+			stats->column_bytes += sizeof(struct libvxl_shared);
+			tables[count++] = (uintptr_t)chunk->columns;
+		} else {
+			stats->slack_bytes
+				+= (chunk->length + 1 - used) * sizeof(struct libvxl_block);
+			stats->column_bytes += sizeof(struct libvxl_shared)
+				+ LIBVXL_CHUNK_COLUMNS * sizeof(struct libvxl_column);
+		}
+
+		stats->fill[chunk->length > used ?
+						used * LIBVXL_STATS_FILL / chunk->length :
+						LIBVXL_STATS_FILL - 1]++;
+	}
+
+	qsort(tables, count, sizeof(uintptr_t), libvxl_page_cmp);
+	for(size_t k = 0; k < count; k++)
+		if(k == 0 || tables[k] != tables[k - 1])
+			stats->column_bytes += sizeof(struct libvxl_shared)
+				+ LIBVXL_CHUNK_COLUMNS * sizeof(struct libvxl_column);
+	libvxl_mem_free(tables);
+
+	if(map->column_generation) {
+		stats->index_bytes += sx * sy * (sizeof(uint64_t*) + sizeof(uint64_t));
+		for(size_t k = 0; k < sx * sy; k++)
+			if(map->column_generation[k])
+				stats->index_bytes += LIBVXL_CHUNK_COLUMNS * sizeof(uint64_t);
+	}
+	if(map->top_colors)
+		stats->index_bytes += map->width * map->height * 2 * sizeof(uint32_t);
+	if(map->lazy)
+		stats->index_bytes += sizeof(struct libvxl_column_index)
+			+ sy * sizeof(size_t)
+			+ map->width * map->height * sizeof(uint32_t);
+
+	stats->total_bytes = sx * sy * sizeof(struct libvxl_chunk)
+		+ stats->block_bytes + stats->slack_bytes + stats->column_bytes
+		+ stats->geometry_bytes + stats->index_bytes;
+}
+
+size_t libvxl_map_compact(struct libvxl_map* map) {
+	if(!map)
+		return 0;
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+	libvxl_sync_begin(map);
+	size_t uniform = libvxl_map_share(map, 0, sx * sy);
+	libvxl_sync_end(map);
+	return uniform;
+}
+
+bool libvxl_counters(struct libvxl_counters* counters, bool reset) {
+#ifdef LIBVXL_COUNTERS
+	// every field is a uint64_t counter
+	uint64_t* from = (uint64_t*)&libvxl_counts;
+	struct libvxl_counters result;
+	uint64_t* to = (uint64_t*)&result;
+	for(size_t k = 0; k < sizeof(struct libvxl_counters) / sizeof(uint64_t);
+		k++)
+		to[k] = libvxl_counter_take(from + k, reset);
+
+	if(counters)
+		*counters = result;
+	return true;
+#else
+	(void)reset;
+	if(counters)
+		memset(counters, 0, sizeof(struct libvxl_counters));
+	return false;
+#endif
+}
+
+// size classes of the pool, four per power of two starting at 64 bytes, up
+// to 896 KiB, anything larger is passed on to libvxl_mem_malloc()
+#define LIBVXL_POOL_CLASSES 56
+#define LIBVXL_POOL_SLAB (256 * 1024)
+// slabs start with their link in the list of all slabs, aligned like blocks
+#define LIBVXL_POOL_HEADER 16
+
+struct libvxl_pool {
+	struct libvxl_allocator allocator;
+#if defined(LIBVXL_NO_THREADS)
+#elif defined(_WIN32)
+	SRWLOCK lock;
+#else
+	pthread_mutex_t lock;
+#endif
+	void* free[LIBVXL_POOL_CLASSES]; // freed blocks, each links to the next
+	uint8_t* carve[LIBVXL_POOL_CLASSES]; // unused rest of the newest slab
+	size_t carve_left[LIBVXL_POOL_CLASSES];
+	void* slabs;
+	size_t reserved;
+};
+
+static size_t libvxl_pool_class_size(size_t k) {
+	return (4 + k % 4) << (k / 4 + 4);
+}
+
+static size_t libvxl_pool_class(size_t size) {
+	if(size <= 64)
+		return 0;
+	size_t h = libvxl_bit_highest(size - 1);
+	return (h - 6) * 4 + (((size - 1) >> (h - 2)) & 3) + 1;
+}
+
+static void libvxl_pool_lock(struct libvxl_pool* pool) {
+#if defined(LIBVXL_NO_THREADS)
+	(void)pool;
+#elif defined(_WIN32)
+	AcquireSRWLockExclusive(&pool->lock);
+#else
+	pthread_mutex_lock(&pool->lock);
+#endif
+}
+
+static void libvxl_pool_unlock(struct libvxl_pool* pool) {
+#if defined(LIBVXL_NO_THREADS)
+	(void)pool;
+#elif defined(_WIN32)
+	ReleaseSRWLockExclusive(&pool->lock);
+#else
+	pthread_mutex_unlock(&pool->lock);
+#endif
+}
+
+static void* libvxl_pool_allocate(void* ctx, size_t size) {
+	struct libvxl_pool* pool = ctx;
+	size_t k = libvxl_pool_class(size);
+	if(k >= LIBVXL_POOL_CLASSES)
+		return libvxl_mem_malloc(size);
+
+	size_t class_size = libvxl_pool_class_size(k);
+	void* block = NULL;
+
+	libvxl_pool_lock(pool);
+
+	if(pool->free[k]) {
+		block = pool->free[k];
+		pool->free[k] = *(void**)block;
+	} else {
+		if(pool->carve_left[k] < class_size) { // start a new slab
+			size_t blocks = LIBVXL_POOL_SLAB / class_size;
+			size_t slab_size
+				= LIBVXL_POOL_HEADER + (blocks ? blocks : 1) * class_size;
+			uint8_t* slab = libvxl_mem_malloc(slab_size);
+
+			if(slab) {
+				*(void**)slab = pool->slabs;
+				pool->slabs = slab;
+				pool->reserved += slab_size;
+				pool->carve[k] = slab + LIBVXL_POOL_HEADER;
+				pool->carve_left[k] = slab_size - LIBVXL_POOL_HEADER;
+			}
+		}
+
+		if(pool->carve_left[k] >= class_size) {
+			block = pool->carve[k];
+			pool->carve[k] += class_size;
+			pool->carve_left[k] -= class_size;
+		}
+	}
+
+	libvxl_pool_unlock(pool);
+
+	return block;
+}
+
+static void libvxl_pool_deallocate(void* ctx, void* ptr, size_t size) {
+	struct libvxl_pool* pool = ctx;
+	size_t k = libvxl_pool_class(size);
+	if(k >= LIBVXL_POOL_CLASSES) {
+		libvxl_mem_free(ptr);
+		return;
+	}
+
+	libvxl_pool_lock(pool);
+	*(void**)ptr = pool->free[k];
+	pool->free[k] = ptr;
+	libvxl_pool_unlock(pool);
+}
+
+struct libvxl_pool* libvxl_pool_create(void) {
+	struct libvxl_pool* pool = libvxl_mem_malloc(sizeof(struct libvxl_pool));
+	if(!pool)
+		return NULL;
+
+	memset(pool, 0, sizeof(struct libvxl_pool));
+	pool->allocator.allocate = libvxl_pool_allocate;
+	pool->allocator.deallocate = libvxl_pool_deallocate;
+	pool->allocator.ctx = pool;
+
+#if defined(LIBVXL_NO_THREADS)
+#elif defined(_WIN32)
+	InitializeSRWLock(&pool->lock);
+#else
+	pthread_mutex_init(&pool->lock, NULL);
+#endif
+
+	return pool;
+}
+
+void libvxl_pool_destroy(struct libvxl_pool* pool) {
+	if(!pool)
+		return;
+
+	while(pool->slabs) {
+		void* next = *(void**)pool->slabs;
+		libvxl_mem_free(pool->slabs);
+		pool->slabs = next;
+	}
+
+#if !defined(LIBVXL_NO_THREADS) && !defined(_WIN32)
+	pthread_mutex_destroy(&pool->lock);
+#endif
+
+	libvxl_mem_free(pool);
+}
+
+const struct libvxl_allocator* libvxl_pool_allocator(struct libvxl_pool* pool) {
+	return pool ? &pool->allocator : NULL;
+}
+
+size_t libvxl_pool_reserved(struct libvxl_pool* pool) {
+	if(!pool)
+		return 0;
+
+	libvxl_pool_lock(pool);
+	size_t reserved = pool->reserved;
+	libvxl_pool_unlock(pool);
+	return reserved;
+}
+
+bool libvxl_size(size_t* size, size_t* depth, const void* data, size_t len) {
+	if(!data || !size || !depth || len == 0)
+		return false;
+	size_t offset = 0;
+	size_t columns = 0;
+	*depth = 0;
+	while(offset + sizeof(struct libvxl_span) - 1 < len) {
+		struct libvxl_span* desc = LIBVXL_SPAN(data, offset);
+		if(desc->color_end + 1 > (int)*depth)
+			*depth = desc->color_end + 1;
+		if(!desc->length)
+			columns++;
+		offset += libvxl_span_length(desc);
+	}
+	*depth = (size_t)(1U << (uint32_t)ceil(log2f(*depth)));
+	*size = sqrt(columns);
+	return true;
+}
+
+static uint32_t libvxl_color_load(const uint8_t* colors, size_t index) {
+	uint32_t color;
+	memcpy(&color, colors + index * sizeof(uint32_t), sizeof(uint32_t));
+	return color;
+}
+
+static bool libvxl_column_decode(struct libvxl_map* map,
+								 struct libvxl_chunk* chunk, size_t x, size_t y,
+								 const void* data, size_t offset, size_t len,
+								 bool geometry) {
+	while(1) {
+		if(offset + sizeof(struct libvxl_span) - 1 >= len)
+			return false;
+		struct libvxl_span* desc = LIBVXL_SPAN(data, offset);
+		if(offset + libvxl_span_length(desc) - 1 >= len)
+			return false;
+		// pieces fed to a libvxl_decoder can start at any address
+		const uint8_t* color_data
+			= (const uint8_t*)data + offset + sizeof(struct libvxl_span);
+
+		if(geometry)
+			for(size_t z = desc->air_start; z < desc->color_start; z++)
+				libvxl_geometry_set(map, x, y, z, 0);
+
+		for(size_t z = desc->color_start; z <= desc->color_end;
+			z++) // top color run
+			libvxl_chunk_put(
+				map, chunk, pos_key(x, y, z),
+				libvxl_color_load(color_data, z - desc->color_start));
+
+		size_t top_len = desc->color_end - desc->color_start + 1;
+		size_t bottom_len = desc->length - 1 - top_len;
+
+		if(desc->length > 0) {
+			if(offset + libvxl_span_length(desc) + sizeof(struct libvxl_span)
+				   - 1
+			   >= len)
+				return false;
+			struct libvxl_span* desc_next
+				= LIBVXL_SPAN(data, offset + libvxl_span_length(desc));
+			for(size_t z = desc_next->air_start - bottom_len;
+				z < desc_next->air_start; z++) // bottom color run
+				libvxl_chunk_put(
+					map, chunk, pos_key(x, y, z),
+					libvxl_color_load(color_data,
+									  z - (desc_next->air_start - bottom_len)
+										  + top_len));
+			offset += libvxl_span_length(desc);
+		} else {
+			return true;
+		}
+	}
+}
+
+// adds a color to the block at [x,y,z] if the map wrapping around exposes it to
+// air at [ox,oy,z] on the opposite edge
+static void libvxl_edge_fixup(struct libvxl_map* map, size_t x, size_t y,
+							  size_t ox, size_t oy, size_t z) {
+	if(!libvxl_geometry_get(map, x, y, z)
+	   || libvxl_geometry_get(map, ox, oy, z))
+		return;
+
+	struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+	if(!libvxl_chunk_find(chunk, pos_key(x, y, z)))
+		libvxl_chunk_insert(map, chunk, pos_key(x, y, z),
+							DEFAULT_COLOR(x, y, z));
+}
+
+// applies the edge fixups of one chunk, this only modifies the chunk itself
+static void libvxl_chunk_fixup(struct libvxl_map* map, size_t chunk_x,
+							   size_t chunk_y) {
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t x_start = chunk_x * LIBVXL_CHUNK_SIZE;
+	size_t y_start = chunk_y * LIBVXL_CHUNK_SIZE;
+	size_t x_end = min(x_start + LIBVXL_CHUNK_SIZE, map->width);
+	size_t y_end = min(y_start + LIBVXL_CHUNK_SIZE, map->height);
+
+	if(chunk_y == 0)
+		for(size_t x = x_start; x < x_end; x++)
+			for(size_t z = 0; z < map->depth; z++)
+				libvxl_edge_fixup(map, x, 0, x, map->height - 1, z);
+
+	if(chunk_y == sy - 1)
+		for(size_t x = x_start; x < x_end; x++)
+			for(size_t z = 0; z < map->depth; z++)
+				libvxl_edge_fixup(map, x, map->height - 1, x, 0, z);
+
+	if(chunk_x == 0)
+		for(size_t y = y_start; y < y_end; y++)
+			for(size_t z = 0; z < map->depth; z++)
+				libvxl_edge_fixup(map, 0, y, map->width - 1, y, z);
+
+	if(chunk_x == sx - 1)
+		for(size_t y = y_start; y < y_end; y++)
+			for(size_t z = 0; z < map->depth; z++)
+				libvxl_edge_fixup(map, map->width - 1, y, 0, y, z);
+}
+
+// decodes the colors of a chunk on first access, its geometry was already
+// filled in by libvxl_index_build()
+static void libvxl_chunk_decode(struct libvxl_map* map,
+								struct libvxl_chunk* chunk) {
+	libvxl_assert(map && map->lazy && chunk && !chunk->blocks,
+				  "invalid input parameters");
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t chunk_x = (chunk - map->chunks) % sx;
+	size_t chunk_y = (chunk - map->chunks) / sx;
+
+	libvxl_chunk_alloc(chunk, LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE * 2,
+					   map->allocator);
+
+	size_t x_end = min((chunk_x + 1) * LIBVXL_CHUNK_SIZE, map->width);
+	size_t y_end = min((chunk_y + 1) * LIBVXL_CHUNK_SIZE, map->height);
+	for(size_t y = chunk_y * LIBVXL_CHUNK_SIZE; y < y_end; y++)
+		for(size_t x = chunk_x * LIBVXL_CHUNK_SIZE; x < x_end; x++)
+			libvxl_column_decode(map, chunk, x, y, map->lazy->data,
+								 libvxl_index_get(map, map->lazy, x, y),
+								 map->lazy->len, false);
+
+	libvxl_chunk_fixup(map, chunk_x, chunk_y);
+
+	if(map->top_colors)
+		for(size_t y = chunk_y * LIBVXL_CHUNK_SIZE; y < y_end; y++)
+			for(size_t x = chunk_x * LIBVXL_CHUNK_SIZE; x < x_end; x++)
+				libvxl_column_top(map, chunk, x, y,
+								  map->top_colors + x + y * map->width,
+								  map->top_heights + x + y * map->width);
+}
+
+struct libvxl_load {
+	struct libvxl_map* map;
+	struct libvxl_column_index* index;
+	bool* failed;
+};
+
+// decodes one band of chunk rows, no other band touches its chunks
+static void libvxl_load_band(void* ctx, size_t band) {
+	struct libvxl_load* load = ctx;
+	struct libvxl_map* map = load->map;
+
+	size_t y_end = min((band + 1) * LIBVXL_CHUNK_SIZE, map->height);
+	for(size_t y = band * LIBVXL_CHUNK_SIZE; y < y_end; y++) {
+		for(size_t x = 0; x < map->width; x++) {
+			if(!libvxl_column_decode(map, chunk_fposition(map, x, y), x, y,
+									 load->index->data,
+									 libvxl_index_get(map, load->index, x, y),
+									 load->index->len, true)) {
+				load->failed[band] = true;
+				return;
+			}
+		}
+	}
+
+	libvxl_band_share(map, band);
+}
+
+static void libvxl_load_fixup(void* ctx, size_t chunk) {
+	struct libvxl_map* map = ((struct libvxl_load*)ctx)->map;
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	libvxl_chunk_fixup(map, chunk % sx, chunk / sx);
+}
+
+// the sizes pos_key() and the vxl format allow for
+static bool libvxl_size_valid(size_t w, size_t h, size_t d) {
+	return w > 0 && h > 0 && d > 0 && w <= LIBVXL_MAX_SIZE
+		&& h <= LIBVXL_MAX_SIZE && d <= LIBVXL_MAX_DEPTH;
+}
+
+// allocates the chunks and tables of a map, if it is going to be decoded its
+// geometry starts out solid and the air runs are cleared as columns arrive,
+// deferred chunks get their storage later from whoever fills them
+static void libvxl_map_init(struct libvxl_map* map, size_t w, size_t h,
+							size_t d,
+							const struct libvxl_create_options* options,
+							bool deferred, bool solid) {
+	map->streamed = 0;
+	map->lazy = NULL;
+	map->sync = NULL;
+	map->generation = 0;
+	map->width = w;
+	map->height = h;
+	map->depth = d;
+	map->allocator = options && options->allocator ? options->allocator :
+													 &libvxl_default_allocator;
+	size_t sx = (w + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (h + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	map->chunks
+		= libvxl_map_alloc(map, sx * sy * sizeof(struct libvxl_chunk));
+	for(size_t y = 0; y < sy; y++) {
+		for(size_t x = 0; x < sx; x++) {
+			// by libvxl_chunk_decode(), or band by band as an empty map is
+			// filled
+			if(deferred) {
+				map->chunks[x + y * sx].length = 0;
+				map->chunks[x + y * sx].index = 0;
+				map->chunks[x + y * sx].columns = NULL;
+				map->chunks[x + y * sx].blocks = NULL;
+				map->chunks[x + y * sx].regular = false;
+				continue;
+			}
+
+			// allows for two fully filled layers
+			libvxl_chunk_alloc(map->chunks + x + y * sx,
+							   LIBVXL_CHUNK_SIZE * LIBVXL_CHUNK_SIZE * 2,
+							   map->allocator);
+		}
+	}
+
+	// all chunks start out on the same page, each one writing to it gets its
+	// own copy, see libvxl_map_share()
+	size_t sg = libvxl_geometry_words(map) * sizeof(size_t);
+	size_t* page = libvxl_shared_alloc(map->allocator, sg);
+	memset(page, solid ? 0xFF : 0x00, sg);
+	for(size_t k = 0; k < sx * sy; k++) {
+		if(k > 0)
+			libvxl_shared_retain(page);
+		map->chunks[k].geometry = page;
+	}
+
+	map->column_generation
+		= libvxl_map_alloc(map, sx * sy * sizeof(uint64_t*));
+	map->chunk_generation = libvxl_map_alloc(map, sx * sy * sizeof(uint64_t));
+	memset(map->column_generation, 0, sx * sy * sizeof(uint64_t*));
+	memset(map->chunk_generation, 0, sx * sy * sizeof(uint64_t));
+
+	map->top_colors = NULL;
+	map->top_heights = NULL;
+	if(options && options->overview) { // filled in as chunks are decoded
+		map->top_colors = libvxl_map_alloc(map, w * h * sizeof(uint32_t));
+		map->top_heights = libvxl_map_alloc(map, w * h * sizeof(uint32_t));
+	}
+}
+
+// applies the edge fixups, shares the geometry of uniform chunks and fills in
+// the overview once every column of the map is decoded
+static void libvxl_load_finish(struct libvxl_map* map, size_t threads) {
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	struct libvxl_load load = {.map = map};
+	libvxl_parallel(threads, sx * sy, libvxl_load_fixup, &load);
+	libvxl_map_share(map, 0, sx * sy);
+
+	if(map->top_colors)
+		for(size_t y = 0; y < map->height; y++)
+			for(size_t x = 0; x < map->width; x++)
+				libvxl_column_top(map, chunk_fposition(map, x, y), x, y,
+								  map->top_colors + x + y * map->width,
+								  map->top_heights + x + y * map->width);
+}
+
+bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d,
+				   const void* data, size_t len) {
+	return libvxl_create_ex(map, w, h, d, data, len, NULL);
+}
+
+bool libvxl_create_ex(struct libvxl_map* map, size_t w, size_t h, size_t d,
+					  const void* data, size_t len,
+					  const struct libvxl_create_options* options) {
+	if(!map || !libvxl_size_valid(w, h, d))
+		return false;
+	bool lazy = data && options && options->lazy && !options->concurrent;
+	libvxl_map_init(map, w, h, d, options, lazy || !data, data != NULL);
+	size_t sx = (w + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (h + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+	if(!data) {
+		// each band is shared before the next one is allocated, which keeps
+		// the peak close to the final size, nothing is tracked while filling
+		uint64_t** tracking = map->column_generation;
+		map->column_generation = NULL;
+
+		for(size_t y = 0; y < h; y++) {
+			if(y % LIBVXL_CHUNK_SIZE == 0) // allows for two fully filled layers
+				for(size_t k = y / LIBVXL_CHUNK_SIZE * sx;
+					k < (y / LIBVXL_CHUNK_SIZE + 1) * sx; k++)
+					libvxl_chunk_alloc(map->chunks + k,
+									   LIBVXL_CHUNK_COLUMNS * 2,
+									   map->allocator);
+
+			for(size_t x = 0; x < w; x++)
+				libvxl_map_set(map, x, y, d - 1, DEFAULT_COLOR(x, y, d - 1));
+
+			if(y % LIBVXL_CHUNK_SIZE == LIBVXL_CHUNK_SIZE - 1 || y == h - 1)
+				libvxl_band_share(map, y / LIBVXL_CHUNK_SIZE);
+		}
+
+		map->column_generation = tracking;
+	}
+
+	map->generation = 0;
+	libvxl_changes_reset(map);
+
+	bool concurrent = options && options->concurrent;
+
+	if(!data) {
+		libvxl_map_share(map, 0, sx * sy);
+		if(concurrent)
+			libvxl_map_concurrent(map);
+		return true;
+	}
+
+	struct libvxl_column_index* index
+		= libvxl_map_alloc(map, sizeof(struct libvxl_column_index));
+	index->data = data;
+	index->len = len;
+	index->mapped = false;
+	index->bands = libvxl_map_alloc(map, sy * sizeof(size_t));
+	index->columns = libvxl_map_alloc(map, w * h * sizeof(uint32_t));
+
+	if(!libvxl_index_build(map, index, lazy)) {
+		libvxl_index_free(map, index);
+		return false;
+	}
+
+	if(lazy) {
+		libvxl_map_share(map, 0, sx * sy);
+		map->lazy = index;
+		return true;
+	}
+
+	size_t threads = options ? options->threads : 1;
+
+	struct libvxl_load load = {
+		.map = map,
+		.index = index,
+		.failed = libvxl_mem_malloc(sy * sizeof(bool)),
+	};
+
+	memset(load.failed, 0, sy * sizeof(bool));
+
+	libvxl_parallel(threads, sy, libvxl_load_band, &load);
+
+	bool success = true;
+	for(size_t k = 0; k < sy; k++)
+		success = success && !load.failed[k];
+
+	if(success)
+		libvxl_load_finish(map, threads);
+
+	libvxl_index_free(map, index);
+	libvxl_mem_free(load.failed);
+
+	if(success && concurrent)
+		libvxl_map_concurrent(map);
+
+	return success;
+}
+
+int libvxl_readfile(struct libvxl_map* map, const char* name, size_t w,
+					size_t h, size_t d,
+					const struct libvxl_create_options* options) {
+	if(!map || !name)
+		return LIBVXL_ERROR_INVALID;
+
+	int error = LIBVXL_OK;
+	size_t len;
+	void* data = libvxl_file_map(name, &len, &error);
+	if(!data)
+		return error;
+
+	if(!w || !h || !d) {
+		size_t size, depth;
+		if(!libvxl_size(&size, &depth, data, len)) {
+			libvxl_file_unmap(data, len);
+			return LIBVXL_ERROR_FORMAT;
+		}
+
+		w = h = size;
+		d = depth;
+	}
+
+	if(!libvxl_create_ex(map, w, h, d, data, len, options)) {
+		libvxl_free(map);
+		libvxl_file_unmap(data, len);
+		return LIBVXL_ERROR_FORMAT;
+	}
+
+	if(map->lazy) { // chunks still refer to the file, unmapped by libvxl_free()
+		map->lazy->mapped = true;
+	} else {
+		libvxl_file_unmap(data, len);
+	}
+
+	return LIBVXL_OK;
+}
+
+// returns the size of the column at the start of data, or 0 if it does not
+// fit into len yet, in which case need is set to how many bytes are required
+// to read further into it, or to 0 if the column is invalid. Unlike
+// libvxl_index_build() every span is checked to lie in order inside the map.
+static size_t libvxl_column_size(const void* data, size_t len, size_t depth,
+								 size_t* need) {
+	size_t offset = 0;
+	// end of the previous top color run and length of its bottom run
+	size_t top = 0, bottom = 0;
+	while(1) {
+		if(offset + sizeof(struct libvxl_span) > len) {
+			*need = offset + sizeof(struct libvxl_span);
+			return 0;
+		}
+
+		struct libvxl_span* desc = LIBVXL_SPAN(data, offset);
+		size_t top_len = desc->color_end + 1 - desc->color_start;
+		if(desc->air_start < top + bottom
+		   || desc->air_start > desc->color_start
+		   || desc->color_start > desc->color_end + 1
+		   || (size_t)desc->color_end + 1 > depth
+		   || (desc->length > 0 && desc->length - 1 < (int)top_len)) {
+			*need = 0;
+			return 0;
+		}
+
+		if(offset + libvxl_span_length(desc) > len) {
+			*need = offset + libvxl_span_length(desc);
+			return 0;
+		}
+
+		offset += libvxl_span_length(desc);
+		if(!desc->length)
+			return offset;
+		top = desc->color_end + 1;
+		bottom = desc->length - 1 - top_len;
+	}
+}
+
+void libvxl_decode_begin(struct libvxl_decoder* decoder,
+						 struct libvxl_map* map, size_t w, size_t h, size_t d,
+						 const struct libvxl_create_options* options) {
+	libvxl_assert(decoder && map, "invalid input parameters");
+
+	decoder->map = map;
+	decoder->column = 0;
+	decoder->carry = NULL;
+	decoder->carry_length = 0;
+	decoder->carry_capacity = 0;
+	decoder->threads = options ? options->threads : 1;
+	decoder->concurrent = options && options->concurrent;
+	decoder->failed = !libvxl_size_valid(w, h, d);
+
+	// an empty map, which libvxl_decode_end() frees again
+	if(decoder->failed)
+		memset(map, 0, sizeof(struct libvxl_map));
+	else
+		libvxl_map_init(map, w, h, d, options, false, true);
+}
+
+// decodes the next column of the map, which is complete in data
+static bool libvxl_decode_column(struct libvxl_decoder* decoder,
+								 const void* data, size_t len) {
+	struct libvxl_map* map = decoder->map;
+	size_t x = decoder->column % map->width;
+	size_t y = decoder->column / map->width;
+	decoder->column++;
+	if(!libvxl_column_decode(map, chunk_fposition(map, x, y), x, y, data, 0,
+							 len, true))
+		return false;
+
+	if(x == map->width - 1
+	   && (y % LIBVXL_CHUNK_SIZE == LIBVXL_CHUNK_SIZE - 1
+		   || y == map->height - 1))
+		libvxl_band_share(map, y / LIBVXL_CHUNK_SIZE);
+
+	return true;
+}
+
+static void libvxl_decode_carry(struct libvxl_decoder* decoder,
+								const uint8_t* data, size_t len) {
+	if(decoder->carry_length + len > decoder->carry_capacity) {
+		decoder->carry_capacity = (decoder->carry_length + len) * 2;
+		decoder->carry
+			= libvxl_mem_realloc(decoder->carry, decoder->carry_capacity);
+	}
+	memcpy(decoder->carry + decoder->carry_length, data, len);
+	decoder->carry_length += len;
+}
+
+bool libvxl_decode_feed(struct libvxl_decoder* decoder, const void* data,
+						size_t len) {
+	if(!decoder || decoder->failed || (!data && len > 0))
+		return false;
+
+	const uint8_t* input = data;
+	size_t columns = decoder->map->width * decoder->map->height;
+	size_t depth = decoder->map->depth;
+
+	// first completes the column that was cut off by the previous piece, only
+	// as many bytes as it needs are copied
+	while(decoder->carry_length > 0 && len > 0) {
+		size_t need;
+		size_t size = libvxl_column_size(decoder->carry, decoder->carry_length,
+										 depth, &need);
+		if(!size && need > 0) {
+			size_t n = min(need - decoder->carry_length, len);
+			libvxl_decode_carry(decoder, input, n);
+			input += n;
+			len -= n;
+			size = libvxl_column_size(decoder->carry, decoder->carry_length,
+									  depth, &need);
+		}
+
+		if(!size && need == 0) {
+			decoder->failed = true;
+			return false;
+		}
+
+		if(size) {
+			if(!libvxl_decode_column(decoder, decoder->carry, size)) {
+				decoder->failed = true;
+				return false;
+			}
+			decoder->carry_length = 0;
+		}
+	}
+
+	// complete columns are decoded straight from the piece
+	size_t offset = 0;
+	while(decoder->carry_length == 0 && decoder->column < columns) {
+		size_t need;
+		size_t size = libvxl_column_size(input + offset, len - offset,
+										 depth, &need);
+		if(!size && need > 0)
+			break;
+		if(!size || !libvxl_decode_column(decoder, input + offset, size)) {
+			decoder->failed = true;
+			return false;
+		}
+		offset += size;
+	}
+
+	// bytes after the last column are ignored, just like libvxl_create() does
+	if(decoder->column < columns && offset < len)
+		libvxl_decode_carry(decoder, input + offset, len - offset);
+
+	return true;
+}
+
+bool libvxl_decode_end(struct libvxl_decoder* decoder) {
+	if(!decoder)
+		return false;
+
+	struct libvxl_map* map = decoder->map;
+	bool success = !decoder->failed
+		&& decoder->column == map->width * map->height;
+
+	libvxl_mem_free(decoder->carry);
+	decoder->carry = NULL;
+	decoder->carry_length = 0;
+	decoder->carry_capacity = 0;
+
+	if(!success) {
+		libvxl_free(map);
+		return false;
+	}
+
+	libvxl_load_finish(map, decoder->threads);
+	if(decoder->concurrent)
+		libvxl_map_concurrent(map);
+
+	return true;
+}
+
+static size_t find_successive_surface(struct libvxl_block* blocks,
+									  size_t count, size_t block_offset,
+									  int x, int y, size_t start,
+									  struct libvxl_block** current) {
+	libvxl_assert(blocks && current, "block pointer is null");
+
+	*current = blocks + block_offset;
+	struct libvxl_block* end_marker = blocks + count;
+
+	if(*current < end_marker && (*current)->position == pos_key(x, y, start)) {
+		while(1) {
+			uint32_t next_z = key_getz((*current)->position) + 1;
+			(*current)++;
+
+			if(*current >= end_marker
+			   || (*current)->position != pos_key(x, y, next_z))
+				return next_z;
+		}
+	} else {
+		return start;
+	}
+}
+
+static void libvxl_column_encode(struct libvxl_map* map, int x, int y,
+								 void* out, size_t* offset) {
+	libvxl_assert(map && out && offset, "invalid input parameters");
+
+	struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+	struct libvxl_column* column
+		= chunk->columns + libvxl_chunk_column(pos_key(x, y, 0));
+	struct libvxl_block* blocks = chunk->blocks + column->start;
+	size_t count = column->count;
+	size_t next = 0;
+
+	bool first_run = true;
+	size_t z = count > 0 ? key_getz(blocks[0].position) : map->depth - 1;
+	while(1) {
+		size_t top_start = libvxl_geometry_get(map, x, y, z) || next >= count ?
+			z :
+			key_getz(blocks[next].position);
+
+		struct libvxl_block* last_surface_block;
+		size_t top_end = find_successive_surface(
+			blocks, count, next, x, y, top_start, &last_surface_block);
+
+		size_t bottom_start = map->depth;
+
+		if(top_end == map->depth || !libvxl_geometry_get(map, x, y, top_end)) {
+			bottom_start = top_end;
+		} else if(last_surface_block < blocks + count
+				  && key_discardz(last_surface_block->position)
+					  == pos_key(x, y, 0)) {
+			bottom_start = key_getz(last_surface_block->position);
+		}
+
+		struct libvxl_span* desc = LIBVXL_SPAN(out, *offset);
+		desc->color_start = top_start;
+		desc->color_end = top_end - 1;
+		desc->air_start = first_run ? 0 : z;
+		*offset += sizeof(struct libvxl_span);
+
+		libvxl_assert(desc->air_start <= desc->color_start,
+					  "air_start is bigger than color_start");
+		libvxl_assert(desc->color_start <= desc->color_end + 1,
+					  "color_start is bigger than color_end + 1");
+
+		first_run = false;
+
+		for(size_t k = top_start; k < top_end; k++) {
+			*(uint32_t*)LIBVXL_SPAN(out, *offset)
+				= (blocks[next++].color & 0xFFFFFF) | 0x7F000000;
+			*offset += sizeof(uint32_t);
+		}
+
+		if(bottom_start == map->depth) {
+			/* this is the last span of this column, do not emit bottom colors,
+			 * set length to 0 */
+			desc->length = 0;
+			break;
+		} else { // bottom_start < map->depth
+			struct libvxl_block* last_surface_block;
+			size_t bottom_end = find_successive_surface(
+				blocks, count, next, x, y, bottom_start, &last_surface_block);
+
+			// there are more spans to follow, emit bottom colors
+			if(bottom_end < map->depth) {
+				desc->length
+					= 1 + top_end - top_start + bottom_end - bottom_start;
+
+				for(size_t k = bottom_start; k < bottom_end; k++) {
+					*(uint32_t*)LIBVXL_SPAN(out, *offset)
+						= (blocks[next++].color & 0xFFFFFF) | 0x7F000000;
+					*offset += sizeof(uint32_t);
+				}
+
+				z = bottom_end;
+			} else { // bottom_end == map->depth
+				desc->length = 1 + top_end - top_start;
+				z = bottom_start;
+			}
+		}
+	}
+}
+
+// upper bound of bytes libvxl_column_encode() emits for one column: at most
+// one span per z level plus the terminating one, and one color per block
+#define LIBVXL_COLUMN_MAX_SIZE(depth)                                          \
+	(((depth)*2 + 1) * sizeof(uint32_t))
+
+// zlib compressed streams (RFC 1950 and 1951), the encoder only emits blocks
+// with the fixed huffman codes, which are cheap and still cut the size of map
+// data well since most of it are repeated colors
+#define LIBVXL_DEFLATE_WINDOW 32768
+#define LIBVXL_DEFLATE_HASH 15 // bits of a hash of three bytes
+#define LIBVXL_DEFLATE_MATCH 258
+#define LIBVXL_DEFLATE_CHAIN 16	   // candidates compared per position
+#define LIBVXL_DEFLATE_BLOCK 65536 // symbols per block
+
+static const uint16_t libvxl_length_base[29] = {
+	3,	4,	5,	6,	7,	8,	9,	10,	 11,  13,  15,	17,	 19,  23, 27,
+	31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+
+static const uint8_t libvxl_length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+	2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+
+static const uint16_t libvxl_distance_base[30] = {
+	1,	  2,	3,	  4,	5,	  7,	 9,		13,	   17,	  25,
+	33,	  49,	65,	  97,	129,  193,	 257,	385,   513,	  769,
+	1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+
+static const uint8_t libvxl_distance_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+	6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+static uint32_t libvxl_reverse(uint32_t code, size_t length) {
+	uint32_t result = 0;
+	for(size_t k = 0; k < length; k++, code >>= 1)
+		result = (result << 1) | (code & 1);
+	return result;
+}
+
+static void libvxl_adler32(uint32_t* adler, const uint8_t* data, size_t len) {
+	uint32_t a = *adler & 0xFFFF, b = *adler >> 16;
+	while(len > 0) { // the sums cannot overflow for this many bytes
+		size_t n = min(len, 5552);
+		for(size_t k = 0; k < n; k++) {
+			a += data[k];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		data += n;
+		len -= n;
+	}
+	*adler = a | (b << 16);
+}
+
+struct libvxl_deflate {
+	uint8_t* data; // raw bytes, a window of them is kept in front of pos
+	size_t length, capacity, pos;
+	int32_t head[1 << LIBVXL_DEFLATE_HASH];
+	int32_t prev[LIBVXL_DEFLATE_WINDOW];
+	uint16_t codes[288]; // fixed literal/length codes, bits reversed
+	uint8_t* out;
+	size_t out_length, out_capacity;
+	uint64_t bits;
+	size_t bit_count;
+	uint32_t adler;
+	size_t symbols; // in the current block
+	bool finished;
+};
+
+static void libvxl_deflate_bits(struct libvxl_deflate* d, uint32_t value,
+								size_t count) {
+	d->bits |= (uint64_t)value << d->bit_count;
+	d->bit_count += count;
+	while(d->bit_count >= 8) {
+		d->out[d->out_length++] = d->bits & 0xFF;
+		d->bits >>= 8;
+		d->bit_count -= 8;
+	}
+}
+
+static size_t libvxl_fixed_length(size_t symbol) {
+	if(symbol < 144)
+		return 8;
+	if(symbol < 256)
+		return 9;
+	return symbol < 280 ? 7 : 8;
+}
+
+// buffers up to three windows of raw bytes and one column of a map this deep
+static struct libvxl_deflate* libvxl_deflate_create(size_t depth) {
+	struct libvxl_deflate* d
+		= libvxl_mem_malloc(sizeof(struct libvxl_deflate));
+	d->capacity = 3 * LIBVXL_DEFLATE_WINDOW + LIBVXL_COLUMN_MAX_SIZE(depth)
+		+ LIBVXL_DEFLATE_MATCH;
+	d->data = libvxl_mem_malloc(d->capacity);
+	d->length = 0;
+	d->pos = 0;
+	memset(d->head, 0xFF, sizeof(d->head));
+	memset(d->prev, 0xFF, sizeof(d->prev));
+
+	uint32_t next[4] = {0x30, 0x190, 0x00, 0xC0}; // first code of each range
+	for(size_t k = 0; k < 288; k++) {
+		size_t range = k < 144 ? 0 : (k < 256 ? 1 : (k < 280 ? 2 : 3));
+		d->codes[k] = libvxl_reverse(next[range]++, libvxl_fixed_length(k));
+	}
+
+	d->out_capacity = 4096;
+	d->out = libvxl_mem_malloc(d->out_capacity);
+	d->out_length = 0;
+	d->bits = 0;
+	d->bit_count = 0;
+	d->adler = 1;
+	d->symbols = 0;
+	d->finished = false;
+
+	// zlib header for a 32K window, then the first fixed block
+	d->out[d->out_length++] = 0x78;
+	d->out[d->out_length++] = 0x01;
+	libvxl_deflate_bits(d, 2, 3);
+	return d;
+}
+
+static void libvxl_deflate_free(struct libvxl_deflate* d) {
+	if(!d)
+		return;
+	libvxl_mem_free(d->data);
+	libvxl_mem_free(d->out);
+	libvxl_mem_free(d);
+}
+
+static void libvxl_deflate_symbol(struct libvxl_deflate* d, size_t symbol) {
+	libvxl_deflate_bits(d, d->codes[symbol], libvxl_fixed_length(symbol));
+}
+
+static void libvxl_deflate_match(struct libvxl_deflate* d, size_t length,
+								 size_t distance) {
+	size_t code = 0;
+	while(code < 28 && libvxl_length_base[code + 1] <= length)
+		code++;
+	libvxl_deflate_symbol(d, 257 + code);
+	libvxl_deflate_bits(d, length - libvxl_length_base[code],
+						libvxl_length_extra[code]);
+
+	// two distance codes per power of two above 4
+	size_t d1 = distance - 1;
+	if(d1 < 4) {
+		code = d1;
+	} else {
+		size_t high = libvxl_bit_highest(d1);
+		code = high * 2 + ((d1 >> (high - 1)) & 1);
+	}
+	libvxl_deflate_bits(d, libvxl_reverse(code, 5), 5);
+	libvxl_deflate_bits(d, distance - libvxl_distance_base[code],
+						libvxl_distance_extra[code]);
+}
+
+static size_t libvxl_deflate_hash(const uint8_t* p) {
+	uint32_t v = p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16);
+	return (v * 2654435761U) >> (32 - LIBVXL_DEFLATE_HASH);
+}
+
+// compresses the raw bytes appended so far, all but the last ones which could
+// still be part of a longer match unless this is the end of the stream
+static void libvxl_deflate_compress(struct libvxl_deflate* d, bool finish) {
+	size_t limit = d->length;
+	if(!finish)
+		limit = d->length > LIBVXL_DEFLATE_MATCH ?
+			d->length - LIBVXL_DEFLATE_MATCH :
+			0;
+
+	if(d->pos < limit) {
+		// at most 9 bits for each byte and a few block headers
+		size_t needed = d->out_length + (limit - d->pos) * 2 + 64;
+		if(needed > d->out_capacity) {
+			d->out_capacity = needed * 2;
+			d->out = libvxl_mem_realloc(d->out, d->out_capacity);
+		}
+	}
+
+	while(d->pos < limit) {
+		const uint8_t* cur = d->data + d->pos;
+		size_t best = 0, distance = 0;
+
+		if(d->pos + 3 <= d->length) {
+			size_t max = min(d->length - d->pos, LIBVXL_DEFLATE_MATCH);
+			int32_t candidate = d->head[libvxl_deflate_hash(cur)];
+
+			for(size_t chain = 0; chain < LIBVXL_DEFLATE_CHAIN && candidate >= 0
+				&& d->pos - candidate <= LIBVXL_DEFLATE_WINDOW;
+				chain++) {
+				const uint8_t* other = d->data + candidate;
+				if(other[best] == cur[best]) {
+					size_t n = 0;
+					while(n < max && other[n] == cur[n])
+						n++;
+					if(n > best) {
+						best = n;
+						distance = d->pos - candidate;
+						if(n == max)
+							break;
+					}
+				}
+				candidate = d->prev[candidate & (LIBVXL_DEFLATE_WINDOW - 1)];
+			}
+		}
+
+		size_t advance = 1;
+		if(best >= 3) {
+			libvxl_deflate_match(d, best, distance);
+			advance = best;
+		} else {
+			libvxl_deflate_symbol(d, *cur);
+		}
+
+		for(size_t k = 0; k < advance; k++, d->pos++) {
+			if(d->pos + 3 > d->length)
+				continue;
+			size_t h = libvxl_deflate_hash(d->data + d->pos);
+			d->prev[d->pos & (LIBVXL_DEFLATE_WINDOW - 1)] = d->head[h];
+			d->head[h] = d->pos;
+		}
+
+		if(++d->symbols == LIBVXL_DEFLATE_BLOCK) { // start another block
+			libvxl_deflate_symbol(d, 256);
+			libvxl_deflate_bits(d, 2, 3);
+			d->symbols = 0;
+		}
+	}
+
+	if(finish && !d->finished) {
+		if(d->out_length + 16 > d->out_capacity) {
+			d->out_capacity = d->out_length + 16;
+			d->out = libvxl_mem_realloc(d->out, d->out_capacity);
+		}
+
+		// end the block, an empty final one follows
+		libvxl_deflate_symbol(d, 256);
+		libvxl_deflate_bits(d, 3, 3);
+		libvxl_deflate_symbol(d, 256);
+		if(d->bit_count > 0)
+			libvxl_deflate_bits(d, 0, 8 - d->bit_count);
+
+		for(size_t k = 0; k < 4; k++)
+			d->out[d->out_length++] = d->adler >> (24 - k * 8);
+		d->finished = true;
+	}
+}
+
+// drops raw bytes no match can reach anymore
+static void libvxl_deflate_slide(struct libvxl_deflate* d) {
+	if(d->pos < 2 * LIBVXL_DEFLATE_WINDOW)
+		return;
+
+	size_t shift
+		= (d->pos / LIBVXL_DEFLATE_WINDOW - 1) * LIBVXL_DEFLATE_WINDOW;
+	memmove(d->data, d->data + shift, d->length - shift);
+	d->length -= shift;
+	d->pos -= shift;
+
+	int32_t offset = shift;
+	for(size_t k = 0; k < (1 << LIBVXL_DEFLATE_HASH); k++)
+		d->head[k] = d->head[k] >= offset ? d->head[k] - offset : -1;
+	for(size_t k = 0; k < LIBVXL_DEFLATE_WINDOW; k++)
+		d->prev[k] = d->prev[k] >= offset ? d->prev[k] - offset : -1;
+}
+
+#define LIBVXL_HUFFMAN_FAST 9 // bits resolved by a single table lookup
+
+// canonical huffman code, codes of up to LIBVXL_HUFFMAN_FAST bits are found
+// in fast as (length << 9 | symbol), longer ones are decoded bit by bit
+struct libvxl_huffman {
+	uint16_t count[16];
+	uint16_t symbol[288];
+	uint16_t fast[1 << LIBVXL_HUFFMAN_FAST];
+};
+
+enum libvxl_inflate_state {
+	LIBVXL_INFLATE_HEADER,
+	LIBVXL_INFLATE_BLOCKS,
+	LIBVXL_INFLATE_STORED,
+	LIBVXL_INFLATE_CODES,
+	LIBVXL_INFLATE_CHECKSUM,
+	LIBVXL_INFLATE_DONE,
+	LIBVXL_INFLATE_INVALID,
+};
+
+struct libvxl_inflate {
+	uint8_t* data;
+	size_t length, capacity;
+	uint8_t* input;
+	size_t input_length, input_capacity;
+	// reader position after the last fully decoded symbol
+	size_t offset;
+	uint64_t bits;
+	size_t bit_count;
+	uint32_t adler;
+	// output before this was consumed and is only kept as the window
+	size_t consumed;
+	enum libvxl_inflate_state state;
+	bool last;
+	// bytes left in the current stored block
+	size_t stored;
+	struct libvxl_huffman literals, distances;
+};
+
+struct libvxl_bit_reader {
+	const uint8_t* data;
+	size_t length, offset;
+	uint64_t bits;
+	size_t count;
+	bool underflow;
+};
+
+static void libvxl_bits_fill(struct libvxl_bit_reader* r, size_t n) {
+	while(r->count < n && r->offset < r->length) {
+		r->bits |= (uint64_t)r->data[r->offset++] << r->count;
+		r->count += 8;
+	}
+}
+
+static uint32_t libvxl_bits_get(struct libvxl_bit_reader* r, size_t n) {
+	libvxl_bits_fill(r, n);
+	if(r->count < n) {
+		r->underflow = true;
+		return 0;
+	}
+
+	uint32_t value = r->bits & (((uint64_t)1 << n) - 1);
+	r->bits >>= n;
+	r->count -= n;
+	return value;
+}
+
+// returns false if the code lengths are over-subscribed
+static bool libvxl_huffman_build(struct libvxl_huffman* h,
+								 const uint8_t* lengths, size_t n) {
+	memset(h->count, 0, sizeof(h->count));
+	memset(h->fast, 0, sizeof(h->fast));
+	for(size_t k = 0; k < n; k++)
+		h->count[lengths[k]]++;
+	h->count[0] = 0;
+
+	int left = 1;
+	for(size_t len = 1; len < 16; len++) {
+		left = left * 2 - h->count[len];
+		if(left < 0)
+			return false;
+	}
+
+	uint16_t offsets[16];
+	offsets[1] = 0;
+	for(size_t len = 1; len < 15; len++)
+		offsets[len + 1] = offsets[len] + h->count[len];
+	for(size_t k = 0; k < n; k++)
+		if(lengths[k])
+			h->symbol[offsets[lengths[k]]++] = k;
+
+	// codes are assigned in order of length and then symbol
+	uint32_t code = 0;
+	size_t index = 0;
+	for(size_t len = 1; len <= LIBVXL_HUFFMAN_FAST; len++) {
+		for(size_t k = 0; k < h->count[len]; k++, code++) {
+			uint32_t reversed = libvxl_reverse(code, len);
+			for(size_t e = reversed; e < (1 << LIBVXL_HUFFMAN_FAST);
+				e += (size_t)1 << len)
+				h->fast[e] = (len << 9) | h->symbol[index + k];
+		}
+		index += h->count[len];
+		code <<= 1;
+	}
+
+	return true;
+}
+
+// returns the next symbol, or -1 if the code is invalid or input is missing
+static int libvxl_huffman_decode(struct libvxl_bit_reader* r,
+								 const struct libvxl_huffman* h) {
+	libvxl_bits_fill(r, 15);
+
+	uint16_t entry = h->fast[r->bits & ((1 << LIBVXL_HUFFMAN_FAST) - 1)];
+	if(entry && (size_t)(entry >> 9) <= r->count) {
+		r->bits >>= entry >> 9;
+		r->count -= entry >> 9;
+		return entry & 0x1FF;
+	}
+
+	int code = 0, first = 0, index = 0;
+	for(size_t len = 1; len < 16; len++) {
+		code |= libvxl_bits_get(r, 1);
+		if(r->underflow)
+			return -1;
+		int count = h->count[len];
+		if(code - first < count)
+			return h->symbol[index + code - first];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+
+	return -1;
+}
+
+static void libvxl_inflate_reserve(struct libvxl_inflate* inflate,
+								   size_t length) {
+	if(inflate->length + length <= inflate->capacity)
+		return;
+	inflate->capacity = (inflate->length + length) * 2;
+	inflate->data = libvxl_mem_realloc(inflate->data, inflate->capacity);
+}
+
+// reads the code lengths of a block with its own huffman codes
+static bool libvxl_inflate_tables(struct libvxl_inflate* inflate,
+								  struct libvxl_bit_reader* r) {
+	static const uint8_t order[19]
+		= {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+	size_t literals = libvxl_bits_get(r, 5) + 257;
+	size_t distances = libvxl_bits_get(r, 5) + 1;
+	size_t codes = libvxl_bits_get(r, 4) + 4;
+
+	uint8_t lengths[288 + 32];
+	memset(lengths, 0, 19);
+	for(size_t k = 0; k < codes; k++)
+		lengths[order[k]] = libvxl_bits_get(r, 3);
+	if(r->underflow || literals > 286 || distances > 30)
+		return false;
+
+	struct libvxl_huffman* h = &inflate->literals;
+	if(!libvxl_huffman_build(h, lengths, 19))
+		return false;
+
+	for(size_t k = 0; k < literals + distances;) {
+		int symbol = libvxl_huffman_decode(r, h);
+		if(symbol < 0)
+			return false;
+
+		if(symbol < 16) {
+			lengths[k++] = symbol;
+			continue;
+		}
+
+		size_t repeat;
+		uint8_t value = 0;
+		if(symbol == 16) {
+			if(k == 0)
+				return false;
+			value = lengths[k - 1];
+			repeat = 3 + libvxl_bits_get(r, 2);
+		} else if(symbol == 17) {
+			repeat = 3 + libvxl_bits_get(r, 3);
+		} else {
+			repeat = 11 + libvxl_bits_get(r, 7);
+		}
+
+		if(r->underflow || k + repeat > literals + distances)
+			return false;
+		while(repeat--)
+			lengths[k++] = value;
+	}
+
+	return lengths[256] > 0
+		&& libvxl_huffman_build(&inflate->literals, lengths, literals)
+		&& libvxl_huffman_build(&inflate->distances, lengths + literals,
+								distances);
+}
+
+// reads a block header and its codes, returns 1 when done, 0 if input is
+// missing and -1 if the data is invalid
+static int libvxl_inflate_block(struct libvxl_inflate* inflate,
+								struct libvxl_bit_reader* r) {
+	inflate->last = libvxl_bits_get(r, 1);
+	uint32_t type = libvxl_bits_get(r, 2);
+	if(r->underflow)
+		return 0;
+
+	if(type == 0) { // stored
+		libvxl_bits_get(r, r->count % 8);
+		uint32_t length = libvxl_bits_get(r, 16);
+		uint32_t inverse = libvxl_bits_get(r, 16);
+		if(r->underflow)
+			return 0;
+		if((length ^ 0xFFFF) != inverse)
+			return -1;
+
+		inflate->stored = length;
+		inflate->state = LIBVXL_INFLATE_STORED;
+		return 1;
+	}
+
+	if(type == 1) {
+		uint8_t lengths[288 + 30];
+		for(size_t k = 0; k < 288; k++)
+			lengths[k] = libvxl_fixed_length(k);
+		memset(lengths + 288, 5, 30);
+		libvxl_huffman_build(&inflate->literals, lengths, 288);
+		libvxl_huffman_build(&inflate->distances, lengths + 288, 30);
+	} else if(type == 2) {
+		if(!libvxl_inflate_tables(inflate, r))
+			return r->underflow ? 0 : -1;
+	} else {
+		return -1;
+	}
+
+	inflate->state = LIBVXL_INFLATE_CODES;
+	return 1;
+}
+
+// copies as much of a stored block as there is input, returns 1 at its end
+static int libvxl_inflate_stored(struct libvxl_inflate* inflate,
+								 struct libvxl_bit_reader* r) {
+	libvxl_inflate_reserve(inflate, inflate->stored);
+	while(inflate->stored > 0 && (r->count > 0 || r->offset < r->length)) {
+		inflate->data[inflate->length++] = libvxl_bits_get(r, 8);
+		inflate->stored--;
+	}
+
+	if(inflate->stored > 0)
+		return 0;
+	inflate->state = inflate->last ? LIBVXL_INFLATE_CHECKSUM :
+									 LIBVXL_INFLATE_BLOCKS;
+	return 1;
+}
+
+// decodes symbols until the end of the block, returns 1 when it is reached,
+// 0 if input is missing and -1 if the data is invalid. On missing input the
+// reader and output are left after the last complete symbol.
+static int libvxl_inflate_codes(struct libvxl_inflate* inflate,
+								struct libvxl_bit_reader* r) {
+	struct libvxl_bit_reader saved = *r;
+
+	while(1) {
+		libvxl_inflate_reserve(inflate, LIBVXL_DEFLATE_MATCH);
+
+		int symbol = libvxl_huffman_decode(r, &inflate->literals);
+		if(symbol < 0)
+			break;
+
+		if(symbol < 256) {
+			inflate->data[inflate->length++] = symbol;
+			saved = *r;
+			continue;
+		}
+
+		if(symbol == 256) {
+			inflate->state = inflate->last ? LIBVXL_INFLATE_CHECKSUM :
+											 LIBVXL_INFLATE_BLOCKS;
+			return 1;
+		}
+		if(symbol > 285)
+			return -1;
+
+		size_t length = libvxl_length_base[symbol - 257]
+			+ libvxl_bits_get(r, libvxl_length_extra[symbol - 257]);
+
+		int code = libvxl_huffman_decode(r, &inflate->distances);
+		if(code < 0 || code >= 30)
+			break;
+
+		size_t distance = libvxl_distance_base[code]
+			+ libvxl_bits_get(r, libvxl_distance_extra[code]);
+		if(r->underflow)
+			break;
+		if(distance > inflate->length)
+			return -1;
+
+		uint8_t* dst = inflate->data + inflate->length;
+		for(size_t k = 0; k < length; k++) // can overlap itself
+			dst[k] = dst[k - distance];
+		inflate->length += length;
+		saved = *r;
+	}
+
+	if(!r->underflow)
+		return -1;
+	*r = saved;
+	return 0;
+}
+
+struct libvxl_inflate* libvxl_inflate_create(void) {
+	struct libvxl_inflate* inflate
+		= libvxl_mem_malloc(sizeof(struct libvxl_inflate));
+	inflate->data = NULL;
+	inflate->length = 0;
+	inflate->capacity = 0;
+	inflate->input = NULL;
+	inflate->input_length = 0;
+	inflate->input_capacity = 0;
+	inflate->offset = 0;
+	inflate->bits = 0;
+	inflate->bit_count = 0;
+	inflate->adler = 1;
+	inflate->state = LIBVXL_INFLATE_HEADER;
+	inflate->last = false;
+	inflate->stored = 0;
+	inflate->consumed = 0;
+	return inflate;
+}
+
+void libvxl_inflate_destroy(struct libvxl_inflate* inflate) {
+	if(!inflate)
+		return;
+	libvxl_mem_free(inflate->data);
+	libvxl_mem_free(inflate->input);
+	libvxl_mem_free(inflate);
+}
+
+bool libvxl_inflate_feed(struct libvxl_inflate* inflate, const void* data,
+						 size_t len) {
+	if(!inflate || (!data && len > 0)
+	   || inflate->state == LIBVXL_INFLATE_INVALID)
+		return false;
+
+	// input is kept from the first symbol that is not decoded yet
+	if(inflate->input_length + len > inflate->input_capacity) {
+		inflate->input_capacity = (inflate->input_length + len) * 2;
+		inflate->input
+			= libvxl_mem_realloc(inflate->input, inflate->input_capacity);
+	}
+	if(len > 0)
+		memcpy(inflate->input + inflate->input_length, data, len);
+	inflate->input_length += len;
+
+	while(inflate->state < LIBVXL_INFLATE_DONE) {
+		struct libvxl_bit_reader r = {
+			.data = inflate->input,
+			.length = inflate->input_length,
+			.offset = inflate->offset,
+			.bits = inflate->bits,
+			.count = inflate->bit_count,
+			.underflow = false,
+		};
+
+		size_t start = inflate->length;
+		int result = 1;
+
+		if(inflate->state == LIBVXL_INFLATE_HEADER) {
+			uint32_t method = libvxl_bits_get(&r, 8);
+			uint32_t flags = libvxl_bits_get(&r, 8);
+			if(r.underflow)
+				break;
+			if((method & 0x0F) != 8 || (method >> 4) > 7
+			   || (method * 256 + flags) % 31 != 0 || (flags & 0x20))
+				result = -1;
+			else
+				inflate->state = LIBVXL_INFLATE_BLOCKS;
+		} else if(inflate->state == LIBVXL_INFLATE_BLOCKS) {
+			result = libvxl_inflate_block(inflate, &r);
+			if(result == 0) { // read again once more input arrived
+				inflate->length = start;
+				break;
+			}
+		} else if(inflate->state == LIBVXL_INFLATE_STORED) {
+			result = libvxl_inflate_stored(inflate, &r);
+		} else if(inflate->state == LIBVXL_INFLATE_CODES) {
+			result = libvxl_inflate_codes(inflate, &r);
+		} else {
+			libvxl_bits_get(&r, r.count % 8);
+			uint32_t adler = 0;
+			for(size_t k = 0; k < 4; k++)
+				adler = (adler << 8) | libvxl_bits_get(&r, 8);
+			if(r.underflow)
+				break;
+			if(adler != inflate->adler)
+				result = -1;
+			else
+				inflate->state = LIBVXL_INFLATE_DONE;
+		}
+
+		if(result < 0) {
+			inflate->state = LIBVXL_INFLATE_INVALID;
+			return false;
+		}
+
+		libvxl_adler32(&inflate->adler, inflate->data + start,
+					   inflate->length - start);
+		inflate->offset = r.offset;
+		inflate->bits = r.bits;
+		inflate->bit_count = r.count;
+		if(result == 0)
+			break;
+	}
+
+	// bytes that are already decoded are not needed anymore
+	if(inflate->offset > 0)
+		memmove(inflate->input, inflate->input + inflate->offset,
+				inflate->input_length - inflate->offset);
+	inflate->input_length -= inflate->offset;
+	inflate->offset = 0;
+
+	return true;
+}
+
+const void* libvxl_inflate_data(struct libvxl_inflate* inflate, size_t* len) {
+	if(!inflate)
+		return NULL;
+	if(len)
+		*len = inflate->length - inflate->consumed;
+	return inflate->data + inflate->consumed;
+}
+
+void libvxl_inflate_consume(struct libvxl_inflate* inflate, size_t len) {
+	if(!inflate)
+		return;
+	libvxl_assert(len <= inflate->length - inflate->consumed,
+				  "more bytes consumed than decompressed");
+	inflate->consumed += len;
+
+	// moving the window down only once it is far behind keeps this cheap
+	if(inflate->consumed < LIBVXL_DEFLATE_WINDOW * 4)
+		return;
+	size_t shift = inflate->consumed - LIBVXL_DEFLATE_WINDOW;
+	memmove(inflate->data, inflate->data + shift, inflate->length - shift);
+	inflate->length -= shift;
+	inflate->consumed -= shift;
+}
+
+bool libvxl_inflate_done(struct libvxl_inflate* inflate) {
+	return inflate && inflate->state == LIBVXL_INFLATE_DONE;
+}
+
+static void libvxl_stream_begin(struct libvxl_stream* stream,
+								struct libvxl_map* map, size_t chunk_size) {
+	stream->map = map;
+	map->streamed++;
+	// the snapshot keeps the map as it is now, only chunks edited while the
+	// stream is read get copied, and only by the map
+	libvxl_snapshot(map, &stream->snapshot);
+	stream->generation = map->generation;
+	stream->chunk_size = chunk_size;
+	stream->column = 0;
+	stream->buffer = NULL;
+	stream->buffer_offset = 0;
+	stream->deflate = NULL;
+}
+
+void libvxl_stream(struct libvxl_stream* stream, struct libvxl_map* map,
+				   size_t chunk_size) {
+	if(!stream || !map || chunk_size == 0)
+		return;
+	libvxl_stream_begin(stream, map, chunk_size);
+	// a column is encoded whole, so at most one of them exceeds chunk_size
+	stream->buffer = libvxl_mem_malloc(stream->chunk_size
+									   + LIBVXL_COLUMN_MAX_SIZE(map->depth));
+}
+
+void libvxl_stream_deflate(struct libvxl_stream* stream,
+						   struct libvxl_map* map, size_t chunk_size) {
+	if(!stream || !map || chunk_size == 0)
+		return;
+	libvxl_stream_begin(stream, map, chunk_size);
+	// columns are encoded right into the window of the compressor
+	stream->deflate = libvxl_deflate_create(map->depth);
+}
+
+void libvxl_stream_free(struct libvxl_stream* stream) {
+	if(!stream)
+		return;
+	stream->map->streamed--;
+	libvxl_free(&stream->snapshot);
+	libvxl_mem_free(stream->buffer);
+	libvxl_deflate_free(stream->deflate);
+}
+
+// drops the snapshot's references to a row of chunks which was fully encoded,
+// the map can then modify them without copying
+static void libvxl_stream_release(struct libvxl_stream* stream,
+								  size_t chunk_y) {
+	struct libvxl_map* snapshot = &stream->snapshot;
+	size_t sx = (snapshot->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+	for(size_t k = chunk_y * sx; k < (chunk_y + 1) * sx; k++) {
+		libvxl_chunk_release(snapshot->chunks + k);
+		snapshot->chunks[k].columns = NULL;
+		snapshot->chunks[k].blocks = NULL;
+		snapshot->chunks[k].geometry = NULL;
+		snapshot->chunks[k].regular = false;
+	}
+}
+
+// encodes the next column of the snapshot to out at offset
+static void libvxl_stream_column(struct libvxl_stream* stream, void* out,
+								 size_t* offset) {
+	struct libvxl_map* snapshot = &stream->snapshot;
+	size_t x = stream->column % snapshot->width;
+	size_t y = stream->column / snapshot->width;
+
+	libvxl_column_encode(snapshot, x, y, out, offset);
+	stream->column++;
+
+	if(x + 1 == snapshot->width
+	   && ((y + 1) % LIBVXL_CHUNK_SIZE == 0 || y + 1 == snapshot->height))
+		libvxl_stream_release(stream, y / LIBVXL_CHUNK_SIZE);
+}
+
+static size_t libvxl_stream_read_deflate(struct libvxl_stream* stream,
+										 void* out) {
+	struct libvxl_deflate* d = stream->deflate;
+	size_t max = LIBVXL_COLUMN_MAX_SIZE(stream->snapshot.depth);
+
+	LIBVXL_ENCODE_START();
+	while(d->out_length < stream->chunk_size && !d->finished) {
+		if(stream->column >= stream->snapshot.width * stream->snapshot.height) {
+			libvxl_deflate_compress(d, true);
+			break;
+		}
+
+		if(d->length + max > d->capacity)
+			libvxl_deflate_slide(d);
+
+		size_t start = d->length;
+		libvxl_stream_column(stream, d->data, &d->length);
+		libvxl_adler32(&d->adler, d->data + start, d->length - start);
+		libvxl_deflate_compress(d, false);
+	}
+
+	size_t length = min(d->out_length, stream->chunk_size);
+	memcpy(out, d->out, length);
+	memmove(d->out, d->out + length, d->out_length - length);
+	d->out_length -= length;
+	LIBVXL_ENCODE_END(length);
+	return length;
+}
+
+size_t libvxl_stream_read(struct libvxl_stream* stream, void* out) {
+	if(!stream || !out)
+		return 0;
+	if(stream->deflate)
+		return libvxl_stream_read_deflate(stream, out);
+	size_t columns = stream->snapshot.width * stream->snapshot.height;
+	if(stream->column >= columns && stream->buffer_offset == 0)
+		return 0;
+	LIBVXL_ENCODE_START();
+	while(stream->buffer_offset < stream->chunk_size
+		  && stream->column < columns)
+		libvxl_stream_column(stream, stream->buffer, &stream->buffer_offset);
+	size_t length = stream->buffer_offset;
+	memcpy(out, stream->buffer, min(length, stream->chunk_size));
+	if(length < stream->chunk_size) {
+		stream->buffer_offset = 0;
+	} else {
+		memmove(stream->buffer, (uint8_t*)stream->buffer + stream->chunk_size,
+				length - stream->chunk_size);
+		stream->buffer_offset -= stream->chunk_size;
+	}
+	LIBVXL_ENCODE_END(min(length, stream->chunk_size));
+	return min(length, stream->chunk_size);
+}
+
+struct libvxl_band {
+	uint8_t* data;
+	size_t length, capacity;
+};
+
+struct libvxl_encode {
+	struct libvxl_map* map;
+	struct libvxl_band* bands;
+};
+
+// encodes one band of chunk rows into its own buffer, bands only access their
+// own chunks
+static void libvxl_encode_band(void* ctx, size_t band) {
+	struct libvxl_encode* encode = ctx;
+	struct libvxl_map* map = encode->map;
+	struct libvxl_band* b = encode->bands + band;
+
+	size_t y_end = min((band + 1) * LIBVXL_CHUNK_SIZE, map->height);
+	for(size_t y = band * LIBVXL_CHUNK_SIZE; y < y_end; y++) {
+		for(size_t x = 0; x < map->width; x++) {
+			if(b->capacity - b->length < LIBVXL_COLUMN_MAX_SIZE(map->depth)) {
+				b->capacity = b->capacity * 2
+					+ LIBVXL_COLUMN_MAX_SIZE(map->depth);
+				b->data = libvxl_mem_realloc(b->data, b->capacity);
+			}
+
+			libvxl_column_encode(map, x, y, b->data, &b->length);
+		}
+	}
+}
+
+// encodes all bands at once, the caller joins them in order and frees them
+static struct libvxl_band* libvxl_encode_bands(struct libvxl_map* map,
+											   size_t threads) {
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+	struct libvxl_encode encode = {
+		.map = map,
+		.bands = libvxl_mem_malloc(sy * sizeof(struct libvxl_band)),
+	};
+
+	memset(encode.bands, 0, sy * sizeof(struct libvxl_band));
+
+	libvxl_parallel(threads, sy, libvxl_encode_band, &encode);
+
+	return encode.bands;
+}
+
+static void libvxl_bands_free(struct libvxl_map* map,
+							  struct libvxl_band* bands) {
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	for(size_t k = 0; k < sy; k++)
+		libvxl_mem_free(bands[k].data);
+	libvxl_mem_free(bands);
+}
+
+void libvxl_write(struct libvxl_map* map, void* out, size_t* size) {
+	libvxl_write_mt(map, out, size, 1);
+}
+
+void libvxl_write_mt(struct libvxl_map* map, void* out, size_t* size,
+					 size_t threads) {
+	if(!map || !out)
+		return;
+
+	size_t offset = 0;
+	LIBVXL_ENCODE_START();
+
+	if(threads == 1) { // no need for intermediate buffers
+		for(uint32_t y = 0; y < map->height; y++)
+			for(uint32_t x = 0; x < map->width; x++)
+				libvxl_column_encode(map, x, y, out, &offset);
+	} else {
+		size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+		struct libvxl_band* bands = libvxl_encode_bands(map, threads);
+
+		for(size_t k = 0; k < sy; k++) {
+			memcpy((uint8_t*)out + offset, bands[k].data, bands[k].length);
+			offset += bands[k].length;
+		}
+
+		libvxl_bands_free(map, bands);
+	}
+
+	LIBVXL_ENCODE_END(offset);
+
+	if(size)
+		*size = offset;
+}
+
+#define LIBVXL_WRITE_BUFFER (1 << 20)
+#define LIBVXL_WRITE_ALIGN 4096
+
+static bool libvxl_fd_write(int fd, const uint8_t* data, size_t len) {
+	while(len > 0) {
+#ifdef _WIN32
+		int written = _write(fd, data, (unsigned int)min(len, (size_t)1 << 30));
+#else
+		ssize_t written = write(fd, data, len);
+		if(written < 0 && errno == EINTR)
+			continue;
+#endif
+		if(written <= 0)
+			return false;
+		data += written;
+		len -= written;
+	}
+
+	return true;
+}
+
+int libvxl_writefile_fd(struct libvxl_map* map, int fd, size_t* size) {
+	if(!map || fd < 0)
+		return LIBVXL_ERROR_INVALID;
+
+	// columns are encoded straight into this buffer, which is only flushed
+	// once it could not hold another column
+	void* raw = libvxl_mem_malloc(LIBVXL_WRITE_BUFFER + LIBVXL_WRITE_ALIGN);
+	if(!raw)
+		return LIBVXL_ERROR_MEMORY;
+	uint8_t* buffer
+		= (uint8_t*)(((uintptr_t)raw + LIBVXL_WRITE_ALIGN - 1)
+					 & ~(uintptr_t)(LIBVXL_WRITE_ALIGN - 1));
+
+	int result = LIBVXL_OK;
+	size_t offset = 0, total = 0;
+	LIBVXL_ENCODE_START();
+	for(uint32_t y = 0; y < map->height && result == LIBVXL_OK; y++) {
+		for(uint32_t x = 0; x < map->width; x++) {
+			if(LIBVXL_WRITE_BUFFER - offset
+			   < LIBVXL_COLUMN_MAX_SIZE(map->depth)) {
+				if(!libvxl_fd_write(fd, buffer, offset)) {
+					result = LIBVXL_ERROR_WRITE;
+					break;
+				}
+
+				total += offset;
+				offset = 0;
+			}
+
+			libvxl_column_encode(map, x, y, buffer, &offset);
+		}
+	}
+
+	if(result == LIBVXL_OK) {
+		if(libvxl_fd_write(fd, buffer, offset))
+			total += offset;
+		else
+			result = LIBVXL_ERROR_WRITE;
+	}
+
+	libvxl_mem_free(raw);
+	LIBVXL_ENCODE_END(total);
+
+	if(size)
+		*size = total;
+
+	return result;
+}
+
+static int libvxl_file_create(const char* name) {
+#ifdef _WIN32
+	return _open(name, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+				 _S_IREAD | _S_IWRITE);
+#else
+	return open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+}
+
+static bool libvxl_file_close(int fd) {
+#ifdef _WIN32
+	return _close(fd) >= 0;
+#else
+	return close(fd) >= 0;
+#endif
+}
+
+size_t libvxl_writefile(struct libvxl_map* map, char* name) {
+	if(!map || !name)
+		return 0;
+	int fd = libvxl_file_create(name);
+	if(fd < 0)
+		return 0;
+
+	size_t total;
+	int result = libvxl_writefile_fd(map, fd, &total);
+
+	if(!libvxl_file_close(fd))
+		result = LIBVXL_ERROR_WRITE;
+
+	return result == LIBVXL_OK ? total : 0;
+}
+
+size_t libvxl_writefile_mt(struct libvxl_map* map, char* name,
+						   size_t threads) {
+	if(!map || !name)
+		return 0;
+	if(threads == 1)
+		return libvxl_writefile(map, name);
+
+	int fd = libvxl_file_create(name);
+	if(fd < 0)
+		return 0;
+
+	LIBVXL_ENCODE_START();
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	struct libvxl_band* bands = libvxl_encode_bands(map, threads);
+
+	bool success = true;
+	size_t total = 0;
+	for(size_t k = 0; k < sy && success; k++) {
+		success = libvxl_fd_write(fd, bands[k].data, bands[k].length);
+		if(success)
+			total += bands[k].length;
+	}
+
+	if(!libvxl_file_close(fd))
+		success = false;
+
+	libvxl_bands_free(map, bands);
+	LIBVXL_ENCODE_END(total);
+	return success ? total : 0;
+}
+
+size_t libvxl_delta_size(struct libvxl_map* map, uint64_t since) {
+	if(!map || !map->column_generation)
+		return 0;
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+	size_t columns = 0;
+	for(size_t chunk_y = 0; chunk_y < sy; chunk_y++) {
+		for(size_t chunk_x = 0; chunk_x < sx; chunk_x++) {
+			if(map->chunk_generation[chunk_x + chunk_y * sx] <= since)
+				continue;
+
+			size_t x_end = min((chunk_x + 1) * LIBVXL_CHUNK_SIZE, map->width);
+			size_t y_end
+				= min((chunk_y + 1) * LIBVXL_CHUNK_SIZE, map->height);
+			for(size_t y = chunk_y * LIBVXL_CHUNK_SIZE; y < y_end; y++)
+				for(size_t x = chunk_x * LIBVXL_CHUNK_SIZE; x < x_end; x++)
+					if(libvxl_column_generation(map, chunk_x + chunk_y * sx,
+												x, y)
+					   > since)
+						columns++;
+		}
+	}
+
+	return columns
+		* (sizeof(struct libvxl_delta_column)
+		   + LIBVXL_COLUMN_MAX_SIZE(map->depth));
+}
+
+void libvxl_write_delta(struct libvxl_map* map, uint64_t since, void* out,
+						size_t* size) {
+	if(!map || !out || !map->column_generation)
+		return;
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+	size_t offset = 0;
+	LIBVXL_ENCODE_START();
+	for(size_t chunk_y = 0; chunk_y < sy; chunk_y++) {
+		for(size_t chunk_x = 0; chunk_x < sx; chunk_x++) {
+			if(map->chunk_generation[chunk_x + chunk_y * sx] <= since)
+				continue;
+
+			size_t x_end = min((chunk_x + 1) * LIBVXL_CHUNK_SIZE, map->width);
+			size_t y_end
+				= min((chunk_y + 1) * LIBVXL_CHUNK_SIZE, map->height);
+			for(size_t y = chunk_y * LIBVXL_CHUNK_SIZE; y < y_end; y++) {
+				for(size_t x = chunk_x * LIBVXL_CHUNK_SIZE; x < x_end; x++) {
+					if(libvxl_column_generation(map, chunk_x + chunk_y * sx,
+												x, y)
+					   <= since)
+						continue;
+
+					struct libvxl_delta_column* header
+						= (struct libvxl_delta_column*)((uint8_t*)out
+														+ offset);
+					offset += sizeof(struct libvxl_delta_column);
+
+					size_t start = offset;
+					libvxl_column_encode(map, x, y, out, &offset);
+
+					header->x = x;
+					header->y = y;
+					header->length = offset - start;
+				}
+			}
+		}
+	}
+
+	LIBVXL_ENCODE_END(offset);
+
+	if(size)
+		*size = offset;
+}
+
+// checks that the spans of a column stay inside the data and the map depth
+static bool libvxl_column_check(struct libvxl_map* map, const void* data,
+								size_t offset, size_t len) {
+	size_t z = 0;
+
+	while(1) {
+		if(offset + sizeof(struct libvxl_span) > len)
+			return false;
+		struct libvxl_span* desc = LIBVXL_SPAN(data, offset);
+		if(offset + libvxl_span_length(desc) > len)
+			return false;
+
+		if(desc->air_start < z || desc->air_start > desc->color_start
+		   || desc->color_start > desc->color_end + 1
+		   || (size_t)desc->color_end + 1 > map->depth)
+			return false;
+
+		size_t top_len = desc->color_end - desc->color_start + 1;
+
+		if(desc->length == 0)
+			return offset + libvxl_span_length(desc) == len;
+
+		if(desc->length < 1 + top_len)
+			return false;
+
+		size_t bottom_len = desc->length - 1 - top_len;
+		offset += libvxl_span_length(desc);
+
+		if(offset + sizeof(struct libvxl_span) > len)
+			return false;
+		struct libvxl_span* desc_next = LIBVXL_SPAN(data, offset);
+		if(desc_next->air_start < desc->color_end + 1 + bottom_len
+		   || desc_next->air_start >= map->depth)
+			return false;
+
+		z = desc_next->air_start;
+	}
+}
+
+// replaces a column of a chunk with the one encoded at offset
+static void libvxl_column_replace(struct libvxl_map* map, size_t x, size_t y,
+								  const void* data, size_t offset,
+								  size_t len) {
+	struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+
+	// decode into a scratch chunk first, its column is then copied over
+	struct libvxl_chunk column;
+	libvxl_chunk_alloc(&column, map->depth, map->allocator);
+
+	for(size_t z = 0; z < map->depth; z++)
+		libvxl_geometry_set(map, x, y, z, 1);
+	libvxl_column_decode(map, &column, x, y, data, offset, len, true);
+
+	size_t index = libvxl_chunk_column(pos_key(x, y, 0));
+	struct libvxl_column* src = column.columns + index;
+
+	libvxl_chunk_own(map, chunk);
+	libvxl_column_reserve(map, chunk, index, src->count);
+
+	struct libvxl_column* dst = chunk->columns + index;
+	memcpy(chunk->blocks + dst->start, column.blocks + src->start,
+		   src->count * sizeof(struct libvxl_block));
+	dst->count = src->count;
+
+	libvxl_shared_release(column.columns);
+	libvxl_map_touch(map, x, y);
+}
+
+bool libvxl_apply_delta(struct libvxl_map* map, const void* data, size_t len) {
+	if(!map || !data)
+		return false;
+
+	// validate everything first, the map is left untouched on errors
+	size_t offset = 0;
+	while(offset < len) {
+		if(offset + sizeof(struct libvxl_delta_column) > len)
+			return false;
+
+		struct libvxl_delta_column* header
+			= (struct libvxl_delta_column*)((uint8_t*)data + offset);
+		offset += sizeof(struct libvxl_delta_column);
+
+		if(header->x >= map->width || header->y >= map->height
+		   || header->length > len - offset
+		   || !libvxl_column_check(map, data, offset,
+								   offset + header->length))
+			return false;
+
+		offset += header->length;
+	}
+
+	libvxl_sync_begin(map);
+	map->generation++;
+
+	offset = 0;
+	while(offset < len) {
+		struct libvxl_delta_column* header
+			= (struct libvxl_delta_column*)((uint8_t*)data + offset);
+		offset += sizeof(struct libvxl_delta_column);
+
+		libvxl_column_replace(map, header->x, header->y, data, offset,
+							  offset + header->length);
+		offset += header->length;
+	}
+
+	libvxl_sync_end(map);
+	return true;
+}
+
+// the region of a map to use, NULL selects the whole map
+static bool libvxl_region_get(struct libvxl_map* map,
+							  const struct libvxl_region* region,
+							  struct libvxl_region* out) {
+	if(!region) {
+		*out = (struct libvxl_region) {
+			.width = map->width,
+			.height = map->height,
+			.depth = map->depth,
+		};
+		return true;
+	}
+
+	*out = *region;
+	return region->width > 0 && region->height > 0 && region->depth > 0
+		&& region->x <= map->width && region->width <= map->width - region->x
+		&& region->y <= map->height
+		&& region->height <= map->height - region->y
+		&& region->z <= map->depth && region->depth <= map->depth - region->z;
+}
+
+// solid bits of the columns of one x of a region, with an empty column on
+// either end along y, everything outside the region is air
+static void libvxl_region_slab(struct libvxl_map* map,
+							   const struct libvxl_region* r, size_t x,
+							   const uint64_t* range, uint64_t* slab) {
+	memset(slab, 0, (r->height + 2) * LIBVXL_COLUMN_WORDS * sizeof(uint64_t));
+
+	if(x >= r->width)
+		return;
+
+	for(size_t y = 0; y < r->height; y++) {
+		uint64_t* m = slab + (y + 1) * LIBVXL_COLUMN_WORDS;
+		libvxl_geometry_bits(map, r->x + x, r->y + y, m);
+		for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++)
+			m[k] &= range[k];
+	}
+}
+
+// calls visit() with region coordinates for every block of a region with a
+// face towards air, sorted by x, then y and then z, faces has a bit per face
+// in the order of libvxl_face, everything outside the region counts as air,
+// blocks are only counted if visit is NULL
+static size_t libvxl_region_scan(struct libvxl_map* map,
+								 const struct libvxl_region* r,
+								 void (*visit)(void* ctx, size_t x, size_t y,
+											   size_t z, uint32_t color,
+											   unsigned faces),
+								 void* ctx) {
+	uint64_t range[LIBVXL_COLUMN_WORDS];
+	libvxl_bits_range(r->z, r->z + r->depth, range);
+
+	// the slabs at x - 1, x and x + 1
+	size_t stride = (r->height + 2) * LIBVXL_COLUMN_WORDS;
+	uint64_t* slabs = libvxl_mem_malloc(3 * stride * sizeof(uint64_t));
+	uint64_t* west = slabs;
+	uint64_t* center = slabs + stride;
+	uint64_t* east = slabs + stride * 2;
+	libvxl_region_slab(map, r, SIZE_MAX, range, west);
+	libvxl_region_slab(map, r, 0, range, center);
+
+	size_t total = 0;
+	for(size_t x = 0; x < r->width; x++) {
+		libvxl_region_slab(map, r, x + 1, range, east);
+
+		for(size_t y = 0; y < r->height; y++) {
+			size_t c = (y + 1) * LIBVXL_COLUMN_WORDS;
+			const uint64_t* m = center + c;
+			uint64_t up[LIBVXL_COLUMN_WORDS], down[LIBVXL_COLUMN_WORDS];
+			libvxl_bits_exposed(m, map->depth, false, up, down);
+
+			size_t mx = r->x + x, my = r->y + y;
+			struct libvxl_block* blocks = NULL;
+			size_t count = 0, next = 0;
+			if(visit) {
+				struct libvxl_chunk* chunk = chunk_fposition(map, mx, my);
+				struct libvxl_column* column = chunk->columns
+					+ libvxl_chunk_column(pos_key(mx, my, 0));
+				blocks = chunk->blocks + column->start;
+				count = column->count;
+			}
+
+			for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++) {
+				// one bit per face, set where the neighbour is air
+				uint64_t faces[6] = {
+					m[k] & ~west[c + k],
+					m[k] & ~east[c + k],
+					m[k] & ~center[c - LIBVXL_COLUMN_WORDS + k],
+					m[k] & ~center[c + LIBVXL_COLUMN_WORDS + k],
+					up[k],
+					down[k],
+				};
+				uint64_t visible = faces[0] | faces[1] | faces[2] | faces[3]
+					| faces[4] | faces[5];
+				total += libvxl_bit_count(visible);
+
+				while(visit && visible) {
+					size_t bit = libvxl_bit_count((visible & -visible) - 1);
+					size_t z = k * 64 + bit;
+					visible &= visible - 1;
+
+					// blocks are sorted by z, so they are walked only once
+					while(next < count && key_getz(blocks[next].position) < z)
+						next++;
+					uint32_t color = next < count
+							&& key_getz(blocks[next].position) == z ?
+						blocks[next].color :
+						DEFAULT_COLOR(mx, my, z);
+
+					unsigned f = 0;
+					for(size_t n = 0; n < 6; n++)
+						f |= (unsigned)((faces[n] >> bit) & 1) << n;
+
+					visit(ctx, x, y, z - r->z, color, f);
+				}
+			}
+		}
+
+		uint64_t* tmp = west;
+		west = center;
+		center = east;
+		east = tmp;
+	}
+
+	libvxl_mem_free(slabs);
+	return total;
+}
+
+#define LIBVXL_KV6_VOXELS sizeof(struct libvxl_kv6)
+
+struct libvxl_kv6_encode {
+	uint8_t* voxels;
+	size_t index;
+	uint32_t* xlen;
+	uint16_t* ylen;
+	size_t height;
+};
+
+static void libvxl_kv6_visit(void* ctx, size_t x, size_t y, size_t z,
+							 uint32_t color, unsigned faces) {
+	struct libvxl_kv6_encode* e = ctx;
+
+	struct libvxl_kv6_block voxel = {
+		.color = (int)((color & 0xFFFFFF) | 0x80000000),
+		.z = (short)z,
+		.visfaces = (unsigned char)faces,
+		.normal = 255, // no direction given
+	};
+	memcpy(e->voxels + e->index++ * sizeof(voxel), &voxel, sizeof(voxel));
+
+	e->xlen[x]++;
+	e->ylen[x * e->height + y]++;
+}
+
+size_t libvxl_kv6_size(struct libvxl_map* map,
+					   const struct libvxl_region* region) {
+	struct libvxl_region r;
+	if(!map || !libvxl_region_get(map, region, &r))
+		return 0;
+
+	return sizeof(struct libvxl_kv6)
+		+ libvxl_region_scan(map, &r, NULL, NULL)
+		* sizeof(struct libvxl_kv6_block)
+		+ r.width * sizeof(uint32_t) + r.width * r.height * sizeof(uint16_t);
+}
+
+void libvxl_kv6_write(struct libvxl_map* map,
+					  const struct libvxl_region* region, void* out,
+					  size_t* size) {
+	struct libvxl_region r;
+	if(size)
+		*size = 0;
+	if(!map || !out || !libvxl_region_get(map, region, &r))
+		return;
+
+	struct libvxl_kv6_encode e = {
+		.voxels = (uint8_t*)out + LIBVXL_KV6_VOXELS,
+		.xlen = libvxl_mem_malloc(r.width * sizeof(uint32_t)),
+		.ylen = libvxl_mem_malloc(r.width * r.height * sizeof(uint16_t)),
+		.height = r.height,
+	};
+	memset(e.xlen, 0, r.width * sizeof(uint32_t));
+	memset(e.ylen, 0, r.width * r.height * sizeof(uint16_t));
+
+	libvxl_region_scan(map, &r, libvxl_kv6_visit, &e);
+
+	struct libvxl_kv6 header = {
+		.magic = {'K', 'v', 'x', 'l'},
+		.width = (int)r.width,
+		.height = (int)r.height,
+		.depth = (int)r.depth,
+		.pivot = {r.width / 2.0F, r.height / 2.0F, r.depth / 2.0F},
+		.len = (int)e.index,
+	};
+	memcpy(out, &header, sizeof(header));
+
+	size_t offset
+		= sizeof(header) + e.index * sizeof(struct libvxl_kv6_block);
+	memcpy((uint8_t*)out + offset, e.xlen, r.width * sizeof(uint32_t));
+	offset += r.width * sizeof(uint32_t);
+	memcpy((uint8_t*)out + offset, e.ylen,
+		   r.width * r.height * sizeof(uint16_t));
+	offset += r.width * r.height * sizeof(uint16_t);
+
+	libvxl_mem_free(e.xlen);
+	libvxl_mem_free(e.ylen);
+
+	if(size)
+		*size = offset;
+}
+
+int libvxl_kv6_writefile(struct libvxl_map* map,
+						 const struct libvxl_region* region,
+						 const char* name) {
+	if(!map || !name)
+		return LIBVXL_ERROR_INVALID;
+
+	size_t size = libvxl_kv6_size(map, region);
+	if(!size)
+		return LIBVXL_ERROR_INVALID;
+
+	// the model is built in memory and written with a single call
+	void* out = libvxl_mem_malloc(size);
+	if(!out)
+		return LIBVXL_ERROR_MEMORY;
+	libvxl_kv6_write(map, region, out, &size);
+
+#ifdef _WIN32
+	int fd = _open(name, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY,
+				   _S_IREAD | _S_IWRITE);
+#else
+	int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+	if(fd < 0) {
+		libvxl_mem_free(out);
+		return LIBVXL_ERROR_OPEN;
+	}
+
+	int result = libvxl_fd_write(fd, out, size) ? LIBVXL_OK :
+												  LIBVXL_ERROR_WRITE;
+#ifdef _WIN32
+	if(_close(fd) < 0)
+#else
+	if(close(fd) < 0)
+#endif
+		result = LIBVXL_ERROR_WRITE;
+
+	libvxl_mem_free(out);
+	return result;
+}
+
+static struct libvxl_kv6_block libvxl_kv6_voxel(const uint8_t* data,
+												size_t index) {
+	struct libvxl_kv6_block voxel;
+	memcpy(&voxel,
+		   data + LIBVXL_KV6_VOXELS + index * sizeof(struct libvxl_kv6_block),
+		   sizeof(voxel));
+	return voxel;
+}
+
+// number of voxels of column [x,y] of a model, ylen can start at any address
+static size_t libvxl_kv6_ylen(const uint8_t* ylen, size_t height, size_t x,
+							  size_t y) {
+	uint16_t count;
+	memcpy(&count, ylen + (x * height + y) * sizeof(uint16_t), sizeof(count));
+	return count;
+}
+
+// checks that the voxel counts add up and every column is sorted by z
+static bool libvxl_kv6_check(const uint8_t* data, size_t len,
+							 struct libvxl_kv6* header) {
+	if(len < sizeof(struct libvxl_kv6))
+		return false;
+
+	memcpy(header, data, sizeof(struct libvxl_kv6));
+	if(memcmp(header->magic, "Kvxl", 4) != 0 || header->width <= 0
+	   || header->height <= 0 || header->depth <= 0 || header->len < 0
+	   || !libvxl_size_valid(header->width, header->height, header->depth))
+		return false;
+
+	size_t w = header->width, h = header->height;
+	size_t voxels = header->len;
+	size_t tables = w * sizeof(uint32_t) + w * h * sizeof(uint16_t);
+	// later data, like a palette, is ignored
+	if(len - sizeof(struct libvxl_kv6) < tables
+	   || (len - sizeof(struct libvxl_kv6) - tables)
+			   / sizeof(struct libvxl_kv6_block)
+		   < voxels)
+		return false;
+
+	const uint8_t* xlen = data + LIBVXL_KV6_VOXELS
+		+ voxels * sizeof(struct libvxl_kv6_block);
+	const uint8_t* ylen = xlen + w * sizeof(uint32_t);
+
+	size_t index = 0;
+	for(size_t x = 0; x < w; x++) {
+		uint32_t count;
+		memcpy(&count, xlen + x * sizeof(uint32_t), sizeof(count));
+
+		size_t start = index;
+		for(size_t y = 0; y < h; y++) {
+			size_t end = index + libvxl_kv6_ylen(ylen, h, x, y);
+			if(end > voxels)
+				return false;
+
+			for(int z = -1; index < end; index++) {
+				struct libvxl_kv6_block voxel = libvxl_kv6_voxel(data, index);
+				if(voxel.z <= z || voxel.z >= header->depth)
+					return false;
+				z = voxel.z;
+			}
+		}
+
+		if(index - start != count)
+			return false;
+	}
+
+	return index == voxels;
+}
+
+bool libvxl_kv6_create(struct libvxl_map* map, const void* data, size_t len,
+					   const struct libvxl_create_options* options) {
+	struct libvxl_kv6 header;
+	if(!map || !data || !libvxl_kv6_check(data, len, &header))
+		return false;
+
+	size_t w = header.width, h = header.height, d = header.depth;
+	libvxl_map_init(map, w, h, d, options, false, false);
+
+	const uint8_t* ylen = (const uint8_t*)data + LIBVXL_KV6_VOXELS
+		+ header.len * sizeof(struct libvxl_kv6_block)
+		+ w * sizeof(uint32_t);
+
+	// a voxel is solid down to the next one, unless its bottom face is
+	// visible, which gives the geometry of every column, the bottom layer of
+	// a map is always solid
+	size_t index = 0;
+	for(size_t x = 0; x < w; x++) {
+		for(size_t y = 0; y < h; y++) {
+			libvxl_geometry_fill(map, x, y, d - 1, d, true);
+			size_t end = index + libvxl_kv6_ylen(ylen, h, x, y);
+			for(; index < end; index++) {
+				struct libvxl_kv6_block voxel = libvxl_kv6_voxel(data, index);
+				size_t z_end = index + 1 < end ?
+					(size_t)libvxl_kv6_voxel(data, index + 1).z :
+					d;
+				if(voxel.visfaces & 0x20)
+					z_end = voxel.z + 1;
+				libvxl_geometry_fill(map, x, y, voxel.z, z_end, true);
+			}
+		}
+	}
+
+	// the map keeps a color for each block on its surface, which is only
+	// known now, voxels that are not on it are dropped
+	index = 0;
+	for(size_t x = 0; x < w; x++) {
+		for(size_t y = 0; y < h; y++) {
+			uint64_t surface[LIBVXL_COLUMN_WORDS];
+			libvxl_column_surface(map, x, y, surface);
+
+			struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+			size_t end = index + libvxl_kv6_ylen(ylen, h, x, y);
+			for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++) {
+				while(surface[k]) {
+					size_t z = k * 64
+						+ libvxl_bit_count((surface[k] & -surface[k]) - 1);
+					surface[k] &= surface[k] - 1;
+
+					struct libvxl_kv6_block voxel;
+					while(index < end
+						  && (voxel = libvxl_kv6_voxel(data, index)).z
+							  < (short)z)
+						index++;
+
+					uint32_t color = index < end && voxel.z == (short)z ?
+						(uint32_t)voxel.color & 0xFFFFFF :
+						DEFAULT_COLOR(x, y, z);
+					libvxl_chunk_put(map, chunk, pos_key(x, y, z), color);
+				}
+			}
+
+			index = end;
+		}
+	}
+
+	libvxl_load_finish(map, options ? options->threads : 1);
+
+	if(options && options->concurrent)
+		libvxl_map_concurrent(map);
+
+	return true;
+}
+
+int libvxl_kv6_readfile(struct libvxl_map* map, const char* name,
+						const struct libvxl_create_options* options) {
+	if(!map || !name)
+		return LIBVXL_ERROR_INVALID;
+
+	int error = LIBVXL_OK;
+	size_t len;
+	void* data = libvxl_file_map(name, &len, &error);
+	if(!data)
+		return error;
+
+	bool success = libvxl_kv6_create(map, data, len, options);
+	libvxl_file_unmap(data, len);
+
+	return success ? LIBVXL_OK : LIBVXL_ERROR_FORMAT;
+}
+
+bool libvxl_map_isinside(struct libvxl_map* map, int x, int y, int z) {
+	return map && x >= 0 && y >= 0 && z >= 0 && x < (int)map->width
+		&& y < (int)map->height && z < (int)map->depth;
+}
+
+static uint32_t libvxl_block_color(struct libvxl_map* map, size_t x, size_t y,
+								   size_t z) {
+	if(!libvxl_geometry_get(map, x, y, z))
+		return 0;
+	struct libvxl_block* loc
+		= libvxl_chunk_find(chunk_fposition(map, x, y), pos_key(x, y, z));
+	return loc ? loc->color : DEFAULT_COLOR(x, y, z);
+}
+
+uint32_t libvxl_map_get(struct libvxl_map* map, int x, int y, int z) {
+	if(!map || x < 0 || y < 0 || z < 0 || x >= (int)map->width
+	   || y >= (int)map->height || z >= (int)map->depth)
+		return 0;
+
+	struct libvxl_reading r;
+	if(!libvxl_read_enter(map, &r))
+		return libvxl_block_color(map, x, y, z);
+
+	uint32_t color;
+	libvxl_read_chunk(map, &r, x, y);
+	do {
+		libvxl_read_start(&r);
+		color = libvxl_block_color(map, x, y, z);
+	} while(libvxl_read_retry(&r));
+	libvxl_read_leave(&r);
+
+	return color;
+}
+
+struct libvxl_query {
+	libvxl_key position;
+	size_t index;
+};
+
+void libvxl_map_get_many(struct libvxl_map* map, const int* positions,
+						 size_t count, uint32_t* colors) {
+	if(!map || !positions || !colors)
+		return;
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+	// too few queries per chunk for grouping to pay off, concurrent maps are
+	// read one chunk at a time anyway
+	if(count < sx * sy || map->sync) {
+		for(size_t k = 0; k < count; k++)
+			colors[k] = libvxl_map_get(map, positions[k * 3 + 0],
+									   positions[k * 3 + 1],
+									   positions[k * 3 + 2]);
+		return;
+	}
+
+	// group queries by chunk with a counting sort, so each chunk's blocks and
+	// geometry are only brought into the cache once
+	size_t* offsets = libvxl_mem_malloc((sx * sy + 1) * sizeof(size_t));
+	struct libvxl_query* queries
+		= libvxl_mem_malloc(count * sizeof(struct libvxl_query));
+	memset(offsets, 0, (sx * sy + 1) * sizeof(size_t));
+
+	for(size_t k = 0; k < count; k++) {
+		int x = positions[k * 3 + 0];
+		int y = positions[k * 3 + 1];
+		int z = positions[k * 3 + 2];
+
+		colors[k] = 0;
+
+		if(x >= 0 && y >= 0 && z >= 0 && x < (int)map->width
+		   && y < (int)map->height && z < (int)map->depth)
+			offsets[x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx + 1]++;
+	}
+
+	for(size_t k = 0; k < sx * sy; k++)
+		offsets[k + 1] += offsets[k];
+
+	for(size_t k = 0; k < count; k++) {
+		int x = positions[k * 3 + 0];
+		int y = positions[k * 3 + 1];
+		int z = positions[k * 3 + 2];
+
+		if(x >= 0 && y >= 0 && z >= 0 && x < (int)map->width
+		   && y < (int)map->height && z < (int)map->depth) {
+			size_t chunk = x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx;
+			queries[offsets[chunk]++] = (struct libvxl_query) {
+				.position = pos_key(x, y, z),
+				.index = k,
+			};
+		}
+	}
+
+	// every chunk's queries now end at its offset, so the last one holds the
+	// number of queries inside of the map
+	for(size_t k = 0; k < offsets[sx * sy - 1]; k++) {
+		libvxl_key pos = queries[k].position;
+		colors[queries[k].index] = libvxl_block_color(
+			map, key_getx(pos), key_gety(pos), key_getz(pos));
+	}
+
+	libvxl_mem_free(offsets);
+	libvxl_mem_free(queries);
+}
+
+// same as libvxl_map_issolid(), for a map that can be read directly
+static bool libvxl_solid(struct libvxl_map* map, int x, int y, int z) {
+	if(z < 0)
+		return false;
+	if(z >= (int)map->depth)
+		return true;
+	return libvxl_geometry_get(map, libvxl_wrap(x, map->width),
+							   libvxl_wrap(y, map->height), z);
+}
+
+bool libvxl_map_issolid(struct libvxl_map* map, int x, int y, int z) {
+	if(z < 0)
+		return false;
+	if(!map || z >= (int)map->depth)
+		return true;
+
+	struct libvxl_reading r;
+	if(!libvxl_read_enter(map, &r))
+		return libvxl_solid(map, x, y, z);
+
+	bool solid;
+	libvxl_read_chunk(map, &r, libvxl_wrap(x, map->width),
+					  libvxl_wrap(y, map->height));
+	do {
+		libvxl_read_start(&r);
+		solid = libvxl_solid(map, x, y, z);
+	} while(libvxl_read_retry(&r));
+	libvxl_read_leave(&r);
+
+	return solid;
+}
+
+void libvxl_map_issolid_many(struct libvxl_map* map, const int* positions,
+							 size_t count, bool* solid) {
+	if(!map || !positions || !solid)
+		return;
+
+	if(map->sync) {
+		for(size_t k = 0; k < count; k++)
+			solid[k] = libvxl_map_issolid(map, positions[k * 3 + 0],
+										  positions[k * 3 + 1],
+										  positions[k * 3 + 2]);
+		return;
+	}
+
+	// a single bit per query, sorting them first would cost more than the
+	// lookups themselves
+	for(size_t k = 0; k < count; k++) {
+		int z = positions[k * 3 + 2];
+		solid[k] = z >= (int)map->depth
+			|| (z >= 0
+				&& libvxl_geometry_get(
+					map, libvxl_wrap(positions[k * 3 + 0], map->width),
+					libvxl_wrap(positions[k * 3 + 1], map->height), z));
+	}
+}
+
+static bool libvxl_surface(struct libvxl_map* map, int x, int y, int z) {
+	if(map->depth <= 64 && z >= 0 && z < (int)map->depth) {
+		// all six neighbours at once, wrapped like libvxl_map_issolid()
+		size_t w = map->width, h = map->height;
+		size_t cx = libvxl_wrap(x, w), cy = libvxl_wrap(y, h);
+		uint64_t m = libvxl_geometry_mask(map, cx, cy);
+		uint64_t bottom = (uint64_t)1 << (map->depth - 1);
+		uint64_t solid = (m << 1) & ((m >> 1) | bottom)
+			& libvxl_geometry_mask(map, libvxl_wrap(x + 1, w), cy)
+			& libvxl_geometry_mask(map, libvxl_wrap(x - 1, w), cy)
+			& libvxl_geometry_mask(map, cx, libvxl_wrap(y + 1, h))
+			& libvxl_geometry_mask(map, cx, libvxl_wrap(y - 1, h));
+		return !((solid >> z) & 1);
+	}
+
+	return !libvxl_solid(map, x, y + 1, z) || !libvxl_solid(map, x, y - 1, z)
+		|| !libvxl_solid(map, x + 1, y, z) || !libvxl_solid(map, x - 1, y, z)
+		|| !libvxl_solid(map, x, y, z + 1) || !libvxl_solid(map, x, y, z - 1);
+}
+
+bool libvxl_map_onsurface(struct libvxl_map* map, int x, int y, int z) {
+	if(!map)
+		return false;
+
+	struct libvxl_reading r;
+	if(!libvxl_read_enter(map, &r))
+		return libvxl_surface(map, x, y, z);
+
+	// the column and its four neighbours, which can be in other chunks
+	size_t w = map->width, h = map->height;
+	size_t cx = libvxl_wrap(x, w), cy = libvxl_wrap(y, h);
+	libvxl_read_chunk(map, &r, cx, cy);
+	libvxl_read_chunk(map, &r, libvxl_wrap(x + 1, w), cy);
+	libvxl_read_chunk(map, &r, libvxl_wrap(x - 1, w), cy);
+	libvxl_read_chunk(map, &r, cx, libvxl_wrap(y + 1, h));
+	libvxl_read_chunk(map, &r, cx, libvxl_wrap(y - 1, h));
+
+	bool surface;
+	do {
+		libvxl_read_start(&r);
+		surface = libvxl_surface(map, x, y, z);
+	} while(libvxl_read_retry(&r));
+	libvxl_read_leave(&r);
+
+	return surface;
+}
+
+uint64_t libvxl_map_getmask(struct libvxl_map* map, int x, int y) {
+	if(!map || map->depth > 64)
+		return 0;
+
+	size_t cx = libvxl_wrap(x, map->width);
+	size_t cy = libvxl_wrap(y, map->height);
+
+	struct libvxl_reading r;
+	if(!libvxl_read_enter(map, &r))
+		return libvxl_geometry_mask(map, cx, cy);
+
+	uint64_t mask;
+	libvxl_read_chunk(map, &r, cx, cy);
+	do {
+		libvxl_read_start(&r);
+		mask = libvxl_geometry_mask(map, cx, cy);
+	} while(libvxl_read_retry(&r));
+	libvxl_read_leave(&r);
+
+	return mask;
+}
+
+void libvxl_map_getmasks(struct libvxl_map* map, int x, int y, size_t count,
+						 uint64_t* masks) {
+	if(!map || !masks || map->depth > 64)
+		return;
+
+	if(map->sync) {
+		for(size_t k = 0; k < count; k++)
+			masks[k] = libvxl_map_getmask(map, x + (int)k, y);
+		return;
+	}
+
+	size_t cy = libvxl_wrap(y, map->height);
+	for(size_t k = 0; k < count; k++)
+		masks[k] = libvxl_geometry_mask(
+			map, libvxl_wrap(x + (int)k, map->width), cy);
+}
+
+void libvxl_map_surfacemasks(struct libvxl_map* map, int x, int y,
+							 size_t count, uint64_t* masks) {
+	if(!map || !masks || map->depth > 64)
+		return;
+
+	uint64_t row[66], north[64], south[64];
+	uint64_t bottom = (uint64_t)1 << (map->depth - 1);
+
+	// in steps of 64 columns so nothing needs to be allocated
+	for(size_t k = 0; k < count; k += 64) {
+		size_t length = min(count - k, 64);
+		int start = x + (int)k;
+
+		libvxl_map_getmasks(map, start - 1, y, length + 2, row);
+		libvxl_map_getmasks(map, start, y - 1, length, north);
+		libvxl_map_getmasks(map, start, y + 1, length, south);
+		libvxl_surface_kernel(row, north, south, bottom, masks + k, length);
+	}
+}
+
+void libvxl_map_gettops(struct libvxl_map* map, int x, int y, size_t count,
+						uint32_t* heights) {
+	if(!map || !heights)
+		return;
+
+	size_t cy = libvxl_wrap(y, map->height);
+	struct libvxl_reading r;
+	if(!libvxl_read_enter(map, &r)) {
+		for(size_t k = 0; k < count; k++)
+			heights[k] = libvxl_geometry_find(
+				map, libvxl_wrap(x + (int)k, map->width), cy, 0,
+				map->depth, true);
+		return;
+	}
+
+	for(size_t k = 0; k < count; k++) {
+		size_t cx = libvxl_wrap(x + (int)k, map->width);
+		r.count = 0;
+		libvxl_read_chunk(map, &r, cx, cy);
+		do {
+			libvxl_read_start(&r);
+			heights[k] = libvxl_geometry_find(map, cx, cy, 0, map->depth, true);
+		} while(libvxl_read_retry(&r));
+	}
+
+	libvxl_read_leave(&r);
+}
+
+static void libvxl_top(struct libvxl_map* map, size_t x, size_t y,
+					   uint32_t* result) {
+	if(map->top_colors) {
+		if(map->lazy) // entries of a chunk are filled in once it is decoded
+			chunk_fposition(map, x, y);
+
+		result[0] = map->top_colors[x + y * map->width];
+		result[1] = map->top_heights[x + y * map->width];
+		return;
+	}
+
+	libvxl_column_top(map, chunk_fposition(map, x, y), x, y, result,
+					  result + 1);
+}
+
+void libvxl_map_gettop(struct libvxl_map* map, int x, int y, uint32_t* result) {
+	if(!map || x < 0 || y < 0 || x >= (int)map->width || y >= (int)map->height)
+		return;
+
+	struct libvxl_reading r;
+	if(!libvxl_read_enter(map, &r)) {
+		libvxl_top(map, x, y, result);
+		return;
+	}
+
+	libvxl_read_chunk(map, &r, x, y);
+	do {
+		libvxl_read_start(&r);
+		libvxl_top(map, x, y, result);
+	} while(libvxl_read_retry(&r));
+	libvxl_read_leave(&r);
+}
+
+void libvxl_map_overview(struct libvxl_map* map, size_t x, size_t y,
+						 size_t width, size_t height, uint32_t* colors,
+						 uint32_t* heights) {
+	if(!map || x + width > map->width || y + height > map->height)
+		return;
+
+	for(size_t row = 0; row < height; row++) {
+		size_t cy = y + row;
+
+		// one chunk at a time, lazily loaded chunks are decoded on the way
+		for(size_t cx = x; cx < x + width;) {
+			size_t end = min((cx / LIBVXL_CHUNK_SIZE + 1) * LIBVXL_CHUNK_SIZE,
+							 x + width);
+			struct libvxl_chunk* chunk = chunk_fposition(map, cx, cy);
+			size_t out = row * width + cx - x;
+			size_t index = cx + cy * map->width;
+
+			if(map->top_colors) {
+				if(colors)
+					memcpy(colors + out, map->top_colors + index,
+						   (end - cx) * sizeof(uint32_t));
+				if(heights)
+					memcpy(heights + out, map->top_heights + index,
+						   (end - cx) * sizeof(uint32_t));
+			} else {
+				for(size_t k = 0; k < end - cx; k++) {
+					uint32_t color, z;
+					libvxl_column_top(map, chunk, cx + k, cy, &color, &z);
+					if(colors)
+						colors[out + k] = color;
+					if(heights)
+						heights[out + k] = z;
+				}
+			}
+
+			cx = end;
+		}
+	}
+}
+
+static void libvxl_map_set_internal(struct libvxl_map* map, int x, int y, int z,
+									uint32_t color) {
+	libvxl_assert(map, "map is null");
+
+	if(z < 0 || z >= (int)map->depth)
+		return;
+
+	x = libvxl_wrap(x, map->width);
+	y = libvxl_wrap(y, map->height);
+
+	if(libvxl_geometry_get(map, x, y, z) && !libvxl_map_onsurface(map, x, y, z))
+		return;
+
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	libvxl_chunk_write(map, x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx);
+	libvxl_chunk_insert(map, chunk_fposition(map, x, y), pos_key(x, y, z),
+						color);
+	libvxl_map_touch(map, x, y);
+}
+
+static void libvxl_map_setair_internal(struct libvxl_map* map, int x, int y,
+									   int z) {
+	libvxl_assert(map, "map is null");
+
+	if(z < 0 || z >= (int)map->depth)
+		return;
+
+	x = libvxl_wrap(x, map->width);
+	y = libvxl_wrap(y, map->height);
+
+	if(!libvxl_geometry_get(map, x, y, z))
+		return;
+
+	struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+
+	if(libvxl_chunk_find(chunk, pos_key(x, y, z))) {
+		size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+		libvxl_chunk_write(map,
+						   x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx);
+		libvxl_chunk_remove(map, chunk, pos_key(x, y, z));
+		libvxl_map_touch(map, x, y);
+	}
+}
+
+void libvxl_map_set(struct libvxl_map* map, int x, int y, int z,
+					uint32_t color) {
+	if(!map || x < 0 || y < 0 || z < 0 || x >= (int)map->width
+	   || y >= (int)map->height || z >= (int)map->depth)
+		return;
+
+	libvxl_sync_begin(map);
+	map->generation++;
+	libvxl_map_touch(map, x, y);
+	libvxl_geometry_set(map, x, y, z, 1);
+	libvxl_map_set_internal(map, x, y, z, color);
+
+	if(!libvxl_map_onsurface(map, x, y + 1, z))
+		libvxl_map_setair_internal(map, x, y + 1, z);
+	if(!libvxl_map_onsurface(map, x, y - 1, z))
+		libvxl_map_setair_internal(map, x, y - 1, z);
+
+	if(!libvxl_map_onsurface(map, x + 1, y, z))
+		libvxl_map_setair_internal(map, x + 1, y, z);
+	if(!libvxl_map_onsurface(map, x - 1, y, z))
+		libvxl_map_setair_internal(map, x - 1, y, z);
+
+	if(!libvxl_map_onsurface(map, x, y, z + 1))
+		libvxl_map_setair_internal(map, x, y, z + 1);
+	if(!libvxl_map_onsurface(map, x, y, z - 1))
+		libvxl_map_setair_internal(map, x, y, z - 1);
+
+	libvxl_sync_end(map);
+}
+
+void libvxl_map_setair(struct libvxl_map* map, int x, int y, int z) {
+	if(!map || x < 0 || y < 0 || z < 0 || x >= (int)map->width
+	   || y >= (int)map->height || z >= (int)map->depth - 1)
+		return;
+
+	libvxl_sync_begin(map);
+
+	bool surface_prev[6] = {
+		libvxl_map_issolid(map, x, y + 1, z) ?
+			libvxl_map_onsurface(map, x, y + 1, z) :
+			true,
+		libvxl_map_issolid(map, x, y - 1, z) ?
+			libvxl_map_onsurface(map, x, y - 1, z) :
+			true,
+		libvxl_map_issolid(map, x + 1, y, z) ?
+			libvxl_map_onsurface(map, x + 1, y, z) :
+			true,
+		libvxl_map_issolid(map, x - 1, y, z) ?
+			libvxl_map_onsurface(map, x - 1, y, z) :
+			true,
+		libvxl_map_issolid(map, x, y, z + 1) ?
+			libvxl_map_onsurface(map, x, y, z + 1) :
+			true,
+		libvxl_map_issolid(map, x, y, z - 1) ?
+			libvxl_map_onsurface(map, x, y, z - 1) :
+			true,
+	};
+
+	map->generation++;
+	libvxl_map_touch(map, x, y);
+	libvxl_map_setair_internal(map, x, y, z);
+	libvxl_geometry_set(map, x, y, z, 0);
+
+	if(!surface_prev[0] && libvxl_map_onsurface(map, x, y + 1, z))
+		libvxl_map_set_internal(map, x, y + 1, z, DEFAULT_COLOR(x, y + 1, z));
+	if(!surface_prev[1] && libvxl_map_onsurface(map, x, y - 1, z))
+		libvxl_map_set_internal(map, x, y - 1, z, DEFAULT_COLOR(x, y - 1, z));
+
+	if(!surface_prev[2] && libvxl_map_onsurface(map, x + 1, y, z))
+		libvxl_map_set_internal(map, x + 1, y, z, DEFAULT_COLOR(x + 1, y, z));
+	if(!surface_prev[3] && libvxl_map_onsurface(map, x - 1, y, z))
+		libvxl_map_set_internal(map, x - 1, y, z, DEFAULT_COLOR(x - 1, y, z));
+
+	if(!surface_prev[4] && libvxl_map_onsurface(map, x, y, z + 1))
+		libvxl_map_set_internal(map, x, y, z + 1, DEFAULT_COLOR(x, y, z + 1));
+	if(!surface_prev[5] && libvxl_map_onsurface(map, x, y, z - 1))
+		libvxl_map_set_internal(map, x, y, z - 1, DEFAULT_COLOR(x, y, z - 1));
+
+	libvxl_sync_end(map);
+}
+
+// a range of blocks [z_start, z_end] in one column that was modified
+struct libvxl_range {
+	size_t chunk;
+	libvxl_key column; // pos_key(x, y, 0)
+	uint32_t z_start, z_end;
+};
+
+static int libvxl_range_cmp(const void* a, const void* b) {
+	const struct libvxl_range* aa = a;
+	const struct libvxl_range* bb = b;
+
+	if(aa->chunk != bb->chunk)
+		return aa->chunk < bb->chunk ? -1 : 1;
+	if(aa->column != bb->column)
+		return aa->column < bb->column ? -1 : 1;
+	return 0;
+}
+
+static struct libvxl_range libvxl_range_make(struct libvxl_map* map, size_t x,
+											 size_t y, size_t z_start,
+											 size_t z_end) {
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	return (struct libvxl_range) {
+		.chunk = x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx,
+		.column = pos_key(x, y, 0),
+		.z_start = z_start,
+		.z_end = z_end,
+	};
+}
+
+enum libvxl_update_action {
+	LIBVXL_UPDATE_SET,
+	LIBVXL_UPDATE_KEEP, // keep old color or use DEFAULT_COLOR if there is none
+	LIBVXL_UPDATE_REMOVE,
+};
+
+struct libvxl_update {
+	libvxl_key position;
+	uint32_t color;
+	enum libvxl_update_action action;
+};
+
+// replaces the blocks of a column of a chunk that is owned by the map
+static void libvxl_column_store(struct libvxl_map* map,
+								struct libvxl_chunk* chunk, size_t column,
+								const struct libvxl_block* blocks,
+								size_t count) {
+	libvxl_column_reserve(map, chunk, column, count);
+	struct libvxl_column* c = chunk->columns + column;
+	memcpy(chunk->blocks + c->start, blocks,
+		   count * sizeof(struct libvxl_block));
+	c->count = count;
+}
+
+// applies updates sorted by position to a chunk, each column touched is merged
+// with its updates in a single pass
+static void libvxl_chunk_merge(struct libvxl_map* map,
+							   struct libvxl_chunk* chunk,
+							   struct libvxl_update* updates, size_t count) {
+	libvxl_assert(chunk && updates, "invalid input parameters");
+
+	libvxl_chunk_own(map, chunk);
+
+	// a column never holds more blocks than the map is deep
+	struct libvxl_block blocks[256];
+
+	for(size_t j = 0; j < count;) {
+		size_t column = libvxl_chunk_column(updates[j].position);
+		libvxl_key key = key_discardz(updates[j].position);
+		struct libvxl_column* c = chunk->columns + column;
+		struct libvxl_block* old = chunk->blocks + c->start;
+
+		size_t i = 0, k = 0;
+		while(i < c->count
+			  || (j < count && key_discardz(updates[j].position) == key)) {
+			if(j == count || key_discardz(updates[j].position) != key
+			   || (i < c->count && old[i].position < updates[j].position)) {
+				blocks[k++] = old[i++];
+				continue;
+			}
+
+			bool exists
+				= i < c->count && old[i].position == updates[j].position;
+			libvxl_key pos = updates[j].position;
+
+			switch(updates[j].action) {
+				case LIBVXL_UPDATE_SET:
+					blocks[k++] = (struct libvxl_block) {
+						.position = pos,
+						.color = updates[j].color,
+					};
+					break;
+				case LIBVXL_UPDATE_KEEP:
+					blocks[k++] = exists ?
+						old[i] :
+						(struct libvxl_block) {
+							.position = pos,
+							.color = DEFAULT_COLOR(key_getx(pos), key_gety(pos),
+												   key_getz(pos)),
+						};
+					break;
+				case LIBVXL_UPDATE_REMOVE: break;
+			}
+
+			if(exists)
+				i++;
+			j++;
+		}
+
+		libvxl_column_store(map, chunk, column, blocks, k);
+	}
+}
+
+// recomputes the surface in and right next to the modified ranges: visible
+// blocks get their color from explicit_color() if it returns true, otherwise
+// they keep their old color or get DEFAULT_COLOR, hidden blocks lose theirs
+static void
+libvxl_surface_rebuild(struct libvxl_map* map, struct libvxl_range* ranges,
+					   size_t count,
+					   bool (*explicit_color)(void* ctx, libvxl_key position,
+											  uint32_t* color),
+					   void* ctx) {
+	libvxl_assert(map && (ranges || !count), "invalid input parameters");
+
+	// neighbouring columns can change visibility as well
+	struct libvxl_range* all
+		= libvxl_mem_malloc(count * 5 * sizeof(struct libvxl_range));
+	size_t length = 0;
+
+	for(size_t k = 0; k < count; k++) {
+		size_t x = key_getx(ranges[k].column);
+		size_t y = key_gety(ranges[k].column);
+		size_t z_start = ranges[k].z_start;
+		size_t z_end = ranges[k].z_end;
+
+		all[length++]
+			= libvxl_range_make(map, x, y, z_start > 0 ? z_start - 1 : 0,
+								min(z_end + 1, map->depth - 1));
+		all[length++] = libvxl_range_make(
+			map, libvxl_wrap((long)x + 1, map->width), y, z_start, z_end);
+		all[length++] = libvxl_range_make(
+			map, libvxl_wrap((long)x - 1, map->width), y, z_start, z_end);
+		all[length++] = libvxl_range_make(
+			map, x, libvxl_wrap((long)y + 1, map->height), z_start, z_end);
+		all[length++] = libvxl_range_make(
+			map, x, libvxl_wrap((long)y - 1, map->height), z_start, z_end);
+	}
+
+	qsort(all, length, sizeof(struct libvxl_range), libvxl_range_cmp);
+
+	// join ranges of the same column
+	size_t columns = 0;
+	for(size_t k = 0; k < length; k++) {
+		if(columns > 0 && all[columns - 1].column == all[k].column) {
+			struct libvxl_range* r = all + columns - 1;
+			r->z_start = min(r->z_start, all[k].z_start);
+			if(all[k].z_end > r->z_end)
+				r->z_end = all[k].z_end;
+		} else {
+			all[columns++] = all[k];
+		}
+	}
+
+	struct libvxl_update* updates = NULL;
+	size_t updates_length = 0;
 
-#define LIBVXL_SPAN(base, off) ((struct libvxl_span*)((uint8_t*)(base) + (off)))
+	for(size_t start = 0; start < columns;) {
+		size_t end = start;
+		size_t blocks = 0;
+		while(end < columns && all[end].chunk == all[start].chunk) {
+			blocks += all[end].z_end - all[end].z_start + 1;
+			end++;
+		}
 
-static struct libvxl_chunk* chunk_fposition(struct libvxl_map* map, size_t x,
-											size_t y) {
-	libvxl_assert(map && x < map->width && y < map->height,
-				  "invalid input parameters");
+		if(blocks > updates_length) {
+			updates_length = blocks;
+			updates = libvxl_mem_realloc(
+				updates, updates_length * sizeof(struct libvxl_update));
+		}
 
-	size_t chunk_cnt = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-	size_t chunk_x = x / LIBVXL_CHUNK_SIZE;
-	size_t chunk_y = y / LIBVXL_CHUNK_SIZE;
-	return map->chunks + chunk_x + chunk_y * chunk_cnt;
-}
+		size_t index = 0;
+		for(size_t k = start; k < end; k++) {
+			int x = key_getx(all[k].column);
+			int y = key_gety(all[k].column);
+
+			for(size_t z = all[k].z_start; z <= all[k].z_end; z++) {
+				struct libvxl_update* u = updates + index++;
+				u->position = pos_key(x, y, z);
+
+				if(!libvxl_geometry_get(map, x, y, z)
+				   || !libvxl_map_onsurface(map, x, y, z)) {
+					u->action = LIBVXL_UPDATE_REMOVE;
+				} else if(explicit_color
+						  && explicit_color(ctx, u->position, &u->color)) {
+					u->action = LIBVXL_UPDATE_SET;
+				} else {
+					u->action = LIBVXL_UPDATE_KEEP;
+				}
+			}
+		}
 
-static bool libvxl_geometry_get(struct libvxl_map* map, size_t x, size_t y,
-								size_t z) {
-	libvxl_assert(map && x < map->width && y < map->height && z < map->depth,
-				  "invalid input parameters");
+		libvxl_chunk_write(map, all[start].chunk);
+		libvxl_chunk_merge(map,
+						   chunk_fposition(map, key_getx(all[start].column),
+										   key_gety(all[start].column)),
+						   updates, index);
 
-	size_t offset = z + (x + y * map->width) * map->depth;
-	return (map->geometry[offset / (sizeof(size_t) * 8)]
-			& ((size_t)1 << (offset % (sizeof(size_t) * 8))))
-		> 0;
+		for(size_t k = start; k < end; k++)
+			libvxl_map_touch(map, key_getx(all[k].column),
+							 key_gety(all[k].column));
+		start = end;
+	}
+
+	libvxl_mem_free(updates);
+	libvxl_mem_free(all);
 }
 
-static void libvxl_geometry_set(struct libvxl_map* map, size_t x, size_t y,
-								size_t z, size_t state) {
-	libvxl_assert(map && x < map->width && y < map->height && z < map->depth,
-				  "invalid input parameters");
+// recomputes which blocks of column [x,y] are on the surface from the geometry
+// of it and its neighbours, these take their color from explicit_color() if it
+// returns true, otherwise they keep their old color or get DEFAULT_COLOR,
+// hidden blocks lose theirs
+static void libvxl_column_rebuild(struct libvxl_map* map, size_t x, size_t y,
+								  bool (*explicit_color)(void* ctx,
+														 libvxl_key position,
+														 uint32_t* color),
+								  void* ctx) {
+	uint64_t surface[LIBVXL_COLUMN_WORDS];
+	libvxl_column_surface(map, x, y, surface);
 
-	size_t offset = z + (x + y * map->width) * map->depth;
+	struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+	libvxl_chunk_own(map, chunk);
+
+	size_t column = libvxl_chunk_column(pos_key(x, y, 0));
+	struct libvxl_column* c = chunk->columns + column;
+	struct libvxl_block* old = chunk->blocks + c->start;
+
+	// a column never holds more blocks than the map is deep
+	struct libvxl_block blocks[256];
+	size_t count = 0, next = 0;
+
+	for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++) {
+		while(surface[k]) {
+			size_t z
+				= k * 64 + libvxl_bit_count((surface[k] & -surface[k]) - 1);
+			surface[k] &= surface[k] - 1;
+
+			libvxl_key pos = pos_key(x, y, z);
+			while(next < c->count && old[next].position < pos)
+				next++;
+
+			uint32_t color;
+			if(!explicit_color || !explicit_color(ctx, pos, &color))
+				color = next < c->count && old[next].position == pos ?
+					old[next].color :
+					DEFAULT_COLOR(x, y, z);
+
+			blocks[count++] = (struct libvxl_block) {
+				.position = pos,
+				.color = color,
+			};
+		}
+	}
 
-	size_t* val = map->geometry + offset / (sizeof(size_t) * 8);
-	size_t bit = offset % (sizeof(size_t) * 8);
+	libvxl_column_store(map, chunk, column, blocks, count);
+}
 
-	*val = (*val & ~((size_t)1 << bit)) | (state << bit);
+// calls func() for the columns [x_start, x_end) x [y_start, y_end) and the
+// ones right next to them, wrapping around the map
+static void libvxl_area_each(struct libvxl_map* map, size_t x_start,
+							 size_t y_start, size_t x_end, size_t y_end,
+							 void (*func)(struct libvxl_map* map, size_t x,
+										  size_t y, void* ctx),
+							 void* ctx) {
+	size_t w = map->width, h = map->height;
+	size_t columns_x = min(x_end - x_start + 2, w);
+	size_t columns_y = min(y_end - y_start + 2, h);
+
+	for(size_t j = 0; j < columns_y; j++)
+		for(size_t i = 0; i < columns_x; i++)
+			func(map, libvxl_wrap((long)(x_start + i) - 1, w),
+				 libvxl_wrap((long)(y_start + j) - 1, h), ctx);
+}
+
+// decodes a chunk of a lazily loaded map before its geometry changes
+static void libvxl_area_decode(struct libvxl_map* map, size_t x, size_t y,
+							   void* ctx) {
+	(void)ctx;
+	chunk_fposition(map, x, y);
 }
 
-static int cmp(const void* a, const void* b) {
-	struct libvxl_block* aa = (struct libvxl_block*)a;
-	struct libvxl_block* bb = (struct libvxl_block*)b;
+struct libvxl_area_colors {
+	bool (*explicit_color)(void* ctx, libvxl_key position, uint32_t* color);
+	void* ctx;
+};
 
-	return (int)(aa->position - bb->position);
+static void libvxl_area_column(struct libvxl_map* map, size_t x, size_t y,
+							   void* ctx) {
+	struct libvxl_area_colors* colors = ctx;
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+
+	libvxl_chunk_write(map, x / LIBVXL_CHUNK_SIZE + y / LIBVXL_CHUNK_SIZE * sx);
+	libvxl_column_rebuild(map, x, y, colors->explicit_color, colors->ctx);
+	libvxl_map_touch(map, x, y);
 }
 
-static void libvxl_chunk_put(struct libvxl_chunk* chunk, uint32_t pos,
-							 uint32_t color) {
-	libvxl_assert(chunk, "chunk pointer is null");
+// rebuilds the surface of every column of an area whose geometry changed and
+// of the columns around it, see libvxl_column_rebuild()
+static void libvxl_area_rebuild(struct libvxl_map* map, size_t x_start,
+								size_t y_start, size_t x_end, size_t y_end,
+								bool (*explicit_color)(void* ctx,
+													   libvxl_key position,
+													   uint32_t* color),
+								void* ctx) {
+	libvxl_area_each(map, x_start, y_start, x_end, y_end, libvxl_area_column,
+					 &(struct libvxl_area_colors) {
+						 .explicit_color = explicit_color,
+						 .ctx = ctx,
+					 });
+}
 
-	if(chunk->index == chunk->length) { // needs to grow
-		chunk->length *= LIBVXL_CHUNK_GROWTH;
-		chunk->blocks = libvxl_mem_realloc(
-			chunk->blocks, chunk->length * sizeof(struct libvxl_block));
-	}
+static int libvxl_edit_op_cmp(const void* a, const void* b) {
+	const struct libvxl_edit_op* aa = a;
+	const struct libvxl_edit_op* bb = b;
 
-	memcpy(chunk->blocks + (chunk->index++),
-		   &(struct libvxl_block) {
-			   .position = pos,
-			   .color = color,
-		   },
-		   sizeof(struct libvxl_block));
+	if(aa->position != bb->position)
+		return aa->position < bb->position ? -1 : 1;
+	return aa->sequence < bb->sequence ? -1 : (aa->sequence > bb->sequence);
 }
 
-static struct libvxl_block*
-libvxl_chunk_gequal_block(struct libvxl_chunk* chunk, uint32_t pos) {
-	libvxl_assert(chunk, "chunk pointer is null");
+struct libvxl_edit_colors {
+	struct libvxl_edit_op* ops;
+	size_t length;
+};
+
+static bool libvxl_edit_color(void* ctx, libvxl_key position, uint32_t* color) {
+	struct libvxl_edit_colors* colors = ctx;
 
 	size_t start = 0;
-	size_t end = chunk->index;
+	size_t end = colors->length;
 	while(end > start) {
 		size_t mid = (start + end) / 2;
-		if(pos > chunk->blocks[mid].position) {
+		if(position > colors->ops[mid].position) {
 			start = mid + 1;
-		} else if(pos < chunk->blocks[mid].position) {
+		} else if(position < colors->ops[mid].position) {
 			end = mid;
 		} else {
-			return chunk->blocks + mid;
+			*color = colors->ops[mid].color;
+			return !colors->ops[mid].air;
 		}
 	}
 
-	return chunk->blocks + start;
+	return false;
 }
 
-static void libvxl_chunk_insert(struct libvxl_chunk* chunk, uint32_t pos,
-								uint32_t color) {
-	libvxl_assert(chunk, "chunk pointer is null");
+static void libvxl_edit_push(struct libvxl_edit* edit, int x, int y, int z,
+							 uint32_t color, bool air) {
+	if(edit->index == edit->length) { // needs to grow
+		edit->length = edit->length > 0 ? edit->length * 2 : 64;
+		edit->ops = libvxl_mem_realloc(
+			edit->ops, edit->length * sizeof(struct libvxl_edit_op));
+	}
 
-	// TODO: use libvxl_chunk_gequal_block
+	edit->ops[edit->index] = (struct libvxl_edit_op) {
+		.position = pos_key(x, y, z),
+		.color = color,
+		.sequence = edit->index,
+		.air = air,
+	};
+	edit->index++;
+}
 
-	size_t start = 0;
-	size_t end = chunk->index;
-	while(end > start) {
-		size_t mid = (start + end) / 2;
-		if(pos > chunk->blocks[mid].position) {
-			start = mid + 1;
-		} else if(pos < chunk->blocks[mid].position) {
-			end = mid;
-		} else { // diff=0, replace color
-			chunk->blocks[mid].color = color;
-			return;
-		}
-	}
+void libvxl_edit_begin(struct libvxl_edit* edit, struct libvxl_map* map) {
+	if(!edit || !map)
+		return;
+	edit->map = map;
+	edit->ops = NULL;
+	edit->length = 0;
+	edit->index = 0;
+}
 
-	if(chunk->index == chunk->length) { // needs to grow
-		chunk->length *= LIBVXL_CHUNK_GROWTH;
-		chunk->blocks = libvxl_mem_realloc(
-			chunk->blocks, chunk->length * sizeof(struct libvxl_block));
-	}
+void libvxl_edit_set(struct libvxl_edit* edit, int x, int y, int z,
+					 uint32_t color) {
+	if(!edit || !edit->map || x < 0 || y < 0 || z < 0
+	   || x >= (int)edit->map->width || y >= (int)edit->map->height
+	   || z >= (int)edit->map->depth)
+		return;
 
-	memmove(chunk->blocks + start + 1, chunk->blocks + start,
-			(chunk->index - start) * sizeof(struct libvxl_block));
-	chunk->blocks[start].position = pos;
-	chunk->blocks[start].color = color;
-	chunk->index++;
+	libvxl_edit_push(edit, x, y, z, color, false);
 }
 
-static size_t libvxl_span_length(struct libvxl_span* s) {
-	libvxl_assert(s, "span pointer is null");
+void libvxl_edit_setair(struct libvxl_edit* edit, int x, int y, int z) {
+	if(!edit || !edit->map || x < 0 || y < 0 || z < 0
+	   || x >= (int)edit->map->width || y >= (int)edit->map->height
+	   || z >= (int)edit->map->depth - 1)
+		return;
 
-	return s->length > 0 ? s->length * 4 :
-						   (s->color_end + 2 - s->color_start) * 4;
+	libvxl_edit_push(edit, x, y, z, 0, true);
 }
 
-void libvxl_free(struct libvxl_map* map) {
-	if(!map)
+void libvxl_edit_commit(struct libvxl_edit* edit) {
+	if(!edit || !edit->map)
 		return;
-	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-	for(size_t k = 0; k < sx * sy; k++)
-		libvxl_mem_free(map->chunks[k].blocks);
-	libvxl_mem_free(map->chunks);
-	libvxl_mem_free(map->geometry);
+
+	struct libvxl_map* map = edit->map;
+	libvxl_sync_begin(map);
+	map->generation++;
+
+	// geometry first, in the order the edits were made
+	for(size_t k = 0; k < edit->index; k++) {
+		libvxl_key pos = edit->ops[k].position;
+		libvxl_geometry_set(map, key_getx(pos), key_gety(pos), key_getz(pos),
+							!edit->ops[k].air);
+	}
+
+	// only the last edit of each position decides its color
+	qsort(edit->ops, edit->index, sizeof(struct libvxl_edit_op),
+		  libvxl_edit_op_cmp);
+
+	size_t length = 0;
+	for(size_t k = 0; k < edit->index; k++) {
+		if(length > 0
+		   && edit->ops[length - 1].position == edit->ops[k].position)
+			length--;
+		edit->ops[length++] = edit->ops[k];
+	}
+
+	struct libvxl_range* ranges
+		= libvxl_mem_malloc(length * sizeof(struct libvxl_range));
+	for(size_t k = 0; k < length; k++) {
+		libvxl_key pos = edit->ops[k].position;
+		ranges[k] = libvxl_range_make(map, key_getx(pos), key_gety(pos),
+									  key_getz(pos), key_getz(pos));
+	}
+
+	libvxl_surface_rebuild(map, ranges, length, libvxl_edit_color,
+						   &(struct libvxl_edit_colors) {
+							   .ops = edit->ops,
+							   .length = length,
+						   });
+
+	libvxl_sync_end(map);
+
+	libvxl_mem_free(ranges);
+	libvxl_mem_free(edit->ops);
+	edit->ops = NULL;
+	edit->length = 0;
+	edit->index = 0;
 }
 
-bool libvxl_size(size_t* size, size_t* depth, const void* data, size_t len) {
-	if(!data || !size || !depth || len == 0)
+struct libvxl_prefab_extract {
+	struct libvxl_prefab* prefab;
+	size_t index;
+};
+
+static void libvxl_prefab_visit(void* ctx, size_t x, size_t y, size_t z,
+								uint32_t color, unsigned faces) {
+	struct libvxl_prefab_extract* e = ctx;
+	(void)faces;
+
+	e->prefab->blocks[e->index++] = (struct libvxl_block) {
+		.position = pos_key(x, y, z),
+		.color = color,
+	};
+	e->prefab->offsets[x * e->prefab->height + y + 1]++;
+}
+
+bool libvxl_region_extract(struct libvxl_map* map,
+						   const struct libvxl_region* region,
+						   struct libvxl_prefab* prefab) {
+	struct libvxl_region r;
+	if(!map || !prefab || !libvxl_region_get(map, region, &r))
 		return false;
-	size_t offset = 0;
-	size_t columns = 0;
-	*depth = 0;
-	while(offset + sizeof(struct libvxl_span) - 1 < len) {
-		struct libvxl_span* desc = LIBVXL_SPAN(data, offset);
-		if(desc->color_end + 1 > (int)*depth)
-			*depth = desc->color_end + 1;
-		if(!desc->length)
-			columns++;
-		offset += libvxl_span_length(desc);
+
+	size_t columns = r.width * r.height;
+	prefab->width = r.width;
+	prefab->height = r.height;
+	prefab->depth = r.depth;
+	prefab->words = (r.depth + 63) / 64;
+	prefab->geometry
+		= libvxl_mem_malloc(columns * prefab->words * sizeof(uint64_t));
+
+	uint64_t range[LIBVXL_COLUMN_WORDS];
+	libvxl_bits_range(r.z, r.z + r.depth, range);
+
+	for(size_t x = 0; x < r.width; x++) {
+		for(size_t y = 0; y < r.height; y++) {
+			uint64_t m[LIBVXL_COLUMN_WORDS], shifted[LIBVXL_COLUMN_WORDS];
+			libvxl_geometry_bits(map, r.x + x, r.y + y, m);
+			for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++)
+				m[k] &= range[k];
+			libvxl_bits_shift(m, -(ptrdiff_t)r.z, shifted);
+			memcpy(prefab->geometry + (x * r.height + y) * prefab->words,
+				   shifted, prefab->words * sizeof(uint64_t));
+		}
 	}
-	*depth = (size_t)(1U << (uint32_t)ceil(log2f(*depth)));
-	*size = sqrt(columns);
+
+	// colors of the blocks that can end up on the surface once pasted
+	prefab->length = libvxl_region_scan(map, &r, NULL, NULL);
+	prefab->blocks
+		= libvxl_mem_malloc(prefab->length * sizeof(struct libvxl_block));
+	prefab->offsets = libvxl_mem_malloc((columns + 1) * sizeof(uint32_t));
+	memset(prefab->offsets, 0, (columns + 1) * sizeof(uint32_t));
+
+	libvxl_region_scan(map, &r, libvxl_prefab_visit,
+					   &(struct libvxl_prefab_extract) {.prefab = prefab});
+
+	for(size_t k = 0; k < columns; k++)
+		prefab->offsets[k + 1] += prefab->offsets[k];
+
 	return true;
 }
 
-bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d,
-				   const void* data, size_t len) {
-	if(!map)
+void libvxl_prefab_free(struct libvxl_prefab* prefab) {
+	if(!prefab)
+		return;
+
+	libvxl_mem_free(prefab->geometry);
+	libvxl_mem_free(prefab->offsets);
+	libvxl_mem_free(prefab->blocks);
+	prefab->geometry = NULL;
+	prefab->offsets = NULL;
+	prefab->blocks = NULL;
+	prefab->length = 0;
+}
+
+struct libvxl_paste {
+	const struct libvxl_prefab* prefab;
+	int x, y, z;
+	size_t x_start, y_start, z_start;
+	size_t x_end, y_end, z_end;
+};
+
+// solid blocks of the prefab keep its colors, exposed ones it has none for
+// get DEFAULT_COLOR
+static bool libvxl_paste_color(void* ctx, libvxl_key position,
+							   uint32_t* color) {
+	struct libvxl_paste* paste = ctx;
+	const struct libvxl_prefab* prefab = paste->prefab;
+	size_t x = key_getx(position), y = key_gety(position);
+	size_t z = key_getz(position);
+
+	if(x < paste->x_start || x >= paste->x_end || y < paste->y_start
+	   || y >= paste->y_end || z < paste->z_start || z >= paste->z_end)
 		return false;
-	map->streamed = 0;
-	map->width = w;
-	map->height = h;
-	map->depth = d;
-	size_t sx = (w + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-	size_t sy = (h + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-	map->chunks = libvxl_mem_malloc(sx * sy * sizeof(struct libvxl_chunk));
-	for(size_t y = 0; y < sy; y++) {
-		for(size_t x = 0; x < sx; x++) {
-			map->chunks[x + y * sx].length = LIBVXL_CHUNK_SIZE
-				* LIBVXL_CHUNK_SIZE * 2; // allows for two fully filled layers
-			map->chunks[x + y * sx].index = 0;
-			map->chunks[x + y * sx].blocks = libvxl_mem_malloc(
-				map->chunks[x + y * sx].length * sizeof(struct libvxl_block));
+
+	size_t column = (x - paste->x) * prefab->height + (y - paste->y);
+	size_t pz = z - paste->z;
+	if(!((prefab->geometry[column * prefab->words + pz / 64] >> (pz % 64)) & 1))
+		return false;
+
+	libvxl_key key = pos_key(x - paste->x, y - paste->y, pz);
+	size_t start = prefab->offsets[column];
+	size_t end = prefab->offsets[column + 1];
+	while(end > start) {
+		size_t mid = (start + end) / 2;
+		if(key > prefab->blocks[mid].position) {
+			start = mid + 1;
+		} else if(key < prefab->blocks[mid].position) {
+			end = mid;
+		} else {
+			*color = prefab->blocks[mid].color;
+			return true;
 		}
 	}
 
-	size_t sg = (w * h * d + (sizeof(size_t) * 8 - 1)) / (sizeof(size_t) * 8)
-		* sizeof(size_t);
-	map->geometry = libvxl_mem_malloc(sg);
-	if(data) {
-		memset(map->geometry, 0xFF, sg);
-	} else {
-		memset(map->geometry, 0x00, sg);
-		for(size_t y = 0; y < h; y++)
-			for(size_t x = 0; x < w; x++)
-				libvxl_map_set(map, x, y, d - 1, DEFAULT_COLOR(x, y, d - 1));
-		return true;
-	}
+	*color = DEFAULT_COLOR(x, y, z);
+	return true;
+}
 
-	size_t offset = 0;
-	for(size_t y = 0; y < map->height; y++) {
-		for(size_t x = 0; x < map->width; x++) {
-			struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+bool libvxl_region_paste(struct libvxl_map* map,
+						 const struct libvxl_prefab* prefab, int x, int y,
+						 int z, bool replace) {
+	if(!map || !prefab || !prefab->geometry)
+		return false;
 
-			while(1) {
-				if(offset + sizeof(struct libvxl_span) - 1 >= len)
-					return false;
-				struct libvxl_span* desc = LIBVXL_SPAN(data, offset);
-				if(offset + libvxl_span_length(desc) - 1 >= len)
-					return false;
-				uint32_t* color_data = (uint32_t*)LIBVXL_SPAN(
-					data, offset + sizeof(struct libvxl_span));
-
-				for(size_t z = desc->air_start; z < desc->color_start; z++)
-					libvxl_geometry_set(map, x, y, z, 0);
-
-				for(size_t z = desc->color_start; z <= desc->color_end;
-					z++) // top color run
-					libvxl_chunk_put(chunk, pos_key(x, y, z),
-									 color_data[z - desc->color_start]);
-
-				size_t top_len = desc->color_end - desc->color_start + 1;
-				size_t bottom_len = desc->length - 1 - top_len;
-
-				if(desc->length > 0) {
-					if(offset + libvxl_span_length(desc)
-						   + sizeof(struct libvxl_span) - 1
-					   >= len)
-						return false;
-					struct libvxl_span* desc_next
-						= LIBVXL_SPAN(data, offset + libvxl_span_length(desc));
-					for(size_t z = desc_next->air_start - bottom_len;
-						z < desc_next->air_start; z++) // bottom color run
-						libvxl_chunk_put(
-							chunk, pos_key(x, y, z),
-							color_data[z - (desc_next->air_start - bottom_len)
-									   + top_len]);
-					offset += libvxl_span_length(desc);
-				} else {
-					offset += libvxl_span_length(desc);
-					break;
-				}
+	// the part of the prefab that lies inside of the map
+	struct libvxl_paste paste = {
+		.prefab = prefab,
+		.x = x,
+		.y = y,
+		.z = z,
+		.x_start = (size_t)max(x, 0),
+		.y_start = (size_t)max(y, 0),
+		.z_start = (size_t)max(z, 0),
+		.x_end = (size_t)max(min((long)x + (long)prefab->width,
+								 (long)map->width),
+							 0),
+		.y_end = (size_t)max(min((long)y + (long)prefab->height,
+								 (long)map->height),
+							 0),
+		.z_end = (size_t)max(min((long)z + (long)prefab->depth,
+								 (long)map->depth),
+							 0),
+	};
+
+	if(paste.x_start >= paste.x_end || paste.y_start >= paste.y_end
+	   || paste.z_start >= paste.z_end)
+		return false;
+
+	libvxl_sync_begin(map);
+	map->generation++;
+
+	if(map->lazy)
+		libvxl_area_each(map, paste.x_start, paste.y_start, paste.x_end,
+						 paste.y_end, libvxl_area_decode, NULL);
+
+	// the bottom layer of the map stays solid
+	uint64_t range[LIBVXL_COLUMN_WORDS], cleared[LIBVXL_COLUMN_WORDS];
+	libvxl_bits_range(paste.z_start, paste.z_end, range);
+	libvxl_bits_range(paste.z_start, min(paste.z_end, map->depth - 1),
+					  cleared);
+
+	// whole geometry words are masked and merged, column by column
+	for(size_t ty = paste.y_start; ty < paste.y_end; ty++) {
+		for(size_t tx = paste.x_start; tx < paste.x_end; tx++) {
+			size_t column = (tx - x) * prefab->height + (ty - y);
+			uint64_t bits[LIBVXL_COLUMN_WORDS] = {0};
+			uint64_t m[LIBVXL_COLUMN_WORDS], old[LIBVXL_COLUMN_WORDS];
+			memcpy(bits, prefab->geometry + column * prefab->words,
+				   prefab->words * sizeof(uint64_t));
+			libvxl_bits_shift(bits, z, m);
+			libvxl_geometry_bits(map, tx, ty, old);
+
+			bool changed = false;
+			for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++) {
+				uint64_t word = (replace ? old[k] & ~cleared[k] : old[k])
+					| (m[k] & range[k]);
+				changed = changed || word != old[k];
+				m[k] = word;
 			}
+
+			if(changed)
+				libvxl_geometry_store(map, tx, ty, m);
 		}
 	}
 
-	for(size_t z = 0; z < map->depth; z++) {
-		for(size_t x = 0; x < map->width; x++) {
-			bool A = libvxl_geometry_get(map, x, 0, z);
-			bool B = libvxl_geometry_get(map, x, map->height - 1, z);
+	libvxl_area_rebuild(map, paste.x_start, paste.y_start, paste.x_end,
+						paste.y_end, libvxl_paste_color, &paste);
+
+	libvxl_sync_end(map);
+	return true;
+}
 
-			struct libvxl_chunk* c1 = chunk_fposition(map, x, 0);
-			struct libvxl_block* b1 = bsearch(
-				&(struct libvxl_block) {
-					.position = pos_key(x, 0, z),
-				},
-				c1->blocks, c1->index, sizeof(struct libvxl_block), cmp);
+#define LIBVXL_SHAPE_RADIUS 65536.0F
+
+// blocks inside of the box lo up to hi whose distance from center, measured
+// only along the axes in round, is at most radius
+struct libvxl_shape {
+	int64_t lo[3], hi[3];
+	int64_t center[3];
+	float radius;
+	bool round[3];
+};
+
+// blocks [z_start, z_end) of column [x,y] inside of a shape, not clipped to
+// the map, returns false if there are none
+static bool libvxl_shape_span(const struct libvxl_shape* shape, int64_t x,
+							  int64_t y, int64_t* z_start, int64_t* z_end) {
+	if(x < shape->lo[0] || x > shape->hi[0] || y < shape->lo[1]
+	   || y > shape->hi[1])
+		return false;
 
-			struct libvxl_chunk* c2 = chunk_fposition(map, x, map->height - 1);
-			struct libvxl_block* b2 = bsearch(
-				&(struct libvxl_block) {
-					.position = pos_key(x, map->height - 1, z),
-				},
-				c2->blocks, c2->index, sizeof(struct libvxl_block), cmp);
+	float left = shape->radius * shape->radius;
+	float d[2] = {(float)(x - shape->center[0]),
+				  (float)(y - shape->center[1])};
+	for(size_t k = 0; k < 2; k++)
+		if(shape->round[k])
+			left -= d[k] * d[k];
 
-			if(A && !B && !b1)
-				libvxl_chunk_insert(c1, pos_key(x, 0, z),
-									DEFAULT_COLOR(x, 0, z));
+	if(left < 0.0F)
+		return false;
 
-			if(!A && B && !b2)
-				libvxl_chunk_insert(c2, pos_key(x, map->height - 1, z),
-									DEFAULT_COLOR(x, map->height - 1, z));
-		}
+	*z_start = shape->lo[2];
+	*z_end = shape->hi[2] + 1;
+
+	if(shape->round[2]) {
+		int64_t h = (int64_t)sqrtf(left);
+		while((float)((h + 1) * (h + 1)) <= left)
+			h++;
+		while(h > 0 && (float)(h * h) > left)
+			h--;
+		*z_start = max(*z_start, shape->center[2] - h);
+		*z_end = min(*z_end, shape->center[2] + h + 1);
+	}
 
-		for(size_t y = 0; y < map->height; y++) {
-			bool A = libvxl_geometry_get(map, 0, y, z);
-			bool B = libvxl_geometry_get(map, map->width - 1, y, z);
+	return *z_start < *z_end;
+}
+
+// blocks of column [x,y] inside of both the shape and the map
+static bool libvxl_shape_clip(struct libvxl_map* map,
+							  const struct libvxl_shape* shape, size_t x,
+							  size_t y, size_t* z_start, size_t* z_end) {
+	int64_t start, end;
+	if(!libvxl_shape_span(shape, (int64_t)x, (int64_t)y, &start, &end))
+		return false;
 
-			struct libvxl_chunk* c1 = chunk_fposition(map, 0, y);
-			struct libvxl_block* b1 = bsearch(
-				&(struct libvxl_block) {
-					.position = pos_key(0, y, z),
-				},
-				c1->blocks, c1->index, sizeof(struct libvxl_block), cmp);
+	start = max(start, (int64_t)0);
+	end = min(end, (int64_t)map->depth);
+	if(start >= end)
+		return false;
 
-			struct libvxl_chunk* c2 = chunk_fposition(map, map->width - 1, y);
-			struct libvxl_block* b2 = bsearch(
-				&(struct libvxl_block) {
-					.position = pos_key(map->width - 1, y, z),
-				},
-				c2->blocks, c2->index, sizeof(struct libvxl_block), cmp);
+	*z_start = (size_t)start;
+	*z_end = (size_t)end;
+	return true;
+}
 
-			if(A && !B && !b1)
-				libvxl_chunk_insert(c1, pos_key(0, y, z),
-									DEFAULT_COLOR(0, y, z));
+struct libvxl_shape_fill {
+	const struct libvxl_shape* shape;
+	uint32_t color;
+};
 
-			if(!A && B && !b2)
-				libvxl_chunk_insert(c2, pos_key(map->width - 1, y, z),
-									DEFAULT_COLOR(map->width - 1, y, z));
-		}
-	}
+static bool libvxl_shape_color(void* ctx, libvxl_key position,
+							   uint32_t* color) {
+	struct libvxl_shape_fill* fill = ctx;
+	int64_t start, end;
+	int64_t z = key_getz(position);
 
+	if(!libvxl_shape_span(fill->shape, key_getx(position), key_gety(position),
+						  &start, &end)
+	   || z < start || z >= end)
+		return false;
+
+	*color = fill->color;
 	return true;
 }
 
-static size_t find_successive_surface(struct libvxl_chunk* chunk,
-									  size_t block_offset, int x, int y,
-									  size_t start,
-									  struct libvxl_block** current) {
-	libvxl_assert(chunk && current, "chunk or block pointer is null");
+// sets the blocks inside of a shape to solid or air as one bit span per column,
+// then rebuilds the surface of all touched columns once
+static bool libvxl_shape_apply(struct libvxl_map* map,
+							   const struct libvxl_shape* shape, bool solid,
+							   uint32_t color,
+							   struct libvxl_region* affected) {
+	if(shape->hi[0] < 0 || shape->hi[1] < 0
+	   || shape->lo[0] >= (int64_t)map->width
+	   || shape->lo[1] >= (int64_t)map->height)
+		return false;
 
-	*current = chunk->blocks + block_offset;
-	struct libvxl_block* end_marker = chunk->blocks + chunk->index;
+	size_t x_start = (size_t)max(shape->lo[0], (int64_t)0);
+	size_t y_start = (size_t)max(shape->lo[1], (int64_t)0);
+	size_t x_end = (size_t)min(shape->hi[0] + 1, (int64_t)map->width);
+	size_t y_end = (size_t)min(shape->hi[1] + 1, (int64_t)map->height);
+
+	// bounds of the blocks inside of both the shape and the map
+	size_t lo[3] = {SIZE_MAX, SIZE_MAX, SIZE_MAX}, hi[3] = {0, 0, 0};
+	for(size_t y = y_start; y < y_end; y++) {
+		for(size_t x = x_start; x < x_end; x++) {
+			size_t z_start, z_end;
+			if(libvxl_shape_clip(map, shape, x, y, &z_start, &z_end)) {
+				lo[0] = min(lo[0], x);
+				lo[1] = min(lo[1], y);
+				lo[2] = min(lo[2], z_start);
+				hi[0] = max(hi[0], x + 1);
+				hi[1] = max(hi[1], y + 1);
+				hi[2] = max(hi[2], z_end);
+			}
+		}
+	}
 
-	if(*current < end_marker && (*current)->position == pos_key(x, y, start)) {
-		while(1) {
-			uint32_t next_z = key_getz((*current)->position) + 1;
-			(*current)++;
+	if(lo[0] >= hi[0])
+		return false;
 
-			if(*current >= end_marker
-			   || (*current)->position != pos_key(x, y, next_z))
-				return next_z;
+	if(affected)
+		*affected = (struct libvxl_region) {
+			.x = lo[0],
+			.y = lo[1],
+			.z = lo[2],
+			.width = hi[0] - lo[0],
+			.height = hi[1] - lo[1],
+			.depth = hi[2] - lo[2],
+		};
+
+	libvxl_sync_begin(map);
+	map->generation++;
+
+	if(map->lazy)
+		libvxl_area_each(map, lo[0], lo[1], hi[0], hi[1], libvxl_area_decode,
+						 NULL);
+
+	for(size_t y = lo[1]; y < hi[1]; y++) {
+		for(size_t x = lo[0]; x < hi[0]; x++) {
+			size_t z_start, z_end;
+			if(!libvxl_shape_clip(map, shape, x, y, &z_start, &z_end))
+				continue;
+
+			// the bottom layer of the map stays solid
+			uint64_t range[LIBVXL_COLUMN_WORDS], m[LIBVXL_COLUMN_WORDS];
+			libvxl_bits_range(z_start,
+							  solid ? z_end : min(z_end, map->depth - 1),
+							  range);
+			libvxl_geometry_bits(map, x, y, m);
+
+			bool changed = false;
+			for(size_t k = 0; k < LIBVXL_COLUMN_WORDS; k++) {
+				uint64_t word = solid ? m[k] | range[k] : m[k] & ~range[k];
+				changed = changed || word != m[k];
+				m[k] = word;
+			}
+
+			if(changed)
+				libvxl_geometry_store(map, x, y, m);
 		}
-	} else {
-		return start;
 	}
+
+	libvxl_area_rebuild(map, lo[0], lo[1], hi[0], hi[1],
+						solid ? libvxl_shape_color : NULL,
+						&(struct libvxl_shape_fill) {
+							.shape = shape,
+							.color = color,
+						});
+
+	libvxl_sync_end(map);
+	return true;
 }
 
-static void libvxl_column_encode(struct libvxl_map* map, size_t* chunk_offsets,
-								 int x, int y, void* out, size_t* offset) {
-	libvxl_assert(map && chunk_offsets && out && offset,
-				  "invalid input parameters");
+bool libvxl_map_box(struct libvxl_map* map, int x1, int y1, int z1, int x2,
+					int y2, int z2, bool solid, uint32_t color,
+					struct libvxl_region* affected) {
+	if(!map)
+		return false;
 
-	struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+	return libvxl_shape_apply(
+		map,
+		&(struct libvxl_shape) {
+			.lo = {min(x1, x2), min(y1, y2), min(z1, z2)},
+			.hi = {max(x1, x2), max(y1, y2), max(z1, z2)},
+		},
+		solid, color, affected);
+}
 
-	bool first_run = true;
-	size_t z
-		= key_getz(chunk->blocks[chunk_offsets[chunk - map->chunks]].position);
-	while(1) {
-		size_t top_start = libvxl_geometry_get(map, x, y, z) ?
-			z :
-			key_getz(
-				chunk->blocks[chunk_offsets[chunk - map->chunks]].position);
+bool libvxl_map_sphere(struct libvxl_map* map, int x, int y, int z,
+					   float radius, bool solid, uint32_t color,
+					   struct libvxl_region* affected) {
+	if(!map || !(radius >= 0.0F) || radius > LIBVXL_SHAPE_RADIUS)
+		return false;
 
-		struct libvxl_block* last_surface_block;
-		size_t top_end
-			= find_successive_surface(chunk, chunk_offsets[chunk - map->chunks],
-									  x, y, top_start, &last_surface_block);
+	int64_t r = (int64_t)radius;
+	return libvxl_shape_apply(map,
+							  &(struct libvxl_shape) {
+								  .lo = {x - r, y - r, z - r},
+								  .hi = {x + r, y + r, z + r},
+								  .center = {x, y, z},
+								  .radius = radius,
+								  .round = {true, true, true},
+							  },
+							  solid, color, affected);
+}
 
-		size_t bottom_start = map->depth;
+bool libvxl_map_cylinder(struct libvxl_map* map, int x, int y, int z,
+						 float radius, int length, enum libvxl_face direction,
+						 bool solid, uint32_t color,
+						 struct libvxl_region* affected) {
+	if(!map || !(radius >= 0.0F) || radius > LIBVXL_SHAPE_RADIUS
+	   || length <= 0 || direction < LIBVXL_FACE_NEG_X
+	   || direction > LIBVXL_FACE_POS_Z)
+		return false;
 
-		if(top_end == map->depth || !libvxl_geometry_get(map, x, y, top_end)) {
-			bottom_start = top_end;
-		} else if(last_surface_block < chunk->blocks + chunk->index
-				  && key_discardz(last_surface_block->position)
-					  == pos_key(x, y, 0)) {
-			bottom_start = key_getz(last_surface_block->position);
-		}
+	int64_t r = (int64_t)radius;
+	size_t axis = direction / 2;
+	struct libvxl_shape shape = {
+		.lo = {x - r, y - r, z - r},
+		.hi = {x + r, y + r, z + r},
+		.center = {x, y, z},
+		.radius = radius,
+		.round = {axis != 0, axis != 1, axis != 2},
+	};
 
-		struct libvxl_span* desc = LIBVXL_SPAN(out, *offset);
-		desc->color_start = top_start;
-		desc->color_end = top_end - 1;
-		desc->air_start = first_run ? 0 : z;
-		*offset += sizeof(struct libvxl_span);
+	// the axis starts at [x,y,z] and runs length blocks into direction
+	int64_t start = shape.center[axis];
+	shape.lo[axis] = direction % 2 ? start : start - length + 1;
+	shape.hi[axis] = direction % 2 ? start + length - 1 : start;
 
-		libvxl_assert(desc->air_start <= desc->color_start,
-					  "air_start is bigger than color_start");
-		libvxl_assert(desc->color_start <= desc->color_end + 1,
-					  "color_start is bigger than color_end + 1");
+	return libvxl_shape_apply(map, &shape, solid, color, affected);
+}
 
-		first_run = false;
+struct libvxl_floating_slot {
+	size_t column;
+	size_t head;
+	uint32_t stamp;
+};
 
-		for(size_t k = top_start; k < top_end; k++) {
-			*(uint32_t*)LIBVXL_SPAN(out, *offset)
-				= (chunk->blocks[chunk_offsets[chunk - map->chunks]++].color
-				   & 0xFFFFFF)
-				| 0x7F000000;
-			*offset += sizeof(uint32_t);
-		}
+#define LIBVXL_FLOATING_NONE SIZE_MAX
 
-		if(bottom_start == map->depth) {
-			/* this is the last span of this column, do not emit bottom colors,
-			 * set length to 0 */
-			desc->length = 0;
-			break;
-		} else { // bottom_start < map->depth
-			struct libvxl_block* last_surface_block;
-			size_t bottom_end = find_successive_surface(
-				chunk, chunk_offsets[chunk - map->chunks], x, y, bottom_start,
-				&last_surface_block);
+static size_t libvxl_floating_hash(struct libvxl_floating* f, size_t column) {
+	size_t h = column * (size_t)0x9E3779B1;
+	return (h ^ (h >> 16)) & (f->slots_capacity - 1);
+}
 
-			// there are more spans to follow, emit bottom colors
-			if(bottom_end < map->depth) {
-				desc->length
-					= 1 + top_end - top_start + bottom_end - bottom_start;
+static struct libvxl_floating_slot*
+libvxl_floating_slot(struct libvxl_floating* f, size_t column) {
+	size_t k = libvxl_floating_hash(f, column);
+	while(f->slots[k].stamp == f->stamp && f->slots[k].column != column)
+		k = (k + 1) & (f->slots_capacity - 1);
+
+	if(f->slots[k].stamp != f->stamp) {
+		f->slots[k].stamp = f->stamp;
+		f->slots[k].column = column;
+		f->slots[k].head = LIBVXL_FLOATING_NONE;
+	}
+
+	return f->slots + k;
+}
+
+static void libvxl_floating_link(struct libvxl_floating* f,
+								 struct libvxl_map* map, size_t node) {
+	struct libvxl_floating_slot* slot = libvxl_floating_slot(
+		f, f->nodes[node].x + f->nodes[node].y * map->width);
+	f->nodes_next[node] = slot->head;
+	slot->head = node;
+}
+
+// keeps the column table at most half full, rebuilding it from all runs
+// visited so far whenever it grows
+static void libvxl_floating_reserve(struct libvxl_floating* f,
+									struct libvxl_map* map) {
+	if(f->nodes_length == f->nodes_capacity) {
+		f->nodes_capacity = f->nodes_capacity > 0 ? f->nodes_capacity * 2 : 64;
+		f->nodes = libvxl_mem_realloc(
+			f->nodes, f->nodes_capacity * sizeof(struct libvxl_run));
+		f->nodes_next = libvxl_mem_realloc(f->nodes_next,
+										   f->nodes_capacity * sizeof(size_t));
+	}
+
+	if((f->nodes_length + 1) * 2 > f->slots_capacity) {
+		f->slots_capacity = f->slots_capacity > 0 ? f->slots_capacity * 2 : 128;
+		libvxl_mem_free(f->slots);
+		f->slots = libvxl_mem_malloc(f->slots_capacity
+									 * sizeof(struct libvxl_floating_slot));
+		memset(f->slots, 0, f->slots_capacity
+				   * sizeof(struct libvxl_floating_slot));
+
+		for(size_t k = 0; k < f->nodes_length; k++)
+			libvxl_floating_link(f, map, k);
+	}
+}
+
+// returns the index of the run starting at z_start in column [x,y], a new
+// one is appended if it was not visited before
+static size_t libvxl_floating_visit(struct libvxl_floating* f,
+									struct libvxl_map* map, size_t x, size_t y,
+									size_t z_start, size_t z_end) {
+	struct libvxl_floating_slot* slot
+		= libvxl_floating_slot(f, x + y * map->width);
+
+	for(size_t k = slot->head; k != LIBVXL_FLOATING_NONE;
+		k = f->nodes_next[k]) {
+		if(f->nodes[k].z_start == z_start)
+			return k;
+	}
+
+	libvxl_floating_reserve(f, map);
+
+	size_t node = f->nodes_length++;
+	f->nodes[node] = (struct libvxl_run) {
+		.x = x,
+		.y = y,
+		.z_start = z_start,
+		.z_end = z_end,
+	};
+	libvxl_floating_link(f, map, node);
+	return node;
+}
 
-				for(size_t k = bottom_start; k < bottom_end; k++) {
-					*(uint32_t*)LIBVXL_SPAN(out, *offset)
-						= (chunk->blocks[chunk_offsets[chunk - map->chunks]++]
-							   .color
-						   & 0xFFFFFF)
-						| 0x7F000000;
-					*offset += sizeof(uint32_t);
-				}
+// visits all solid runs of column [x,y] that overlap [z_start,z_end)
+// returns false if the flood reached a run of an earlier flood
+static bool libvxl_floating_expand(struct libvxl_floating* f,
+								   struct libvxl_map* map, size_t flood,
+								   size_t x, size_t y, size_t z_start,
+								   size_t z_end) {
+	size_t z = libvxl_geometry_get(map, x, y, z_start) ?
+		libvxl_geometry_rfind(map, x, y, z_start, 0, false) :
+		libvxl_geometry_find(map, x, y, z_start, z_end, true);
+
+	while(z < z_end) {
+		size_t end = libvxl_geometry_find(map, x, y, z, map->depth, false);
+		if(libvxl_floating_visit(f, map, x, y, z, end) < flood)
+			return false;
+		if(end >= z_end)
+			break;
+		z = libvxl_geometry_find(map, x, y, end, z_end, true);
+	}
 
-				z = bottom_end;
-			} else { // bottom_end == map->depth
-				desc->length = 1 + top_end - top_start;
-				z = bottom_start;
-			}
+	return true;
+}
+
+// floods the component of the run at index flood, which must be the last one
+// returns true if it is floating
+static bool libvxl_floating_flood(struct libvxl_floating* f,
+								  struct libvxl_map* map, size_t flood,
+								  size_t limit) {
+	size_t blocks = 0;
+
+	for(size_t k = flood; k < f->nodes_length; k++) {
+		struct libvxl_run run = f->nodes[k];
+
+		if(run.z_end == map->depth)
+			return false;
+
+		blocks += run.z_end - run.z_start;
+		if(limit > 0 && blocks > limit)
+			return false;
+
+		size_t neighbours[4][2] = {
+			{run.x > 0 ? run.x - 1 : map->width - 1, run.y},
+			{run.x < map->width - 1 ? run.x + 1 : 0, run.y},
+			{run.x, run.y > 0 ? run.y - 1 : map->height - 1},
+			{run.x, run.y < map->height - 1 ? run.y + 1 : 0},
+		};
+
+		for(size_t n = 0; n < 4; n++) {
+			if(!libvxl_floating_expand(f, map, flood, neighbours[n][0],
+									   neighbours[n][1], run.z_start,
+									   run.z_end))
+				return false;
 		}
 	}
+
+	return true;
 }
 
-void libvxl_stream(struct libvxl_stream* stream, struct libvxl_map* map,
-				   size_t chunk_size) {
-	if(!stream || !map || chunk_size == 0)
-		return;
-	stream->map = map;
-	map->streamed++;
-	stream->chunk_size = chunk_size;
-	stream->pos = pos_key(0, 0, 0);
-	stream->buffer_offset = 0;
-	stream->buffer = libvxl_mem_malloc(stream->chunk_size * 2);
+static void libvxl_floating_result(struct libvxl_floating* f, size_t flood) {
+	size_t length = f->nodes_length - flood;
+	size_t total = f->count > 0 ? f->components[f->count] : 0;
 
-	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-	stream->chunk_offsets = libvxl_mem_malloc(sx * sy * sizeof(size_t));
-	memset(stream->chunk_offsets, 0, sx * sy * sizeof(size_t));
+	if(total + length > f->runs_capacity) {
+		while(total + length > f->runs_capacity)
+			f->runs_capacity
+				= f->runs_capacity > 0 ? f->runs_capacity * 2 : 64;
+		f->runs = libvxl_mem_realloc(
+			f->runs, f->runs_capacity * sizeof(struct libvxl_run));
+	}
+
+	if(f->count + 2 > f->components_capacity) {
+		f->components_capacity
+			= f->components_capacity > 0 ? f->components_capacity * 2 : 16;
+		f->components = libvxl_mem_realloc(
+			f->components, f->components_capacity * sizeof(size_t));
+	}
+
+	memcpy(f->runs + total, f->nodes + flood,
+		   length * sizeof(struct libvxl_run));
+	f->components[f->count] = total;
+	f->components[++f->count] = total + length;
 }
 
-void libvxl_stream_free(struct libvxl_stream* stream) {
-	if(!stream)
+void libvxl_floating_init(struct libvxl_floating* f) {
+	if(!f)
 		return;
-	stream->map->streamed--;
-	libvxl_mem_free(stream->buffer);
-	libvxl_mem_free(stream->chunk_offsets);
+	memset(f, 0, sizeof(struct libvxl_floating));
 }
 
-#ifndef min
-#define min(a, b) ((a) < (b) ? (a) : (b))
-#endif
+void libvxl_floating_free(struct libvxl_floating* f) {
+	if(!f)
+		return;
 
-size_t libvxl_stream_read(struct libvxl_stream* stream, void* out) {
-	if(!stream || !out || key_gety(stream->pos) >= stream->map->height)
+	libvxl_mem_free(f->runs);
+	libvxl_mem_free(f->components);
+	libvxl_mem_free(f->nodes);
+	libvxl_mem_free(f->nodes_next);
+	libvxl_mem_free(f->slots);
+	libvxl_floating_init(f);
+}
+
+size_t libvxl_map_floating(struct libvxl_map* map, struct libvxl_floating* f,
+						   const int* positions, size_t count, size_t limit) {
+	if(!map || !f)
 		return 0;
-	while(stream->buffer_offset < stream->chunk_size
-		  && key_gety(stream->pos) < stream->map->height) {
-		libvxl_column_encode(stream->map, stream->chunk_offsets,
-							 key_getx(stream->pos), key_gety(stream->pos),
-							 stream->buffer, &stream->buffer_offset);
-		if(key_getx(stream->pos) + 1 < stream->map->width)
-			stream->pos
-				= pos_key(key_getx(stream->pos) + 1, key_gety(stream->pos), 0);
-		else
-			stream->pos = pos_key(0, key_gety(stream->pos) + 1, 0);
+
+	f->count = 0;
+	f->nodes_length = 0;
+
+	// invalidates the column table of the previous call without clearing it
+	if(++f->stamp == 0) {
+		memset(f->slots, 0, f->slots_capacity
+				   * sizeof(struct libvxl_floating_slot));
+		f->stamp = 1;
 	}
-	size_t length = stream->buffer_offset;
-	memcpy(out, stream->buffer, min(length, stream->chunk_size));
-	if(length < stream->chunk_size) {
-		stream->buffer_offset = 0;
-	} else {
-		memmove(stream->buffer, (uint8_t*)stream->buffer + stream->chunk_size,
-				length - stream->chunk_size);
-		stream->buffer_offset -= stream->chunk_size;
+
+	if(!f->slots)
+		libvxl_floating_reserve(f, map);
+
+	for(size_t k = 0; k < count; k++) {
+		int x = positions[k * 3 + 0];
+		int y = positions[k * 3 + 1];
+		int z = positions[k * 3 + 2];
+
+		if(!libvxl_map_isinside(map, x, y, z))
+			continue;
+
+		int neighbours[6][3] = {
+			{x - 1, y, z}, {x + 1, y, z}, {x, y - 1, z},
+			{x, y + 1, z}, {x, y, z - 1}, {x, y, z + 1},
+		};
+
+		for(size_t n = 0; n < 6; n++) {
+			int nz = neighbours[n][2];
+			if(nz < 0 || nz >= (int)map->depth)
+				continue;
+
+			size_t nx = libvxl_wrap(neighbours[n][0], map->width);
+			size_t ny = libvxl_wrap(neighbours[n][1], map->height);
+
+			if(!libvxl_geometry_get(map, nx, ny, nz))
+				continue;
+
+			size_t z_start = libvxl_geometry_rfind(map, nx, ny, nz, 0, false);
+			size_t z_end
+				= libvxl_geometry_find(map, nx, ny, nz, map->depth, false);
+
+			size_t flood = f->nodes_length;
+			size_t node
+				= libvxl_floating_visit(f, map, nx, ny, z_start, z_end);
+
+			if(node == flood && libvxl_floating_flood(f, map, flood, limit))
+				libvxl_floating_result(f, flood);
+		}
 	}
-	return min(length, stream->chunk_size);
+
+	return f->count;
 }
 
-void libvxl_write(struct libvxl_map* map, void* out, size_t* size) {
-	if(!map || !out)
-		return;
-	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+// first solid z of column [x,y] the ray meets going from z_in to z_out
+static bool libvxl_ray_column(struct libvxl_map* map, size_t x, size_t y,
+							  int z_in, int z_out, bool up, int* z) {
+	int depth = map->depth;
 
-	size_t* chunk_offsets = libvxl_mem_malloc(sx * sy * sizeof(size_t));
-	memset(chunk_offsets, 0, sx * sy * sizeof(size_t));
+	if(up && z_in >= depth) { // starts below the map
+		*z = z_in;
+		return true;
+	}
 
-	size_t offset = 0;
-	for(uint32_t y = 0; y < map->height; y++)
-		for(uint32_t x = 0; x < map->width; x++)
-			libvxl_column_encode(map, chunk_offsets, x, y, out, &offset);
+	int lo = up ? z_out : z_in;
+	int hi = up ? z_in : z_out;
+	lo = lo > 0 ? lo : 0;
+	hi = hi < depth - 1 ? hi : depth - 1;
+
+	if(lo <= hi) {
+		if(depth <= 64 && sizeof(size_t) >= sizeof(uint64_t)) {
+			uint64_t solid = libvxl_geometry_mask(map, x, y) >> lo;
+			if(hi - lo < 63)
+				solid &= ((uint64_t)2 << (hi - lo)) - 1;
+
+			if(solid) {
+				*z = lo
+					+ (up ? libvxl_bit_highest(solid) :
+							libvxl_bit_lowest(solid));
+				return true;
+			}
+		} else if(up) {
+			size_t found = libvxl_geometry_rfind(map, x, y, hi, lo, true);
+			if(found > (size_t)lo) {
+				*z = found - 1;
+				return true;
+			}
+		} else {
+			size_t found = libvxl_geometry_find(map, x, y, lo, hi + 1, true);
+			if(found <= (size_t)hi) {
+				*z = found;
+				return true;
+			}
+		}
+	}
 
-	if(size)
-		*size = offset;
+	if(!up && z_out >= depth) { // leaves the map at its bottom
+		*z = z_in > depth ? z_in : depth;
+		return true;
+	}
 
-	libvxl_mem_free(chunk_offsets);
+	return false;
 }
 
-size_t libvxl_writefile(struct libvxl_map* map, char* name) {
-	if(!map || !name)
-		return 0;
-	uint8_t buf[1024];
-	struct libvxl_stream s;
-	libvxl_stream(&s, map, 1024);
-	FILE* f = fopen(name, "wb");
-	size_t read, total = 0;
-	while((read = libvxl_stream_read(&s, buf))) {
-		fwrite(buf, 1, read, f);
-		total += read;
-	}
-	fclose(f);
-	libvxl_stream_free(&s);
-	return total;
-}
+bool libvxl_raycast(struct libvxl_map* map, const struct libvxl_ray* ray,
+					struct libvxl_hit* hit) {
+	if(!map || !ray || !hit)
+		return false;
 
-/*void libvxl_kv6_write(struct libvxl_map* map, char* name) {
-	FILE* f = fopen(name, "wb");
+	hit->hit = false;
 
-	struct libvxl_kv6 header;
-	strcpy(header.magic, "Kvxl");
-	header.width = map->width;
-	header.height = map->height;
-	header.depth = map->depth;
-	header.pivot[0] = map->width / 2.0F;
-	header.pivot[1] = map->height / 2.0F;
-	header.pivot[2] = map->depth / 2.0F;
+	double dx = ray->direction[0];
+	double dy = ray->direction[1];
+	double dz = ray->direction[2];
+	double len = sqrt(dx * dx + dy * dy + dz * dz);
+	if(!(len > 0) || !(ray->length >= 0) || ray->length > FLT_MAX)
+		return false;
 
-	header.len = 0;
+	dx /= len;
+	dy /= len;
+	dz /= len;
+	double length = min((double)ray->length, LIBVXL_RAY_MAX_LENGTH);
 
-	int sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-	int sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
-	for(int y = 0; y < sy; y++)
-		for(int x = 0; x < sx; x++)
-			header.len += map->chunks[x + y * sx].index;
+	double px = ray->origin[0];
+	double py = ray->origin[1];
+	double pz = ray->origin[2];
+	double cx = floor(px);
+	double cy = floor(py);
+	double cz = floor(pz);
 
-	fwrite(&header, sizeof(header), 1, f);
+	if(fabs(cx) > (1 << 30) || fabs(cy) > (1 << 30) || fabs(cz) > (1 << 30))
+		return false;
 
-	int xoffset[map->width];
-	short xyoffset[map->width * map->height];
-	memset(xoffset, 0, sizeof(xoffset));
-	memset(xyoffset, 0, sizeof(xyoffset));
+	// wraps around like libvxl_map_issolid()
+	size_t x = libvxl_wrap((long)cx, map->width);
+	size_t y = libvxl_wrap((long)cy, map->height);
+	int z = (int)cz;
+
+	int step_x = dx > 0 ? 1 : -1;
+	int step_y = dy > 0 ? 1 : -1;
+	int step_z = dz > 0 ? 1 : -1;
+	double delta_x = dx != 0 ? fabs(1.0 / dx) : DBL_MAX;
+	double delta_y = dy != 0 ? fabs(1.0 / dy) : DBL_MAX;
+	double delta_z = dz != 0 ? fabs(1.0 / dz) : DBL_MAX;
+	// distance to the next cell border along each axis
+	double next_x = dx != 0 ? (cx + (dx > 0) - px) / dx : DBL_MAX;
+	double next_y = dy != 0 ? (cy + (dy > 0) - py) / dy : DBL_MAX;
+	double next_z = dz != 0 ? (cz + (dz > 0) - pz) / dz : DBL_MAX;
+
+	// 2D DDA over columns, the part of the ray inside a column is checked
+	// against its geometry at once so empty space is skipped
+	int face = -1; // axis the current column was entered through
+	double t = 0;
 
-	size_t chunk_offsets[sx * sy];
-	memset(chunk_offsets, 0, sizeof(chunk_offsets));
+	while(1) {
+		while(next_z <= t) { // z borders crossed together with the column's
+			z += step_z;
+			next_z += delta_z;
+		}
 
-	for(size_t y = 0; y < map->height; y++) {
-		for(size_t x = 0; x < map->width; x++) {
-			struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+		if(z < 0 && dz <= 0) // everything above the map is air
+			return false;
 
-			while(1) {
-				struct libvxl_block* next
-					= &chunk->blocks[chunk_offsets[chunk - map->chunks]];
-				if(key_getx(next->position) != x)
-					break;
+		double t_exit = min(min(next_x, next_y), length);
+		int z_in = z;
+		while(next_z < t_exit) {
+			z += step_z;
+			next_z += delta_z;
+		}
 
-				chunk_offsets[chunk - map->chunks]++;
-
-				struct libvxl_kv6_block blk;
-				blk.color = next->color & 0xFFFFFF;
-				blk.z = key_getz(next->position);
-				blk.normal = 0;
-
-				blk.visfaces = 0;
-				if(libvxl_map_issolid(map, x + 1, y, blk.z))
-					blk.visfaces |= 0x01;
-				if(libvxl_map_issolid(map, x - 1, y, blk.z))
-					blk.visfaces |= 0x02;
-				if(libvxl_map_issolid(map, x, y + 1, blk.z))
-					blk.visfaces |= 0x04;
-				if(libvxl_map_issolid(map, x, y - 1, blk.z))
-					blk.visfaces |= 0x08;
-				if(libvxl_map_issolid(map, x, y, blk.z + 1))
-					blk.visfaces |= 0x10;
-				if(libvxl_map_issolid(map, x, y, blk.z - 1))
-					blk.visfaces |= 0x20;
-
-				fwrite(&blk, sizeof(blk), 1, f);
-
-				xoffset[x]++;
-				xyoffset[x + y * map->width]++;
+		int z_hit;
+		if(libvxl_ray_column(map, x, y, z_in, z, dz < 0, &z_hit)) {
+			hit->hit = true;
+			hit->x = x;
+			hit->y = y;
+			hit->z = z_hit;
+			hit->normal[0] = hit->normal[1] = hit->normal[2] = 0;
+
+			if(z_hit != z_in) { // entered the block through its top or bottom
+				hit->normal[2] = -step_z;
+				hit->distance = (z_hit + (dz > 0 ? 0 : 1) - pz) / dz;
+			} else {
+				if(face >= 0)
+					hit->normal[face] = face == 0 ? -step_x : -step_y;
+				hit->distance = t;
 			}
+
+			hit->color = z_hit < (int)map->depth ?
+				libvxl_map_get(map, x, y, z_hit) :
+				0;
+			return true;
+		}
+
+		if(t_exit >= length)
+			return false;
+
+		if(next_x < next_y) {
+			x = step_x > 0 ? (x + 1 == map->width ? 0 : x + 1) :
+							 (x == 0 ? map->width - 1 : x - 1);
+			t = next_x;
+			next_x += delta_x;
+			face = 0;
+		} else {
+			y = step_y > 0 ? (y + 1 == map->height ? 0 : y + 1) :
+							 (y == 0 ? map->height - 1 : y - 1);
+			t = next_y;
+			next_y += delta_y;
+			face = 1;
 		}
 	}
+}
 
-	fwrite(xoffset, sizeof(xoffset), 1, f);
-	fwrite(xyoffset, sizeof(xyoffset), 1, f);
+#define LIBVXL_RAY_GROUP 64
 
-	fclose(f);
-}*/
+struct libvxl_raycast_batch {
+	struct libvxl_map* map;
+	const struct libvxl_ray* rays;
+	struct libvxl_hit* hits;
+	size_t count;
+};
 
-bool libvxl_map_isinside(struct libvxl_map* map, int x, int y, int z) {
-	return map && x >= 0 && y >= 0 && z >= 0 && x < (int)map->width
-		&& y < (int)map->height && z < (int)map->depth;
+static void libvxl_raycast_group(void* ctx, size_t group) {
+	struct libvxl_raycast_batch* batch = ctx;
+
+	size_t end = min((group + 1) * LIBVXL_RAY_GROUP, batch->count);
+	for(size_t k = group * LIBVXL_RAY_GROUP; k < end; k++)
+		libvxl_raycast(batch->map, batch->rays + k, batch->hits + k);
 }
 
-uint32_t libvxl_map_get(struct libvxl_map* map, int x, int y, int z) {
-	if(!map || x < 0 || y < 0 || z < 0 || x >= (int)map->width
-	   || y >= (int)map->height || z >= (int)map->depth)
-		return 0;
-	if(!libvxl_geometry_get(map, x, y, z))
+size_t libvxl_raycast_many(struct libvxl_map* map,
+						   const struct libvxl_ray* rays, size_t count,
+						   struct libvxl_hit* hits, size_t threads) {
+	if(!map || !rays || !hits)
 		return 0;
-	struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
-	struct libvxl_block* loc = bsearch(
-		&(struct libvxl_block) {
-			.position = pos_key(x, y, z),
-		},
-		chunk->blocks, chunk->index, sizeof(struct libvxl_block), cmp);
-	return loc ? loc->color : DEFAULT_COLOR(x, y, z);
+
+	struct libvxl_raycast_batch batch = {
+		.map = map,
+		.rays = rays,
+		.hits = hits,
+		.count = count,
+	};
+
+	// rays can wrap to any chunk and workers must not decode lazily
+	// loaded chunks themselves
+	if(map->lazy && threads != 1) {
+		size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+		size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+		for(size_t k = 0; k < sx * sy; k++)
+			if(!map->chunks[k].columns)
+				libvxl_chunk_decode(map, map->chunks + k);
+	}
+
+	libvxl_parallel(threads,
+					(count + LIBVXL_RAY_GROUP - 1) / LIBVXL_RAY_GROUP,
+					libvxl_raycast_group, &batch);
+
+	size_t result = 0;
+	for(size_t k = 0; k < count; k++)
+		if(hits[k].hit)
+			result++;
+
+	return result;
 }
 
-bool libvxl_map_issolid(struct libvxl_map* map, int x, int y, int z) {
-	if(z < 0)
-		return false;
-	if(!map || z >= (int)map->depth)
-		return true;
-	return libvxl_geometry_get(map, (size_t)x % (size_t)map->width,
-							   (size_t)y % (size_t)map->height, z);
+// width of the neighbourhood of a chunk the mesher looks at, one column of
+// every neighbouring chunk on each side
+#define LIBVXL_MESH_BORDER (LIBVXL_CHUNK_SIZE + 2)
+
+// dense copy of a chunk for meshing: the solid state of its columns and of the
+// columns around it, with a layer of air above and a solid one below, and the
+// colors of its own blocks
+struct libvxl_mesher {
+	struct libvxl_map* map;
+	size_t x, y; // first column of the chunk
+	size_t size[3]; // extent of the chunk in x, y and z
+	ptrdiff_t strides[3]; // of solid along x, y and z
+	uint8_t* solid;
+	uint32_t* colors;
+	// faces of one direction, laid out like colors
+	uint64_t* mask;
+	size_t* slices; // faces in each slice of mask
+};
+
+static void libvxl_mesher_fill(struct libvxl_mesher* m) {
+	struct libvxl_map* map = m->map;
+
+	// wraps around in x and y like libvxl_map_issolid()
+	for(size_t ly = 0; ly < LIBVXL_MESH_BORDER; ly++) {
+		for(size_t lx = 0; lx < LIBVXL_MESH_BORDER; lx++) {
+			size_t x = libvxl_wrap((long)(m->x + lx) - 1, map->width);
+			size_t y = libvxl_wrap((long)(m->y + ly) - 1, map->height);
+			uint8_t* column = m->solid + lx * m->strides[0] + ly * m->strides[1];
+			column[0] = 0;
+			column[map->depth + 1] = 1;
+
+			for(size_t z = 0; z < map->depth;) {
+				bool state = libvxl_geometry_get(map, x, y, z);
+				size_t end = libvxl_geometry_find(map, x, y, z, map->depth,
+												  !state);
+				memset(column + z + 1, state, end - z);
+				z = end;
+			}
+		}
+	}
+
+	struct libvxl_chunk* chunk = chunk_fposition(map, m->x, m->y);
+	for(size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++)
+		for(size_t z = 0; z < map->depth; z++)
+			m->colors[k * map->depth + z]
+				= DEFAULT_COLOR(m->x + k % LIBVXL_CHUNK_SIZE,
+								m->y + k / LIBVXL_CHUNK_SIZE, z);
+	for(size_t k = 0; k < LIBVXL_CHUNK_COLUMNS; k++) {
+		struct libvxl_column* c = chunk->columns + k;
+		for(size_t b = c->start; b < c->start + c->count; b++)
+			m->colors[k * map->depth + key_getz(chunk->blocks[b].position)]
+				= chunk->blocks[b].color;
+	}
 }
 
-bool libvxl_map_onsurface(struct libvxl_map* map, int x, int y, int z) {
-	if(!map)
-		return false;
-	return !libvxl_map_issolid(map, x, y + 1, z)
-		|| !libvxl_map_issolid(map, x, y - 1, z)
-		|| !libvxl_map_issolid(map, x + 1, y, z)
-		|| !libvxl_map_issolid(map, x - 1, y, z)
-		|| !libvxl_map_issolid(map, x, y, z + 1)
-		|| !libvxl_map_issolid(map, x, y, z - 1);
+// ambient occlusion of the corner of a face towards du and dv, from the three
+// blocks in front of the face that touch it: 3 is fully lit, 0 fully occluded
+static size_t libvxl_mesher_ao(const uint8_t* front, ptrdiff_t du,
+							   ptrdiff_t dv) {
+	if(front[du] && front[dv])
+		return 0;
+	return 3 - front[du] - front[dv] - front[du + dv];
 }
 
-void libvxl_map_gettop(struct libvxl_map* map, int x, int y, uint32_t* result) {
-	if(!map || x < 0 || y < 0 || x >= (int)map->width || y >= (int)map->height)
-		return;
+static void libvxl_mesh_push(struct libvxl_mesh* mesh,
+							 const struct libvxl_quad* quad) {
+	if(mesh->length == mesh->capacity) {
+		mesh->capacity = mesh->capacity ? mesh->capacity * 2 : 64;
+		mesh->quads = libvxl_mem_realloc(
+			mesh->quads, mesh->capacity * sizeof(struct libvxl_quad));
+	}
 
-	struct libvxl_chunk* c = chunk_fposition(map, x, y);
-	struct libvxl_block* block = libvxl_chunk_gequal_block(c, pos_key(x, y, 0));
+	mesh->quads[mesh->length++] = *quad;
+}
 
-	libvxl_assert(block < c->blocks + c->index, "block is out of bounds");
-	libvxl_assert(key_discardz(block->position) == pos_key(x, y, 0),
-				  "position is out of bounds");
-	libvxl_assert(key_getz(block->position) < map->depth,
-				  "position is out of bounds");
+// merges equal faces of a slice into as few rectangles as possible, taking
+// the longest row first and then growing it for as long as rows match
+static void libvxl_mesher_merge(struct libvxl_mesher* m,
+								struct libvxl_mesh* mesh, size_t face,
+								size_t axis, size_t u, size_t v, size_t slice) {
+	size_t depth = m->map->depth;
+	size_t strides[3] = {depth, LIBVXL_CHUNK_SIZE * depth, 1};
+	size_t su = strides[u], sv = strides[v];
+	uint64_t* mask = m->mask + slice * strides[axis];
+
+	for(size_t j = 0; j < m->size[v]; j++) {
+		for(size_t i = 0; i < m->size[u];) {
+			uint64_t entry = mask[i * su + j * sv];
+			if(!entry) {
+				i++;
+				continue;
+			}
 
-	result[0] = block->color;
-	result[1] = key_getz(block->position);
-}
+			size_t w = 1;
+			while(i + w < m->size[u] && mask[(i + w) * su + j * sv] == entry)
+				w++;
 
-static void libvxl_map_set_internal(struct libvxl_map* map, int x, int y, int z,
-									uint32_t color) {
-	libvxl_assert(map, "map is null");
+			size_t h = 1;
+			for(; j + h < m->size[v]; h++) {
+				size_t k = 0;
+				while(k < w && mask[(i + k) * su + (j + h) * sv] == entry)
+					k++;
+				if(k < w)
+					break;
+			}
 
-	if(z < 0 || z >= (int)map->depth)
-		return;
+			for(size_t l = 0; l < h; l++)
+				for(size_t k = 0; k < w; k++)
+					mask[(i + k) * su + (j + l) * sv] = 0;
+
+			size_t pos[3];
+			pos[axis] = slice;
+			pos[u] = i;
+			pos[v] = j;
+			libvxl_mesh_push(mesh,
+							 &(struct libvxl_quad) {
+								 .x = m->x + pos[0],
+								 .y = m->y + pos[1],
+								 .z = pos[2],
+								 .width = w,
+								 .height = h,
+								 .face = face,
+								 .ao = (entry >> 32) & 0xFF,
+								 .color = entry & 0xFFFFFFFF,
+							 });
+			i += w;
+		}
+	}
+}
 
-	x = (size_t)x % (size_t)map->width;
-	y = (size_t)y % (size_t)map->height;
+// finds the faces of one direction column by column, where solid is
+// contiguous, and then merges them slice by slice
+static void libvxl_mesher_faces(struct libvxl_mesher* m,
+								struct libvxl_mesh* mesh, size_t face) {
+	// the axis a face points along and the two spanning it
+	static const size_t axes[3][3] = {{0, 1, 2}, {1, 0, 2}, {2, 0, 1}};
+	size_t axis = axes[face / 2][0];
+	size_t u = axes[face / 2][1];
+	size_t v = axes[face / 2][2];
+	ptrdiff_t front = face % 2 ? m->strides[axis] : -m->strides[axis];
+	ptrdiff_t su = m->strides[u], sv = m->strides[v];
+	size_t depth = m->map->depth;
+
+	memset(m->slices, 0, m->size[axis] * sizeof(size_t));
+
+	for(size_t ly = 0; ly < m->size[1]; ly++) {
+		for(size_t lx = 0; lx < m->size[0]; lx++) {
+			size_t column = lx + ly * LIBVXL_CHUNK_SIZE;
+			const uint8_t* solid = m->solid + (lx + 1) * m->strides[0]
+				+ (ly + 1) * m->strides[1] + 1;
+			uint64_t* mask = m->mask + column * depth;
+			size_t pos[3] = {lx, ly, 0};
+
+			for(size_t z = 0; z < depth; z++) {
+				if(!solid[z] || solid[z + front]) {
+					mask[z] = 0;
+					continue;
+				}
 
-	if(libvxl_geometry_get(map, x, y, z) && !libvxl_map_onsurface(map, x, y, z))
-		return;
+				const uint8_t* f = solid + z + front;
+				size_t ao = libvxl_mesher_ao(f, -su, -sv)
+					| libvxl_mesher_ao(f, su, -sv) << 2
+					| libvxl_mesher_ao(f, su, sv) << 4
+					| libvxl_mesher_ao(f, -su, sv) << 6;
+				// set bit 40 tells faces apart from empty entries
+				mask[z] = (uint64_t)1 << 40 | (uint64_t)ao << 32
+					| m->colors[column * depth + z];
+				pos[2] = z;
+				m->slices[pos[axis]]++;
+			}
+		}
+	}
 
-	libvxl_chunk_insert(chunk_fposition(map, x, y), pos_key(x, y, z), color);
+	for(size_t slice = 0; slice < m->size[axis]; slice++)
+		if(m->slices[slice])
+			libvxl_mesher_merge(m, mesh, face, axis, u, v, slice);
 }
 
-static void libvxl_map_setair_internal(struct libvxl_map* map, int x, int y,
-									   int z) {
-	libvxl_assert(map, "map is null");
-
-	if(z < 0 || z >= (int)map->depth)
+void libvxl_mesh_chunk(struct libvxl_map* map, size_t x, size_t y,
+					   struct libvxl_mesh* mesh) {
+	if(!map || !mesh || x >= map->width || y >= map->height)
 		return;
 
-	x = (size_t)x % (size_t)map->width;
-	y = (size_t)y % (size_t)map->height;
+	struct libvxl_mesher m = {
+		.map = map,
+		.x = x - x % LIBVXL_CHUNK_SIZE,
+		.y = y - y % LIBVXL_CHUNK_SIZE,
+	};
 
-	if(!libvxl_geometry_get(map, x, y, z))
+	m.size[0] = min(LIBVXL_CHUNK_SIZE, map->width - m.x);
+	m.size[1] = min(LIBVXL_CHUNK_SIZE, map->height - m.y);
+	m.size[2] = map->depth;
+	m.strides[2] = 1;
+	m.strides[0] = map->depth + 2;
+	m.strides[1] = LIBVXL_MESH_BORDER * m.strides[0];
+	m.solid = libvxl_mem_malloc(LIBVXL_MESH_BORDER * m.strides[1]);
+	m.colors = libvxl_mem_malloc(LIBVXL_CHUNK_COLUMNS * map->depth
+								 * sizeof(uint32_t));
+	m.mask = libvxl_mem_malloc(LIBVXL_CHUNK_COLUMNS * map->depth
+							   * sizeof(uint64_t));
+	m.slices = libvxl_mem_malloc(max(LIBVXL_CHUNK_SIZE, map->depth)
+								 * sizeof(size_t));
+
+	libvxl_mesher_fill(&m);
+
+	mesh->length = 0;
+	for(size_t face = 0; face < 6; face++)
+		libvxl_mesher_faces(&m, mesh, face);
+	mesh->generation = map->generation;
+	mesh->built = true;
+
+	libvxl_mem_free(m.solid);
+	libvxl_mem_free(m.colors);
+	libvxl_mem_free(m.mask);
+	libvxl_mem_free(m.slices);
+}
+
+void libvxl_mesh_free(struct libvxl_mesh* mesh) {
+	if(!mesh)
 		return;
 
-	struct libvxl_chunk* chunk = chunk_fposition(map, x, y);
+	libvxl_mem_free(mesh->quads);
+	mesh->quads = NULL;
+	mesh->length = 0;
+	mesh->capacity = 0;
+	mesh->built = false;
+}
 
-	struct libvxl_block* loc = bsearch(
-		&(struct libvxl_block) {
-			.position = pos_key(x, y, z),
-		},
-		chunk->blocks, chunk->index, sizeof(struct libvxl_block), cmp);
+struct libvxl_mesh_batch {
+	struct libvxl_map* map;
+	struct libvxl_mesh* meshes;
+	size_t* chunks;
+};
 
-	if(loc) {
-		memmove(loc, loc + 1,
-				(chunk->blocks + (--chunk->index) - loc)
-					* sizeof(struct libvxl_block));
+static void libvxl_mesh_one(void* ctx, size_t index) {
+	struct libvxl_mesh_batch* batch = ctx;
+	struct libvxl_map* map = batch->map;
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t k = batch->chunks[index];
+	libvxl_mesh_chunk(map, k % sx * LIBVXL_CHUNK_SIZE,
+					  k / sx * LIBVXL_CHUNK_SIZE, batch->meshes + k);
+}
+
+// a mesh also shows the faces and shadows of the columns bordering its chunk,
+// so it is outdated once its chunk or any chunk around it changed
+static bool libvxl_mesh_outdated(struct libvxl_map* map,
+								 struct libvxl_mesh* mesh, size_t chunk_x,
+								 size_t chunk_y) {
+	if(!mesh->built)
+		return true;
+	if(!map->chunk_generation) // snapshots do not track changes
+		return false;
 
-		if(chunk->index * LIBVXL_CHUNK_SHRINK <= chunk->length) {
-			chunk->length /= LIBVXL_CHUNK_GROWTH;
-			chunk->blocks = libvxl_mem_realloc(
-				chunk->blocks, chunk->length * sizeof(struct libvxl_block));
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	for(size_t dy = 0; dy < 3; dy++) {
+		for(size_t dx = 0; dx < 3; dx++) {
+			size_t x = (chunk_x + sx + dx - 1) % sx;
+			size_t y = (chunk_y + sy + dy - 1) % sy;
+			if(map->chunk_generation[x + y * sx] > mesh->generation)
+				return true;
 		}
 	}
+
+	return false;
 }
 
-void libvxl_map_set(struct libvxl_map* map, int x, int y, int z,
-					uint32_t color) {
-	if(!map || x < 0 || y < 0 || z < 0 || x >= (int)map->width
-	   || y >= (int)map->height || z >= (int)map->depth)
-		return;
+size_t libvxl_mesh_update(struct libvxl_map* map, struct libvxl_mesh* meshes,
+						  size_t threads) {
+	if(!map || !meshes)
+		return 0;
 
-	libvxl_geometry_set(map, x, y, z, 1);
-	libvxl_map_set_internal(map, x, y, z, color);
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	struct libvxl_mesh_batch batch = {
+		.map = map,
+		.meshes = meshes,
+		.chunks = libvxl_mem_malloc(sx * sy * sizeof(size_t)),
+	};
 
-	if(!libvxl_map_onsurface(map, x, y + 1, z))
-		libvxl_map_setair_internal(map, x, y + 1, z);
-	if(!libvxl_map_onsurface(map, x, y - 1, z))
-		libvxl_map_setair_internal(map, x, y - 1, z);
+	size_t count = 0;
+	for(size_t k = 0; k < sx * sy; k++) {
+		if(!libvxl_mesh_outdated(map, meshes + k, k % sx, k / sx))
+			continue;
+		// workers must not decode lazily loaded chunks themselves
+		chunk_fposition(map, k % sx * LIBVXL_CHUNK_SIZE,
+						k / sx * LIBVXL_CHUNK_SIZE);
+		batch.chunks[count++] = k;
+	}
 
-	if(!libvxl_map_onsurface(map, x + 1, y, z))
-		libvxl_map_setair_internal(map, x + 1, y, z);
-	if(!libvxl_map_onsurface(map, x - 1, y, z))
-		libvxl_map_setair_internal(map, x - 1, y, z);
+	libvxl_parallel(threads, count, libvxl_mesh_one, &batch);
+	libvxl_mem_free(batch.chunks);
 
-	if(!libvxl_map_onsurface(map, x, y, z + 1))
-		libvxl_map_setair_internal(map, x, y, z + 1);
-	if(!libvxl_map_onsurface(map, x, y, z - 1))
-		libvxl_map_setair_internal(map, x, y, z - 1);
+	return count;
 }
 
-void libvxl_map_setair(struct libvxl_map* map, int x, int y, int z) {
-	if(!map || x < 0 || y < 0 || z < 0 || x >= (int)map->width
-	   || y >= (int)map->height || z >= (int)map->depth - 1)
+void libvxl_snapshot(struct libvxl_map* map, struct libvxl_map* snapshot) {
+	if(!map || !snapshot)
 		return;
 
-	bool surface_prev[6] = {
-		libvxl_map_issolid(map, x, y + 1, z) ?
-			libvxl_map_onsurface(map, x, y + 1, z) :
-			true,
-		libvxl_map_issolid(map, x, y - 1, z) ?
-			libvxl_map_onsurface(map, x, y - 1, z) :
-			true,
-		libvxl_map_issolid(map, x + 1, y, z) ?
-			libvxl_map_onsurface(map, x + 1, y, z) :
-			true,
-		libvxl_map_issolid(map, x - 1, y, z) ?
-			libvxl_map_onsurface(map, x - 1, y, z) :
-			true,
-		libvxl_map_issolid(map, x, y, z + 1) ?
-			libvxl_map_onsurface(map, x, y, z + 1) :
-			true,
-		libvxl_map_issolid(map, x, y, z - 1) ?
-			libvxl_map_onsurface(map, x, y, z - 1) :
-			true,
-	};
-
-	libvxl_map_setair_internal(map, x, y, z);
-	libvxl_geometry_set(map, x, y, z, 0);
-
-	if(!surface_prev[0] && libvxl_map_onsurface(map, x, y + 1, z))
-		libvxl_map_set_internal(map, x, y + 1, z, DEFAULT_COLOR(x, y + 1, z));
-	if(!surface_prev[1] && libvxl_map_onsurface(map, x, y - 1, z))
-		libvxl_map_set_internal(map, x, y - 1, z, DEFAULT_COLOR(x, y - 1, z));
-
-	if(!surface_prev[2] && libvxl_map_onsurface(map, x + 1, y, z))
-		libvxl_map_set_internal(map, x + 1, y, z, DEFAULT_COLOR(x + 1, y, z));
-	if(!surface_prev[3] && libvxl_map_onsurface(map, x - 1, y, z))
-		libvxl_map_set_internal(map, x - 1, y, z, DEFAULT_COLOR(x - 1, y, z));
+	size_t sx = (map->width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
+	size_t sy = (map->height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE;
 
-	if(!surface_prev[4] && libvxl_map_onsurface(map, x, y, z + 1))
-		libvxl_map_set_internal(map, x, y, z + 1, DEFAULT_COLOR(x, y, z + 1));
-	if(!surface_prev[5] && libvxl_map_onsurface(map, x, y, z - 1))
-		libvxl_map_set_internal(map, x, y, z - 1, DEFAULT_COLOR(x, y, z - 1));
+	snapshot->width = map->width;
+	snapshot->height = map->height;
+	snapshot->depth = map->depth;
+	snapshot->streamed = 0;
+	snapshot->lazy = NULL;
+	snapshot->sync = NULL;
+	snapshot->generation = map->generation;
+	snapshot->column_generation = NULL;
+	snapshot->chunk_generation = NULL;
+	snapshot->top_colors = NULL;
+	snapshot->top_heights = NULL;
+	snapshot->allocator = map->allocator;
+	snapshot->chunks
+		= libvxl_map_alloc(snapshot, sx * sy * sizeof(struct libvxl_chunk));
+
+	for(size_t k = 0; k < sx * sy; k++) {
+		// readers must never decode lazily themselves
+		if(map->lazy && !map->chunks[k].columns)
+			libvxl_chunk_decode(map, map->chunks + k);
+
+		snapshot->chunks[k] = map->chunks[k];
+		libvxl_shared_retain(map->chunks[k].columns);
+		if(map->chunks[k].regular)
+			libvxl_shared_retain(map->chunks[k].blocks);
+		libvxl_shared_retain(map->chunks[k].geometry);
+	}
 }
 
 void libvxl_copy_chunk_destroy(struct libvxl_chunk_copy* copy) {
 	if(!copy)
 		return;
 
-	libvxl_mem_free(copy->geometry);
-	libvxl_mem_free(copy->blocks_sorted);
+	libvxl_free(&copy->snapshot);
 }
 
 uint32_t libvxl_copy_chunk_get_color(struct libvxl_chunk_copy* copy, size_t x,
 									 size_t y, size_t z) {
-	if(!copy)
+	if(!copy || x >= copy->width || y >= copy->height || z >= copy->depth)
 		return 0;
 
-	struct libvxl_block* loc = bsearch(
-		&(struct libvxl_block) {
-			.position = pos_key(x, y, z),
-		},
-		copy->blocks_sorted, copy->blocks_sorted_count,
-		sizeof(struct libvxl_block), cmp);
+	// only blocks of the copied chunk are visible
+	if(chunk_fposition(&copy->snapshot, x, y) != copy->chunk)
+		return 0;
+
+	struct libvxl_block* loc = libvxl_chunk_find(copy->chunk, pos_key(x, y, z));
 	return loc ? (loc->color & 0xFFFFFF) : 0;
 }
 
@@ -778,9 +6526,7 @@ bool libvxl_copy_chunk_is_solid(struct libvxl_chunk_copy* copy, size_t x,
 	if(!copy || x >= copy->width || y >= copy->height || z >= copy->depth)
 		return true;
 
-	size_t offset = z + (x + y * copy->width) * copy->depth;
-	return copy->geometry[offset / (sizeof(size_t) * 8)]
-		& ((size_t)1 << (offset % (sizeof(size_t) * 8)));
+	return libvxl_geometry_get(&copy->snapshot, x, y, z);
 }
 
 void libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
@@ -788,18 +6534,9 @@ void libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
 	if(!map || !copy || x >= map->width || y >= map->height)
 		return;
 
-	size_t sg
-		= (map->width * map->height * map->depth + (sizeof(size_t) * 8 - 1))
-		/ (sizeof(size_t) * 8) * sizeof(size_t);
-	copy->geometry = libvxl_mem_malloc(sg);
-	memcpy(copy->geometry, map->geometry, sg);
+	libvxl_snapshot(map, &copy->snapshot);
 
-	struct libvxl_chunk* c = chunk_fposition(map, x, y);
-	copy->blocks_sorted
-		= libvxl_mem_malloc(c->index * sizeof(struct libvxl_block));
-	copy->blocks_sorted_count = c->index;
-	memcpy(copy->blocks_sorted, c->blocks,
-		   c->index * sizeof(struct libvxl_block));
+	copy->chunk = chunk_fposition(&copy->snapshot, x, y);
 
 	copy->width = map->width;
 	copy->height = map->height;
@@ -19,7 +19,6 @@
 #define LIBVXL_CHUNK_SIZE		16
 //! @brief How many blocks the buffer will grow once it is full
 #define LIBVXL_CHUNK_GROWTH		2
-#define LIBVXL_CHUNK_SHRINK		4
 
 #ifndef libvxl_mem_malloc
 #define libvxl_mem_malloc(sz) malloc(sz)
@@ -38,12 +37,39 @@
 //! @code{.c}
 //! 0xYYYXXXZZ
 //! @endcode
-//! This leaves 12 bits for X and Y and 8 bits for Z
-#define pos_key(x,y,z)			((uint32_t)(((y)<<20) | ((x)<<8) | (z)))
-#define key_discardz(key)		((uint32_t)((key)&0xFFFFFF00))
+//! This leaves 12 bits for X and Y and 8 bits for Z.
+//!
+//! Built with LIBVXL_WIDE_KEYS defined, e.g. by the CMake option of the same name, keys are 64 bits wide:
+//! @code{.c}
+//! 0xYYYYYYYYXXXXXXZZ
+//! @endcode
+//! This allows for much larger maps, up to LIBVXL_MAX_SIZE blocks along x and y, but every stored block then
+//! takes 16 instead of 8 bytes. Programs using libvxl.h have to be built with the same setting.
+#ifdef LIBVXL_WIDE_KEYS
+typedef uint64_t libvxl_key;
+#define pos_key(x,y,z)			((libvxl_key)(y)<<32 | (libvxl_key)(x)<<8 | (libvxl_key)(z))
+#define key_discardz(key)		((libvxl_key)((key)&~(libvxl_key)0xFF))
+#define key_getx(key)			(((key)>>8)&0xFFFFFF)
+#define key_gety(key)			(((key)>>32)&0xFFFFFFFF)
+#define key_getz(key)			((key)&0xFF)
+//! @brief Largest width and height of a map, limited by the 16 bit coordinates of libvxl_delta_column
+#define LIBVXL_MAX_SIZE			65536
+#else
+typedef uint32_t libvxl_key;
+#define pos_key(x,y,z)			((libvxl_key)(((y)<<20) | ((x)<<8) | (z)))
+#define key_discardz(key)		((libvxl_key)((key)&0xFFFFFF00))
 #define key_getx(key)			(((key)>>8)&0xFFF)
 #define key_gety(key)			(((key)>>20)&0xFFF)
 #define key_getz(key)			((key)&0xFF)
+//! @brief Largest width and height of a map, limited by the bits pos_key() has for them
+#define LIBVXL_MAX_SIZE			4096
+#endif
+
+//! @brief Largest depth of a map, spans of the vxl format store z in a single byte
+#define LIBVXL_MAX_DEPTH		256
+
+//! @brief Longest distance libvxl_raycast() walks, longer rays are cut off there
+#define LIBVXL_RAY_MAX_LENGTH	65536
 
 #ifdef _MSC_VER
 #define __attribute(x)
@@ -56,32 +82,187 @@ struct __attribute((packed)) libvxl_span {
 	uint8_t air_start;
 };
 
+struct __attribute((packed)) libvxl_delta_column {
+	uint16_t x, y;
+	uint32_t length;
+};
+
 struct libvxl_block {
-	uint32_t position;
+	libvxl_key position;
 	uint32_t color;
 };
 
+struct libvxl_column {
+	uint32_t start;
+	uint16_t count, capacity;
+};
+
 struct libvxl_chunk {
-	struct libvxl_block* blocks;
-	size_t length, index;
+	struct libvxl_column* columns; // slice of blocks of each column
+	struct libvxl_block* blocks;   // slices sorted by z, with gaps in between
+	size_t length, index;          // blocks allocated and used incl. gaps
+	size_t* geometry;
+	bool regular; // one block per column, columns is shared and blocks separate
+};
+
+struct libvxl_column_index;
+struct libvxl_sync;
+
+//! @brief Allocates the memory a map keeps, see libvxl_create_options
+//!
+//! Memory is always handed back with the size it was requested with.
+//! Temporary buffers used during a single call still come from libvxl_mem_malloc().
+struct libvxl_allocator {
+	//! @brief Returns at least *size* bytes aligned for any type, *ctx* is passed along unchanged
+	void* (*allocate)(void* ctx, size_t size);
+	//! @brief Releases memory returned by *allocate*, *size* is the one it was allocated with
+	void (*deallocate)(void* ctx, void* ptr, size_t size);
+	void* ctx;
 };
 
 struct libvxl_map {
 	size_t width, height, depth;
+	const struct libvxl_allocator* allocator;
 	struct libvxl_chunk* chunks;
-	size_t* geometry;
 	size_t streamed;
+	struct libvxl_column_index* lazy;
+	uint64_t generation;
+	uint64_t** column_generation; // per chunk, allocated on its first change
+	uint64_t* chunk_generation;
+	uint32_t* top_colors;
+	uint32_t* top_heights;
+	struct libvxl_sync* sync;
+};
+
+struct libvxl_edit_op {
+	libvxl_key position;
+	uint32_t color;
+	uint32_t sequence;
+	bool air;
+};
+
+struct libvxl_edit {
+	struct libvxl_map* map;
+	struct libvxl_edit_op* ops;
+	size_t length, index;
+};
+
+struct libvxl_run {
+	size_t x, y;
+	size_t z_start, z_end;
+};
+
+struct libvxl_floating_slot;
+
+struct libvxl_floating {
+	struct libvxl_run* runs;
+	size_t* components;
+	size_t count;
+	size_t runs_capacity, components_capacity;
+	struct libvxl_run* nodes;
+	size_t* nodes_next;
+	size_t nodes_length, nodes_capacity;
+	struct libvxl_floating_slot* slots;
+	size_t slots_capacity;
+	uint32_t stamp;
 };
 
+struct libvxl_ray {
+	float origin[3];
+	float direction[3];
+	float length;
+};
+
+struct libvxl_hit {
+	bool hit;
+	int x, y, z;
+	int normal[3];
+	uint32_t color;
+	float distance;
+};
+
+//! @brief Direction a face of a block points to, see libvxl_quad
+enum libvxl_face {
+	LIBVXL_FACE_NEG_X,
+	LIBVXL_FACE_POS_X,
+	LIBVXL_FACE_NEG_Y,
+	LIBVXL_FACE_POS_Y,
+	LIBVXL_FACE_NEG_Z, //!< facing the sky
+	LIBVXL_FACE_POS_Z,
+};
+
+//! @brief Rectangle of equal block faces made by libvxl_mesh_chunk()
+//!
+//! The quad covers blocks [x,y,z] up to *width* blocks along its first axis and *height* blocks along its second one.
+//! Faces along x span y and z, faces along y span x and z, faces along z span x and y, in this order.
+//! A face towards negative coordinates lies on the near side of its blocks, one towards positive coordinates on the far side.
+struct libvxl_quad {
+	uint16_t x, y, z;
+	uint16_t width, height;
+	uint8_t face; //!< one of libvxl_face
+	//! @brief Ambient occlusion of the corners, two bits each from *3* (lit) to *0* (dark)
+	//!
+	//! Corners are in the order [0,0], [1,0], [1,1], [0,1] along the two axes, starting at the lowest bits.
+	uint8_t ao;
+	uint32_t color;
+};
+
+//! @brief Quads of one chunk, zero-initialize before the first use
+struct libvxl_mesh {
+	struct libvxl_quad* quads;
+	size_t length, capacity;
+	uint64_t generation; //!< of the map when the mesh was built
+	bool built;
+};
+
+struct libvxl_deflate;
+
 struct libvxl_stream {
 	struct libvxl_map* map;
-	size_t* chunk_offsets;
+	struct libvxl_map snapshot; // what is streamed, see libvxl_snapshot()
+	uint64_t generation;
 	size_t chunk_size;
 	void* buffer;
 	size_t buffer_offset;
-	size_t pos;
+	size_t column; // next column to stream, x + y * width
+	struct libvxl_deflate* deflate; // NULL for uncompressed streams
+};
+
+struct libvxl_decoder {
+	struct libvxl_map* map;
+	size_t column; // next column to decode, x + y * width
+	uint8_t* carry; // start of a column that was cut off
+	size_t carry_length, carry_capacity;
+	size_t threads;
+	bool concurrent;
+	bool failed;
+};
+
+//! @brief Box of blocks [x,y,z] up to [x+width-1,y+height-1,z+depth-1] of a map
+struct libvxl_region {
+	size_t x, y, z;
+	size_t width, height, depth;
 };
 
+//! @brief Copy of the blocks of a region made by libvxl_region_extract(), to be pasted with libvxl_region_paste()
+//!
+//! Column [x,y] is stored at index *x * height + y*, like the column counts of a kv6 model.
+struct libvxl_prefab {
+	size_t width, height, depth;
+	size_t words; //!< 64 bit geometry words per column
+	//! @brief Bit *z % 64* of word *column * words + z / 64* is set if [x,y,z] is solid
+	uint64_t* geometry;
+	//! @brief Index of the first block of each column, followed by *length*
+	uint32_t* offsets;
+	//! @brief Colors of all blocks with a face towards air, positions are relative to the region
+	struct libvxl_block* blocks;
+	size_t length;
+};
+
+//! @brief Header of a model in kv6 format
+//!
+//! It is followed by *len* voxels of type libvxl_kv6_block, sorted by x, then y and then z, one 32 bit count of voxels
+//! per x and one 16 bit count of voxels per column, indexed by *x * height + y*.
 struct __attribute((packed)) libvxl_kv6 {
 	char magic[4];
 	int width, height, depth;
@@ -89,18 +270,19 @@ struct __attribute((packed)) libvxl_kv6 {
 	int len;
 };
 
+//! @brief Voxel of a kv6 model, which has at least one face exposed to air
 struct __attribute((packed)) libvxl_kv6_block {
 	int color;
 	short z;
+	//! @brief One bit per face towards air, from the lowest bit: -x, +x, -y, +y, -z (the top) and +z
 	unsigned char visfaces;
 	unsigned char normal;
 };
 
 struct libvxl_chunk_copy {
 	size_t width, height, depth;
-	size_t* geometry;
-	struct libvxl_block* blocks_sorted;
-	size_t blocks_sorted_count;
+	struct libvxl_map snapshot;
+	struct libvxl_chunk* chunk;
 };
 
 void libvxl_copy_chunk_destroy(struct libvxl_chunk_copy* copy);
@@ -122,27 +304,256 @@ void libvxl_copy_chunk(struct libvxl_map* map, struct libvxl_chunk_copy* copy,
 //! libvxl_create(&m,512,512,64,ptr);
 //! @endcode
 //! @param map Pointer to a struct of type libvxl_map that stores information about the loaded map
-//! @param w Width of map (x-coord)
-//! @param h Height of map (y-coord)
-//! @param d Depth of map (z-coord)
+//! @param w Width of map (x-coord), at most LIBVXL_MAX_SIZE
+//! @param h Height of map (y-coord), at most LIBVXL_MAX_SIZE
+//! @param d Depth of map (z-coord), at most LIBVXL_MAX_DEPTH
 //! @param data Pointer to valid map data, left unmodified also not freed
 //! @param len map data size in bytes
 //! @note Pass **NULL** as map data to create a new empty map, just water level will be filled with DEFAULT_COLOR
+//! @note Chunks which are solid from the same height down, like those of open water, share a single copy of their
+//! geometry and, with one block per column, their column table, see libvxl_map_compact()
 //! @returns 1 on success
 bool libvxl_create(struct libvxl_map* map, size_t w, size_t h, size_t d, const void* data, size_t len);
 
-//! @brief Write a map to disk, uses the libvxl_stream API internally
+//! @brief Optional settings for libvxl_create_ex()
+struct libvxl_create_options {
+	//! @brief Worker threads used to decode the map, *0* uses one per hardware thread
+	//! @note Decoding is split into bands of chunk rows, so more threads than chunk rows won't help
+	size_t threads;
+	//! @brief Only index the columns and decode chunks on first access
+	//!
+	//! The geometry is filled in right away, block colors of a chunk are decoded the first time it is accessed.
+	//! @note Map data must stay valid until libvxl_free() is called
+	//! @note Reading such a map from multiple threads is only safe after every chunk was accessed once
+	bool lazy;
+	//! @brief Keep color and height of the topmost block of every column in an array
+	//!
+	//! Every edit updates the entries of the columns it changes, libvxl_map_gettop() and
+	//! libvxl_map_overview() then only read from these arrays.
+	//! @note Uses 8 additional bytes per column
+	bool overview;
+	//! @brief Allocator for all memory the map keeps, **NULL** uses libvxl_mem_malloc()
+	//!
+	//! See libvxl_pool_create() for one which keeps freed memory for the next maps.
+	//! @note Must stay valid until the map and all of its snapshots were freed
+	const struct libvxl_allocator* allocator;
+	//! @brief Allow other threads to read the map while one thread modifies it
+	//!
+	//! libvxl_map_get(), libvxl_map_issolid(), libvxl_map_onsurface(), libvxl_map_getmask(), libvxl_map_gettop()
+	//! and the batched variants of these can then be called from any number of threads while libvxl_map_set(),
+	//! libvxl_map_setair(), libvxl_edit_commit() or libvxl_apply_delta() run on another one.
+	//! Every chunk has a version which the writer keeps odd while it changes the chunk, readers retry
+	//! until they saw the same even version before and after reading. Memory the writer replaces is
+	//! freed once no reader can still be using it.
+	//! @note Only one thread may modify the map at a time, readers of the chunks it changes wait for it to finish
+	//! @note At most 64 threads can read at the same time, further readers wait until one of them is done
+	//! @note All other functions must not run while the map is modified, take a libvxl_snapshot() for those
+	//! @note Implies that *lazy* is ignored
+	bool concurrent;
+};
+
+//! @brief Same as libvxl_create(), but with additional settings
+//!
+//! Example:
+//! @code{.c}
+//! struct libvxl_map m;
+//! libvxl_create_ex(&m,512,512,64,ptr,len,&(struct libvxl_create_options) {.threads = 0});
+//! @endcode
+//! @param options Pointer to settings, **NULL** behaves exactly like libvxl_create()
+//! @returns 1 on success
+bool libvxl_create_ex(struct libvxl_map* map, size_t w, size_t h, size_t d, const void* data, size_t len, const struct libvxl_create_options* options);
+
+//! @brief Error codes returned by the file functions
+enum libvxl_error {
+	LIBVXL_OK = 0,
+	//! @brief A required parameter was **NULL** or invalid
+	LIBVXL_ERROR_INVALID = -1,
+	//! @brief The file could not be opened
+	LIBVXL_ERROR_OPEN = -2,
+	//! @brief The file could not be read or mapped into memory
+	LIBVXL_ERROR_READ = -3,
+	//! @brief Not all bytes could be written
+	LIBVXL_ERROR_WRITE = -4,
+	//! @brief The file does not contain a valid map
+	LIBVXL_ERROR_FORMAT = -5,
+	//! @brief Out of memory
+	LIBVXL_ERROR_MEMORY = -6,
+};
+
+//! @brief Start building a map from pieces of map data as they arrive
+//!
+//! Each complete column is decoded into the map right away, only the start of a column that is cut off
+//! at the end of a piece is kept until the next one. The whole map data is never held at once.
+//!
+//! Example:
+//! @code{.c}
+//! struct libvxl_decoder dec;
+//! struct libvxl_map m;
+//! libvxl_decode_begin(&dec,&m,512,512,64,NULL);
+//! // for every packet received
+//! if(!libvxl_decode_feed(&dec,packet,len))
+//!     disconnect();
+//! // once the transfer is over
+//! if(!libvxl_decode_end(&dec))
+//!     return;
+//! @endcode
+//! @param decoder Decoder state, needs no cleanup besides libvxl_decode_end()
+//! @param map Map to decode into, must not be used before libvxl_decode_end() returned
+//! @param options Pointer to settings, can be **NULL**, *lazy* is ignored
+//! @note If the size is not allowed by libvxl_create(), every other call of the decoder fails
+void libvxl_decode_begin(struct libvxl_decoder* decoder, struct libvxl_map* map, size_t w, size_t h, size_t d, const struct libvxl_create_options* options);
+
+//! @brief Decode the next piece of map data, pieces can be split anywhere
+//! @returns *0* if the data is not a valid map, every later call fails as well
+bool libvxl_decode_feed(struct libvxl_decoder* decoder, const void* data, size_t len);
+
+//! @brief Finish the map once all data was fed
+//! @returns 1 if every column of the map was received, otherwise the map is left freed
+bool libvxl_decode_end(struct libvxl_decoder* decoder);
+
+//! @brief Load a map from disk
+//!
+//! The file is mapped into memory and passed to libvxl_create_ex() directly without copying it.
+//!
+//! Example:
+//! @code{.c}
+//! struct libvxl_map m;
+//! if(libvxl_readfile(&m,"map.vxl",512,512,64,NULL) != LIBVXL_OK)
+//!     return;
+//! @endcode
+//! @param map Pointer to a struct of type libvxl_map that stores information about the loaded map
+//! @param name Filename of input file
+//! @param w Width of map (x-coord)
+//! @param h Height of map (y-coord)
+//! @param d Depth of map (z-coord)
+//! @param options Pointer to settings, can be **NULL**
+//! @note If any of *w*, *h* or *d* is *0* the size is guessed with libvxl_size()
+//! @note For lazily loaded maps the file stays mapped until libvxl_free() is called
+//! @returns *LIBVXL_OK* on success, otherwise one of libvxl_error and *map* is left freed
+int libvxl_readfile(struct libvxl_map* map, const char* name, size_t w, size_t h, size_t d, const struct libvxl_create_options* options);
+
+//! @brief Write a map to disk, see libvxl_writefile_fd()
 //! @param map Map to be written
 //! @param name Filename of output file
-//! @returns total bytes written to disk
+//! @returns total bytes written to disk, *0* on failure
 size_t libvxl_writefile(struct libvxl_map* map, char* name);
 
+//! @brief Write a map to an open file descriptor
+//!
+//! Columns are encoded directly into a large aligned buffer which is written out with a single call each time it fills up.
+//! @param map Map to be written
+//! @param fd File descriptor opened for writing
+//! @param size pointer to an int, total bytes written, can be **NULL**
+//! @returns *LIBVXL_OK* on success, otherwise one of libvxl_error
+int libvxl_writefile_fd(struct libvxl_map* map, int fd, size_t* size);
+
 //! @brief Compress the map back to vxl format and save it in *out*, the total byte size will be written to *size*
 //! @param map Map to compress
 //! @param out pointer to memory where the vxl will be stored
 //! @param size pointer to an int, total byte size
 void libvxl_write(struct libvxl_map* map, void* out, size_t* size);
 
+//! @brief Same as libvxl_writefile(), but encodes the map on multiple threads
+//! @param map Map to be written
+//! @param name Filename of output file
+//! @param threads Worker threads to use, *0* uses one per hardware thread
+//! @returns total bytes written to disk, *0* on failure
+size_t libvxl_writefile_mt(struct libvxl_map* map, char* name, size_t threads);
+
+//! @brief Same as libvxl_write(), but encodes the map on multiple threads
+//!
+//! The map is split into bands of chunk rows which are encoded at the same time and joined in order afterwards.
+//! Output is byte-identical to libvxl_write().
+//! @param map Map to compress
+//! @param out pointer to memory where the vxl will be stored
+//! @param size pointer to an int, total byte size
+//! @param threads Worker threads to use, *0* uses one per hardware thread
+void libvxl_write_mt(struct libvxl_map* map, void* out, size_t* size, size_t threads);
+
+//! @brief Upper bound of the bytes libvxl_write_delta() needs for the same arguments
+//! @param map Map to use
+//! @param since Generation the receiver is at
+//! @returns buffer size in bytes
+size_t libvxl_delta_size(struct libvxl_map* map, uint64_t since);
+
+//! @brief Encode only the columns that changed after generation *since*
+//!
+//! Every change to the map increases map->generation and marks the columns it affected with it.
+//! The first change to a chunk allocates 8 bytes for each of its columns to keep track of them, chunks that
+//! never change cost nothing beyond their own generation.
+//! Each changed column is written as a libvxl_delta_column header followed by its spans in vxl format.
+//! @code{.c}
+//! uint64_t since = client->generation;
+//! void* out = malloc(libvxl_delta_size(&m,since));
+//! size_t size;
+//! libvxl_write_delta(&m,since,out,&size);
+//! client->generation = m.generation;
+//! @endcode
+//! @param map Map to compress
+//! @param since Generation the receiver is at, *0* for every column changed since loading
+//! @param out pointer to memory where the delta will be stored, see libvxl_delta_size()
+//! @param size pointer to an int, total byte size
+void libvxl_write_delta(struct libvxl_map* map, uint64_t since, void* out, size_t* size);
+
+//! @brief Replace the columns contained in a delta made by libvxl_write_delta()
+//! @param map Map to update, must be of the same size as the map the delta was made from
+//! @param data Pointer to the delta
+//! @param len Byte size of the delta
+//! @returns *false* if the delta is malformed, the map is left unmodified in that case
+bool libvxl_apply_delta(struct libvxl_map* map, const void* data, size_t len);
+
+//! @brief Exact byte size of the model libvxl_kv6_write() makes for the same arguments
+//! @param map Map to use
+//! @param region Blocks to export, **NULL** for the whole map
+//! @returns buffer size in bytes, *0* if the region is empty or does not fit into the map
+size_t libvxl_kv6_size(struct libvxl_map* map, const struct libvxl_region* region);
+
+//! @brief Export a region of a map as a model in kv6 format
+//!
+//! Only blocks with a face towards air are stored, everything outside of the region counts as air.
+//! Blocks exposed by the cut get their color if the map has one for them and DEFAULT_COLOR otherwise.
+//! Visible faces are found for whole columns at once from shifted geometry words.
+//! @code{.c}
+//! struct libvxl_region r = {.x = 64, .y = 64, .z = 0, .width = 32, .height = 32, .depth = 64};
+//! void* out = malloc(libvxl_kv6_size(&m,&r));
+//! size_t size;
+//! libvxl_kv6_write(&m,&r,out,&size);
+//! @endcode
+//! @param map Map to export
+//! @param region Blocks to export, **NULL** for the whole map, the model's [0,0,0] is the region's [x,y,z]
+//! @param out pointer to memory where the model will be stored, see libvxl_kv6_size()
+//! @param size pointer to an int, total byte size, *0* if the region is invalid
+void libvxl_kv6_write(struct libvxl_map* map, const struct libvxl_region* region, void* out, size_t* size);
+
+//! @brief Export a region of a map to disk, see libvxl_kv6_write()
+//!
+//! The model is built in memory and written with a single call.
+//! @param map Map to export
+//! @param region Blocks to export, **NULL** for the whole map
+//! @param name Filename of output file
+//! @returns *LIBVXL_OK* on success, otherwise one of libvxl_error
+int libvxl_kv6_writefile(struct libvxl_map* map, const struct libvxl_region* region, const char* name);
+
+//! @brief Create a map of the size of a model in kv6 format
+//!
+//! A voxel is solid down to the next voxel of its column, unless its bottom face is visible.
+//! Like in every map the bottom layer is solid even where the model has no voxels.
+//! Its color is kept if it ends up on the surface of the map, other surface blocks get DEFAULT_COLOR.
+//! @param map Pointer to a struct of type libvxl_map that stores information about the loaded map
+//! @param data Pointer to the model, left unmodified also not freed
+//! @param len model size in bytes
+//! @param options Pointer to settings, can be **NULL**, *lazy* is ignored
+//! @returns *false* if the model is malformed or bigger than LIBVXL_MAX_SIZE x LIBVXL_MAX_SIZE x LIBVXL_MAX_DEPTH,
+//! nothing is allocated in that case
+bool libvxl_kv6_create(struct libvxl_map* map, const void* data, size_t len, const struct libvxl_create_options* options);
+
+//! @brief Load a model in kv6 format from disk, see libvxl_kv6_create()
+//! @param map Pointer to a struct of type libvxl_map that stores information about the loaded map
+//! @param name Filename of input file
+//! @param options Pointer to settings, can be **NULL**
+//! @returns *LIBVXL_OK* on success, otherwise one of libvxl_error
+int libvxl_kv6_readfile(struct libvxl_map* map, const char* name, const struct libvxl_create_options* options);
+
 //! @brief Tells if a block is solid at location [x,y,z]
 //! @param map Map to use
 //! @param x x-coordinate of block
@@ -160,6 +571,41 @@ bool libvxl_map_issolid(struct libvxl_map* map, int x, int y, int z);
 //! @returns on surface=1
 bool libvxl_map_onsurface(struct libvxl_map* map, int x, int y, int z);
 
+//! @brief Read which blocks of a column are solid as a bit mask
+//! @param map Map to use, must not be deeper than 64 blocks
+//! @param x x-coordinate of block column
+//! @param y y-coordinate of block column
+//! @returns mask with *bit z* set if [x,y,z] is solid, on error *0*
+//! @note Coordinates wrap around at the map borders, like for libvxl_map_issolid()
+uint64_t libvxl_map_getmask(struct libvxl_map* map, int x, int y);
+
+//! @brief Same as libvxl_map_getmask(), but for count columns along the x-axis starting at [x,y]
+//! @param masks pointer to *uint64_t[count]*, is filled with one mask per column
+void libvxl_map_getmasks(struct libvxl_map* map, int x, int y, size_t count, uint64_t* masks);
+
+//! @brief Read which blocks of count columns along the x-axis starting at [x,y] are on the surface
+//!
+//! Is equal to calling libvxl_map_issolid() and libvxl_map_onsurface() on every block,
+//! but works on whole columns and uses SSE2 or AVX2 if the compiler targets it.
+//! A default build on x86-64 uses SSE2, configure with *-DLIBVXL_AVX2=ON* (or compile with *-mavx2*) for AVX2.
+//!
+//! @param map Map to use, must not be deeper than 64 blocks
+//! @param x x-coordinate of first block column
+//! @param y y-coordinate of block columns
+//! @param count Number of columns
+//! @param masks pointer to *uint64_t[count]*, *bit z* is set if the block is solid and on the surface
+//! @note Define *LIBVXL_NO_SIMD* to only use the portable version
+void libvxl_map_surfacemasks(struct libvxl_map* map, int x, int y, size_t count, uint64_t* masks);
+
+//! @brief Read height of topmost block of count columns along the x-axis starting at [x,y]
+//! @param map Map to use
+//! @param x x-coordinate of first block column
+//! @param y y-coordinate of block columns
+//! @param count Number of columns
+//! @param heights pointer to *uint32_t[count]*, is filled with the z of each topmost block
+//! @note Unlike libvxl_map_gettop() this only reads the geometry, a whole word at a time
+void libvxl_map_gettops(struct libvxl_map* map, int x, int y, size_t count, uint32_t* heights);
+
 //! @brief Read block color
 //! @param map Map to use
 //! @param x x-coordinate of block
@@ -168,6 +614,23 @@ bool libvxl_map_onsurface(struct libvxl_map* map, int x, int y, int z);
 //! @returns color of block at location [x,y,z] in format *0xAARRGGBB*, on error *0*
 uint32_t libvxl_map_get(struct libvxl_map* map, int x, int y, int z);
 
+//! @brief Same as libvxl_map_get() for many blocks at once
+//!
+//! Large batches are grouped by chunk first, so the blocks of each chunk are only brought into
+//! the cache once instead of for every query.
+//! @param map Map to use
+//! @param positions Array of count [x,y,z] triples
+//! @param count Number of positions
+//! @param colors pointer to *uint32_t[count]*, is filled with the color of each block
+void libvxl_map_get_many(struct libvxl_map* map, const int* positions, size_t count, uint32_t* colors);
+
+//! @brief Same as libvxl_map_issolid() for many blocks at once
+//! @param map Map to use
+//! @param positions Array of count [x,y,z] triples
+//! @param count Number of positions
+//! @param solid pointer to *bool[count]*, is filled with whether each block is solid
+void libvxl_map_issolid_many(struct libvxl_map* map, const int* positions, size_t count, bool* solid);
+
 //! @brief Read color of topmost block (as seen from above at Z=0)
 //!
 //! See libvxl_map_get() for to be expected color format
@@ -187,6 +650,26 @@ uint32_t libvxl_map_get(struct libvxl_map* map, int x, int y, int z);
 //! @returns *nothing, see result param*
 void libvxl_map_gettop(struct libvxl_map* map, int x, int y, uint32_t* result);
 
+//! @brief Read color and height of the topmost block of every column in a rectangle
+//!
+//! Same as calling libvxl_map_gettop() for every column, but in a single pass over the map.
+//! This is fastest if the map was created with the *overview* option of libvxl_create_ex().
+//!
+//! Example:
+//! @code{.c}
+//! uint32_t image[512 * 512];
+//! libvxl_map_overview(&m,0,0,512,512,image,NULL);
+//! @endcode
+//! @param map Map to use
+//! @param x x-coordinate of the first column
+//! @param y y-coordinate of the first column
+//! @param width Number of columns along the x-axis
+//! @param height Number of columns along the y-axis
+//! @param colors pointer to *uint32_t[width * height]* filled row by row, can be **NULL**
+//! @param heights pointer to *uint32_t[width * height]* filled row by row, can be **NULL**
+//! @note Nothing is written if the rectangle is not fully inside of the map
+void libvxl_map_overview(struct libvxl_map* map, size_t x, size_t y, size_t width, size_t height, uint32_t* colors, uint32_t* heights);
+
 //! @brief Set block at location [x,y,z] to a new color
 //!
 //! See libvxl_map_get() for expected color format, alpha component can be discarded
@@ -206,10 +689,348 @@ void libvxl_map_set(struct libvxl_map* map, int x, int y, int z, uint32_t color)
 //! @param z z-coordinate of block
 void libvxl_map_setair(struct libvxl_map* map, int x, int y, int z);
 
+//! @brief Start a batch of edits
+//!
+//! Edits are only queued and applied all at once by libvxl_edit_commit(): first all geometry changes,
+//! then the surface colors of every touched column are recomputed and merged into each chunk in one pass.
+//! This is a lot faster than many single libvxl_map_set() or libvxl_map_setair() calls.
+//!
+//! Example:
+//! @code{.c}
+//! struct libvxl_edit e;
+//! libvxl_edit_begin(&e,&m);
+//! libvxl_edit_setair(&e,x,y,z);
+//! libvxl_edit_set(&e,x,y,z+1,0xFF0000);
+//! libvxl_edit_commit(&e);
+//! @endcode
+//! @param edit Pointer to a struct of type libvxl_edit
+//! @param map Map to edit
+//! @note The map does not reflect queued edits before they are committed
+void libvxl_edit_begin(struct libvxl_edit* edit, struct libvxl_map* map);
+
+//! @brief Queue setting the block at location [x,y,z] to a new color, see libvxl_map_set()
+//! @note A block placed by the batch keeps this color even if it was covered and uncovered again within the same batch
+void libvxl_edit_set(struct libvxl_edit* edit, int x, int y, int z, uint32_t color);
+
+//! @brief Queue setting location [x,y,z] to air, see libvxl_map_setair()
+void libvxl_edit_setair(struct libvxl_edit* edit, int x, int y, int z);
+
+//! @brief Apply all queued edits to the map and free the batch
+//! @param edit Batch to apply, libvxl_edit_begin() must be called again to reuse it
+void libvxl_edit_commit(struct libvxl_edit* edit);
+
+//! @brief Copy the blocks of a region of a map
+//!
+//! Stores the geometry of the region and the colors of all of its blocks which have a face towards air,
+//! everything outside of the region counting as air. These are all blocks that can end up visible once pasted.
+//! @param map Map to copy from
+//! @param region Blocks to copy, **NULL** for the whole map
+//! @param prefab Pointer to a struct of type libvxl_prefab receiving the copy, free it with libvxl_prefab_free()
+//! @returns *false* if the region is empty or does not fit into the map, nothing is allocated in that case
+bool libvxl_region_extract(struct libvxl_map* map, const struct libvxl_region* region, struct libvxl_prefab* prefab);
+
+//! @brief Paste blocks copied by libvxl_region_extract() into a map with the prefab's [0,0,0] at [x,y,z]
+//!
+//! Works on whole geometry words of each column: they are merged with the prefab's and the colors of each
+//! touched column are rebuilt in a single pass, including the columns right around the pasted ones.
+//! Blocks of the prefab keep their colors, blocks of the map exposed by the paste keep theirs or get DEFAULT_COLOR.
+//! Example:
+//! @code{.c}
+//! struct libvxl_prefab p;
+//! struct libvxl_region r = {.x = 100, .y = 100, .z = 20, .width = 16, .height = 16, .depth = 44};
+//! if(libvxl_region_extract(&a,&r,&p)) {
+//!     libvxl_region_paste(&b,&p,200,300,20,true);
+//!     libvxl_prefab_free(&p);
+//! }
+//! @endcode
+//! @param map Map to paste into
+//! @param prefab Blocks to paste, the parts outside of the map are left out
+//! @param x X-coord the prefab's [0,0,0] ends up at, can be negative
+//! @param y Y-coord the prefab's [0,0,0] ends up at, can be negative
+//! @param z Z-coord the prefab's [0,0,0] ends up at, can be negative
+//! @param replace *true* to also carve the prefab's air into the map, *false* to only add its solid blocks
+//! @note The bottom layer of the map stays solid
+//! @returns *false* if no part of the prefab lies inside of the map
+bool libvxl_region_paste(struct libvxl_map* map, const struct libvxl_prefab* prefab, int x, int y, int z, bool replace);
+
+//! @brief Free the memory of a prefab
+void libvxl_prefab_free(struct libvxl_prefab* prefab);
+
+//! @brief Fill the box spanned by two corners with solid blocks of one color or carve it out of the map
+//!
+//! Like all shape operations this sets whole spans of blocks per column at once and rebuilds the colors of each
+//! touched column in a single pass afterwards, instead of doing all the work of libvxl_map_set() for every block.
+//! Solid blocks inside of the shape take the new color, blocks of the map exposed by carving keep theirs or
+//! get DEFAULT_COLOR. Parts of the shape outside of the map are left out, the bottom layer is never carved.
+//! Example:
+//! @code{.c}
+//! struct libvxl_region r;
+//! if(libvxl_map_sphere(&m,x,y,z,10.0F,false,0,&r))
+//!     invalidate_cache(r.x,r.y,r.z,r.width,r.height,r.depth);
+//! @endcode
+//! @param map Map to change
+//! @param x1 X-coord of one corner
+//! @param y1 Y-coord of one corner
+//! @param z1 Z-coord of one corner
+//! @param x2 X-coord of the opposite corner, included in the box
+//! @param y2 Y-coord of the opposite corner, included in the box
+//! @param z2 Z-coord of the opposite corner, included in the box
+//! @param solid *true* to fill the shape, *false* to carve it out
+//! @param color Color of the filled blocks
+//! @param affected Pointer to a struct of type libvxl_region receiving the bounds of the blocks inside of the
+//! shape and the map, can be **NULL**. Blocks right next to these may have changed their color too.
+//! @returns *false* if the shape does not cover any block of the map
+bool libvxl_map_box(struct libvxl_map* map, int x1, int y1, int z1, int x2, int y2, int z2, bool solid, uint32_t color, struct libvxl_region* affected);
+
+//! @brief Fill or carve out all blocks whose center is at most radius away from the center of [x,y,z]
+//!
+//! See libvxl_map_box() for how the map is changed.
+//! @param radius Radius of the sphere, 0 to 65536
+//! @returns *false* if the shape does not cover any block of the map or radius is out of range
+bool libvxl_map_sphere(struct libvxl_map* map, int x, int y, int z, float radius, bool solid, uint32_t color, struct libvxl_region* affected);
+
+//! @brief Fill or carve out a cylinder whose axis starts at [x,y,z] and runs length blocks towards direction
+//!
+//! Blocks are inside if their center is at most radius away from the axis, see libvxl_map_box() for how the map
+//! is changed. Digging a tunnel into a wall is a cylinder pointing away from the face that was hit.
+//! @param radius Radius of the cylinder, 0 to 65536
+//! @param length Number of blocks along the axis, including [x,y,z]
+//! @param direction Direction the axis points to
+//! @returns *false* if the shape does not cover any block of the map or radius or length are out of range
+bool libvxl_map_cylinder(struct libvxl_map* map, int x, int y, int z, float radius, int length, enum libvxl_face direction, bool solid, uint32_t color, struct libvxl_region* affected);
+
+//! @brief Prepare a struct of type libvxl_floating for use with libvxl_map_floating()
+void libvxl_floating_init(struct libvxl_floating* floating);
+
+//! @brief Free all results and scratch memory held by a struct of type libvxl_floating
+void libvxl_floating_free(struct libvxl_floating* floating);
+
+//! @brief Find the blocks that got disconnected from the bottom layer by removing blocks
+//!
+//! Only the components touching one of the given positions are checked, traversing solid
+//! runs of the geometry column by column. Any memory needed is kept in floating and reused
+//! by the next call, so once warmed up no allocations are done.
+//!
+//! Component k consists of the runs floating->runs[floating->components[k]] up to (excluding)
+//! floating->runs[floating->components[k + 1]], each covering the blocks from z_start up to
+//! (excluding) z_end in its column. The results stay valid until the next call.
+//! @code{.c}
+//! struct libvxl_floating f;
+//! libvxl_floating_init(&f);
+//! libvxl_map_setair(&m,x,y,z);
+//! size_t count = libvxl_map_floating(&m,&f,(int[]) {x,y,z},1,4096);
+//! @endcode
+//! @param map Map to use
+//! @param floating Pointer to a struct of type libvxl_floating receiving the components
+//! @param positions Array of count [x,y,z] triples of blocks that were just set to air
+//! @param count Number of positions
+//! @param limit Components larger than this many blocks are considered grounded, *0* for no limit
+//! @returns number of floating components found
+size_t libvxl_map_floating(struct libvxl_map* map, struct libvxl_floating* floating, const int* positions, size_t count, size_t limit);
+
+//! @brief Find the first solid block along a ray
+//!
+//! The ray walks column by column and checks the part of it inside a column against the geometry
+//! all at once, so long stretches of air cost no more than a single step.
+//! Like libvxl_map_issolid(), the map wraps around in x and y, everything above it is air and
+//! everything below it is solid. A ray stops as soon as it is above the map and not going down, and walks
+//! at most LIBVXL_RAY_MAX_LENGTH blocks, so rays of any length take bounded time.
+//!
+//! Example:
+//! @code{.c}
+//! struct libvxl_hit hit;
+//! if(libvxl_raycast(&m,&(struct libvxl_ray) {{256.5F,256.5F,10.5F},{1,0,0.5F},128},&hit))
+//! 	libvxl_map_setair(&m,hit.x,hit.y,hit.z);
+//! @endcode
+//! @param map Map to use
+//! @param ray Ray starting at origin (in block units, block [x,y,z] spans up to [x+1,y+1,z+1]), its direction does not need to be normalized, length is the maximum distance, at most LIBVXL_RAY_MAX_LENGTH
+//! @param hit Pointer to a struct of type libvxl_hit, is filled with the position and color of the block, the normal of the face that was hit and the distance to it
+//! @returns *true* if a block was hit
+//! @note The normal is [0,0,0] if the ray starts inside of a solid block, x and y of the hit always lie inside of the map
+bool libvxl_raycast(struct libvxl_map* map, const struct libvxl_ray* ray, struct libvxl_hit* hit);
+
+//! @brief Same as libvxl_raycast() for many rays at once
+//! @param map Map to use
+//! @param rays Array of count rays
+//! @param count Number of rays
+//! @param hits Array of count results, hit tells whether the ray hit something
+//! @param threads Worker threads to use, *0* uses one per hardware thread
+//! @returns number of rays that hit a block
+//! @note With more than one thread all chunks of a lazily loaded map are decoded first
+size_t libvxl_raycast_many(struct libvxl_map* map, const struct libvxl_ray* rays, size_t count, struct libvxl_hit* hits, size_t threads);
+
+//! @brief Build the visible faces of the chunk containing column [x,y]
+//!
+//! The chunk and the columns around it are copied into a dense buffer once, then every slice of faces is merged
+//! into quads greedily. Only faces of solid blocks next to air are kept, quads only merge faces of the same color and
+//! ambient occlusion. Like libvxl_map_issolid(), the map wraps around in x and y, everything above it is air and
+//! everything below it is solid.
+//! @param map Map to use
+//! @param x x-coordinate of any column of the chunk
+//! @param y y-coordinate of any column of the chunk
+//! @param mesh Mesh that is replaced, its memory is reused
+//! @note Can run on many threads at once as long as the map is not modified, lazily loaded chunks are decoded first
+//! @note Quads never reach past the chunk, each one only holds faces whose four corners have the same ambient occlusion
+//! @note To shade quads evenly, split them along the diagonal between corners [1,0] and [0,1] if *ao* of [0,0] and [1,1] sums to less than theirs
+void libvxl_mesh_chunk(struct libvxl_map* map, size_t x, size_t y, struct libvxl_mesh* mesh);
+
+//! @brief Rebuild the meshes of all chunks that changed since they were last built
+//!
+//! Example:
+//! @code{.c}
+//! size_t chunks = ((m.width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE) * ((m.height + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE);
+//! struct libvxl_mesh* meshes = calloc(chunks,sizeof(struct libvxl_mesh));
+//! // every frame
+//! if(libvxl_mesh_update(&m,meshes,0))
+//!     upload_changed(meshes);
+//! @endcode
+//! @param map Map to use
+//! @param meshes One mesh per chunk, chunk [cx,cy] is at index *cx + cy * ((width + LIBVXL_CHUNK_SIZE - 1) / LIBVXL_CHUNK_SIZE)*
+//! @param threads Worker threads to use, *0* uses one per hardware thread
+//! @returns number of meshes that were rebuilt
+//! @note A mesh is rebuilt when its chunk or a chunk next to it changed, as they share faces and ambient occlusion
+//! @note Snapshots do not track changes, only meshes that were never built are built for them
+size_t libvxl_mesh_update(struct libvxl_map* map, struct libvxl_mesh* meshes, size_t threads);
+
+//! @brief Free the quads of a mesh, it can be built again afterwards
+void libvxl_mesh_free(struct libvxl_mesh* mesh);
+
 //! @brief Free a map from memory
 //! @param map Map to free
 void libvxl_free(struct libvxl_map* map);
 
+//! @brief Take a read-only snapshot of a map
+//!
+//! The snapshot shares geometry and blocks with the map chunk by chunk, a chunk is only copied once the map modifies it.
+//! It can be read from another thread while the map keeps being modified, using the same functions as for any map.
+//! @code{.c}
+//! struct libvxl_map snapshot;
+//! libvxl_snapshot(&m,&snapshot);
+//! // hand snapshot to a worker thread, which calls libvxl_free(&snapshot) when done
+//! @endcode
+//! @param map Map to take the snapshot of, only from the thread that modifies it
+//! @param snapshot Pointer to a struct of type libvxl_map receiving the snapshot, free it with libvxl_free()
+//! @note For lazily loaded maps all remaining chunks are decoded first
+//! @note Snapshots do not track changes, libvxl_write_delta() does nothing on them
+void libvxl_snapshot(struct libvxl_map* map, struct libvxl_map* snapshot);
+
+//! @brief Number of buckets of the chunk fill histogram of libvxl_stats
+#define LIBVXL_STATS_FILL 10
+
+//! @brief Memory used by a map, filled by libvxl_map_stats()
+//! @note Byte counts do not include the map struct itself and count storage shared with snapshots for each of them
+struct libvxl_stats {
+	//! @brief Number of chunks the map is split into
+	size_t chunks;
+	//! @brief Chunks whose blocks are in memory, less than *chunks* for lazily loaded maps
+	size_t chunks_decoded;
+	//! @brief Decoded chunks with exactly one block per column, these share one column table and have no gaps
+	size_t regular_chunks;
+	//! @brief Number of blocks stored, these are the blocks on the surface
+	size_t blocks;
+	//! @brief Bytes used by stored blocks
+	size_t block_bytes;
+	//! @brief Bytes allocated for blocks, but not in use, in the gaps between column slices and after the last one
+	size_t slack_bytes;
+	//! @brief Bytes of the per chunk column tables and allocation headers
+	size_t column_bytes;
+	//! @brief Pages of solid bits in use, chunks that are solid from the same height down share one
+	size_t geometry_pages;
+	//! @brief Bytes of the solid bits of all chunks
+	size_t geometry_bytes;
+	//! @brief Bytes of change tracking, the overview cache and the column index of lazily loaded maps
+	size_t index_bytes;
+	//! @brief Sum of all of the above and of the chunk array
+	size_t total_bytes;
+	//! @brief Chunk fill histogram, *fill[k]* counts the decoded chunks which use between
+	//! k/LIBVXL_STATS_FILL and (k+1)/LIBVXL_STATS_FILL of the blocks they allocated, full ones are in the last bucket
+	size_t fill[LIBVXL_STATS_FILL];
+};
+
+//! @brief Report how much memory a map uses and where it goes
+//!
+//! Example:
+//! @code{.c}
+//! struct libvxl_stats stats;
+//! libvxl_map_stats(&m,&stats);
+//! printf("%zu bytes, %zu of them unused\n",stats.total_bytes,stats.slack_bytes);
+//! @endcode
+//! @param map Map to inspect
+//! @param stats Pointer to a struct of type libvxl_stats receiving the result
+//! @note Chunks of lazily loaded maps are not decoded by this
+void libvxl_map_stats(struct libvxl_map* map, struct libvxl_stats* stats);
+
+//! @brief Let all chunks which are solid from the same height down share their geometry again
+//!
+//! Maps do this on their own right after loading, so large maps that are mostly air or flat ground only keep
+//! the solid bits of the chunks with anything on them. Those with exactly one block per column also drop their
+//! column table and free space, which is what an empty map is made of. A chunk gets its own copy again once it
+//! is changed, call this after e.g. resetting parts of a map to flat ground.
+//! @note Chunks of concurrent maps keep their column tables
+//! @param map Map to compact
+//! @returns number of chunks that are solid from the same height down
+size_t libvxl_map_compact(struct libvxl_map* map);
+
+//! @brief Counts of internal operations, filled by libvxl_counters()
+struct libvxl_counters {
+	//! @brief Chunk storage that was allocated anew because a column slice could not grow
+	uint64_t reallocs;
+	//! @brief Column slices that were moved to free space at the end of their chunk's storage
+	uint64_t relocations;
+	//! @brief Bytes moved or copied to make room for blocks or to close the gap of a removed one
+	uint64_t moved_bytes;
+	//! @brief Binary searches for a block in its column
+	uint64_t searches;
+	//! @brief Total steps taken by these searches, the average depth is *search_steps / searches*
+	uint64_t search_steps;
+	//! @brief Bytes encoded to vxl format by the write, stream and delta functions
+	uint64_t encoded_bytes;
+	//! @brief Nanoseconds spent in these functions, *encoded_bytes * 1e9 / encode_ns* gives bytes per second
+	//! @note For libvxl_writefile() and libvxl_writefile_fd() this includes writing to disk
+	uint64_t encode_ns;
+};
+
+//! @brief Read and optionally reset the counters of internal operations
+//!
+//! The counters are only updated if libvxl was compiled with *LIBVXL_COUNTERS* defined, they are shared by every map and thread.
+//! @param counters Pointer to a struct of type libvxl_counters receiving the current counts, can be **NULL**
+//! @param reset Set all counters to *0* after reading them
+//! @returns *false* if libvxl was compiled without counters, *counters* is zeroed in that case
+bool libvxl_counters(struct libvxl_counters* counters, bool reset);
+
+//! @brief Pool of memory, sorted into size classes, which can be shared by many maps
+struct libvxl_pool;
+
+//! @brief Create a pool allocator
+//!
+//! Memory is taken from the heap in large slabs and split into blocks of a few fixed sizes.
+//! Freed blocks are kept for the next allocation of their size class instead of being returned to the heap,
+//! so loading and freeing maps over and over does not fragment the heap.
+//! It is safe to use from multiple threads.
+//! @code{.c}
+//! struct libvxl_pool* pool = libvxl_pool_create();
+//! struct libvxl_create_options options = {.threads = 1, .allocator = libvxl_pool_allocator(pool)};
+//! libvxl_create_ex(&m,512,512,64,ptr,len,&options);
+//! // ... libvxl_free(&m), load the next map with the same options
+//! libvxl_pool_destroy(pool);
+//! @endcode
+//! @returns the new pool, **NULL** if out of memory
+struct libvxl_pool* libvxl_pool_create(void);
+
+//! @brief Free a pool and all memory it holds
+//! @param pool Pool to free, every map using it must have been freed before
+void libvxl_pool_destroy(struct libvxl_pool* pool);
+
+//! @brief The allocator to pass to libvxl_create_ex() to use a pool
+//! @param pool Pool to use
+//! @returns pointer to the allocator, valid until the pool is destroyed
+const struct libvxl_allocator* libvxl_pool_allocator(struct libvxl_pool* pool);
+
+//! @brief Bytes a pool took from the heap, in use or not
+//! @param pool Pool to inspect
+//! @returns byte count
+size_t libvxl_pool_reserved(struct libvxl_pool* pool);
+
 //! @brief Tries to guess the size of a map
 //! @note This won't always give accurate results for a map's height
 //! @note It is assumed the map is square.
@@ -220,11 +1041,30 @@ void libvxl_free(struct libvxl_map* map);
 bool libvxl_size(size_t* size, size_t* depth, const void* data, size_t len);
 
 //! @brief Start streaming a map
+//!
+//! The stream encodes the map as it is right now, the map can keep being edited while the stream is read.
+//! It holds a libvxl_snapshot() of the map, so only chunks edited before the stream passed them are copied
+//! and rows of chunks are let go as soon as they were encoded.
+//! Send libvxl_write_delta() of stream->generation afterwards to bring the receiver up to date:
+//! @code{.c}
+//! struct libvxl_stream s;
+//! libvxl_stream(&s,&m,8192);
+//! // ... libvxl_stream_read(&s,buffer) while the game goes on
+//! client->generation = s.generation;
+//! libvxl_stream_free(&s);
+//! @endcode
 //! @param stream Pointer to a struct of type libvxl_stream
-//! @param map Map to stream
+//! @param map Map to stream, only from the thread that modifies it
 //! @param chunk_size size in bytes each call to libvxl_stream_read() will encode at most
 void libvxl_stream(struct libvxl_stream* stream, struct libvxl_map* map, size_t chunk_size);
 
+//! @brief Same as libvxl_stream(), but the stream is compressed in zlib format
+//!
+//! Every packet read is chunk_size bytes long except for the last one, so they can be sent as they are.
+//! Any zlib implementation can decompress the stream, as can libvxl_inflate_feed().
+//! @note The encoder favours speed, it only finds short matches and uses the fixed huffman codes of deflate
+void libvxl_stream_deflate(struct libvxl_stream* stream, struct libvxl_map* map, size_t chunk_size);
+
 //! @brief Free a stream from memory
 //! @param map stream to free
 void libvxl_stream_free(struct libvxl_stream* stream);
@@ -244,4 +1084,55 @@ size_t libvxl_stream_read(struct libvxl_stream* stream, void* out);
 //! @param z z-coordinate of block
 bool libvxl_map_isinside(struct libvxl_map* map, int x, int y, int z);
 
+struct libvxl_inflate;
+
+//! @brief Start decompressing a zlib stream, e.g. one made by libvxl_stream_deflate()
+//!
+//! Example:
+//! @code{.c}
+//! struct libvxl_inflate* z = libvxl_inflate_create();
+//! // for every packet received
+//! if(!libvxl_inflate_feed(z,packet,len))
+//!     disconnect();
+//! // once the transfer is over
+//! size_t size;
+//! const void* data = libvxl_inflate_data(z,&size);
+//! if(libvxl_inflate_done(z))
+//!     libvxl_create(&m,512,512,64,data,size);
+//! libvxl_inflate_destroy(z);
+//! @endcode
+//! The output can also be passed on to a libvxl_decoder as it grows:
+//! @code{.c}
+//! // for every packet received
+//! if(!libvxl_inflate_feed(z,packet,len))
+//!     disconnect();
+//! size_t size;
+//! const void* data = libvxl_inflate_data(z,&size);
+//! if(!libvxl_decode_feed(&dec,data,size))
+//!     disconnect();
+//! libvxl_inflate_consume(z,size);
+//! @endcode
+//! @returns a decompressor, free it with libvxl_inflate_destroy()
+struct libvxl_inflate* libvxl_inflate_create(void);
+
+//! @brief Free a decompressor and its output
+void libvxl_inflate_destroy(struct libvxl_inflate* inflate);
+
+//! @brief Decompress the next bytes of a stream, packets can be split anywhere
+//! @note Output grows by every symbol that could be decoded, only an incomplete one is kept as input
+//! @returns *0* if the data is not a valid zlib stream, every later call fails as well
+bool libvxl_inflate_feed(struct libvxl_inflate* inflate, const void* data, size_t len);
+
+//! @brief All bytes decompressed so far that were not consumed yet
+//! @param len Pointer to where the byte count will be stored, can be **NULL**
+//! @returns pointer to the bytes, stays valid until the next call to libvxl_inflate_feed() or libvxl_inflate_consume()
+const void* libvxl_inflate_data(struct libvxl_inflate* inflate, size_t* len);
+
+//! @brief Drop bytes from the start of libvxl_inflate_data() that are not needed anymore
+//! @note Only the last 32 KiB of output, which later data can refer to, are kept in memory
+void libvxl_inflate_consume(struct libvxl_inflate* inflate, size_t len);
+
+//! @brief Check if the end of the stream was reached and its checksum matched
+bool libvxl_inflate_done(struct libvxl_inflate* inflate);
+
 #endif